@@ -17,118 +17,120 @@
 #include "types.h"
 #include "param.h"
 #include "spinlock.h"
+#include "rwlock.h"
 #include "sleeplock.h"
 #include "riscv.h"
 #include "defs.h"
+#include "rusage.h"
+#include "proc.h"
 #include "fs.h"
 #include "buf.h"
+#include "stats.h"
+#include "trace.h"
 
-#define BUCKET_SIZE 13
-#define BLOCK_NUM 100
+#define NBUCKET 13
 
 struct {
   struct spinlock lock;
   struct buf buf[NBUF];
 } bcache;
 
+// Cached blocks are found through a hash table of chains
+// linked by b->hnext. Lookups take a bucket's lock for
+// reading, so they don't exclude each other; bcache.lock
+// serializes bget()'s choice of a buffer to recycle, and the
+// changes to the chains that follow, which take the affected
+// buckets' locks for writing.
+//
+// A buffer in use has b->refcnt > 0 and is never recycled.
+// Since get_val() raises refcnt while holding its bucket's
+// lock, and hash_clear() checks it while holding the same
+// lock for writing, a buffer can't be recycled out from under
+// a lookup. refcnt is updated atomically, as readers of a
+// bucket may change it at the same time.
 struct bucket {
-  struct spinlock lock;
-  struct buf *data[BUCKET_SIZE];
+  struct rwlock lock;
+  struct buf *head;
 };
 
-
 struct hashtable {
-  struct bucket item[BLOCK_NUM];
+  struct bucket item[NBUCKET];
 } hash_table;
 
-void hash_set(uint dev, uint blockno, struct buf* b)
+static struct bucket *
+hash_bucket(uint dev, uint blockno)
 {
   // This is safe since currently dev is relatively small
-  int key = dev * 2000 + blockno;
-  int bucket_idx = key / BUCKET_SIZE;
-  struct bucket* buck = &hash_table.item[bucket_idx];
-  static int count = 0;
-  acquire(&buck->lock);
-  for(int idx = 0; idx < BUCKET_SIZE; ++idx)
-  {
-    if(buck->data[idx] == (struct buf*) 0)
-    {
-      buck->data[idx] = b;
-      count++;
-      break;
-
-    }
-  }
-  release(&buck->lock);
+  uint key = dev * 2000 + blockno;
+  return &hash_table.item[key % NBUCKET];
 }
 
-void hash_clear(uint dev, uint blockno)
+// Add b to the chain for its block.
+// Caller must hold bcache.lock.
+static void
+hash_set(struct buf *b)
 {
-  int key = dev * 2000 + blockno;
-  int bucket_idx = key / BUCKET_SIZE;
-  struct bucket* buck = &hash_table.item[bucket_idx];
-  static int count = 0;
-  acquire(&buck->lock);
-  for (int idx = 0; idx < BUCKET_SIZE; ++idx)
-  {
-    if (buck->data[idx] != (struct buf*)0 && buck->data[idx]->dev == dev && buck->data[idx]->blockno == blockno)
-    {
-      count++;
-      buck->data[idx] = (struct buf*)0;
-      break;
-    }
-  }
-  release(&buck->lock);
+  struct bucket *buck = hash_bucket(b->dev, b->blockno);
+
+  acquirewrite(&buck->lock);
+  b->hnext = buck->head;
+  buck->head = b;
+  releasewrite(&buck->lock);
 }
 
-struct buf* get_val(uint dev, uint blockno)
+// Remove b from the chain for its block, so that it can be
+// recycled. Fails, returning -1, if someone has found b
+// since the caller checked that it was unused.
+// Caller must hold bcache.lock.
+static int
+hash_clear(struct buf *b)
 {
-  int key = dev * 2000 + blockno;
-  int bucket_idx = key / BUCKET_SIZE;
-  int find_buf = 0;
-  struct bucket* buck = &hash_table.item[bucket_idx];
-  struct buf* b = (struct buf*) 0;
-  static int count = 0;
-  // acquire(&buck->lock);
-  for (int idx = 0; idx < BUCKET_SIZE; ++idx)
-  {
-    b = buck->data[idx];
-    if (b != (struct buf *)0)
-    {
-      if(b->dev == dev && b->blockno == blockno)
-      {
-        find_buf = 1;
-        count++;
-        break;
-      }
-    }
+  struct bucket *buck = hash_bucket(b->dev, b->blockno);
+  struct buf **pp;
+
+  acquirewrite(&buck->lock);
+  if(b->refcnt != 0){
+    releasewrite(&buck->lock);
+    return -1;
   }
-  // release(&buck->lock);
-  if(!find_buf)
-  {
-    return (struct buf*)0;
+  for(pp = &buck->head; *pp; pp = &(*pp)->hnext){
+    if(*pp == b){
+      *pp = b->hnext;
+      break;
+    }
   }
-  return b;
+  b->hnext = 0;
+  releasewrite(&buck->lock);
+  return 0;
 }
 
-void init_hash_table()
+// Look for a buffer caching block blockno of dev, and if
+// there is one, take a reference to it.
+static struct buf*
+get_val(uint dev, uint blockno)
 {
-  for(int i = 0; i < BLOCK_NUM; ++i)
-  {
-    initlock(&hash_table.item[i].lock, "bcache.bucket");
-    for(int j = 0; j < BUCKET_SIZE; ++j)
-    {
-      hash_table.item[i].data[j] = (struct buf*)0;
+  struct bucket *buck = hash_bucket(dev, blockno);
+  struct buf *b;
+
+  acquireread(&buck->lock);
+  for(b = buck->head; b; b = b->hnext){
+    if(b->dev == dev && b->blockno == blockno){
+      __sync_fetch_and_add(&b->refcnt, 1);
+      break;
     }
   }
+  releaseread(&buck->lock);
+  return b;
 }
 
 void
 binit(void)
 {
   struct buf* b;
-  init_hash_table();
-  initlock(&bcache.lock, "bcache");
+
+  for(int i = 0; i < NBUCKET; ++i)
+    initrwlock(&hash_table.item[i].lock, "bcache.bucket");
+  initmcslock(&bcache.lock, "bcache");
 
   for(b = bcache.buf; b < bcache.buf+NBUF; b++){
     b->ticks_recently_touched = ticks;
@@ -143,43 +145,48 @@ static struct buf*
 bget(uint dev, uint blockno)
 {
   struct buf *b;
-  struct buf* b_oldest = (struct buf*) 0;
-  uint ticks_min = (uint)-1;
-  if((b = get_val(dev, blockno)) != (struct buf*)0)
-  {
-    acquiresleep(&b->lock);
-    b->refcnt++;
-    b->ticks_recently_touched = ticks;
-    return b;
-  }
-
+  struct buf* b_oldest;
+  uint ticks_min;
 
-  acquire(&bcache.lock);
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++ )
-  {
-    if(b->refcnt == 0)
-    {
-      if(b->ticks_recently_touched < ticks_min)
-      {
-        ticks_min = b->ticks_recently_touched;
-        b_oldest = b;
-      }
+  if((b = get_val(dev, blockno)) == 0){
+    acquire(&bcache.lock);
+    // someone else may have cached the block meanwhile.
+    if((b = get_val(dev, blockno)) != 0){
+      release(&bcache.lock);
+    } else {
+      do {
+        b_oldest = 0;
+        ticks_min = 0;
+        for(b = bcache.buf; b < bcache.buf+NBUF; b++){
+          if(b->refcnt == 0 &&
+             (b_oldest == 0 || b->ticks_recently_touched < ticks_min)){
+            ticks_min = b->ticks_recently_touched;
+            b_oldest = b;
+          }
+        }
+        if(b_oldest == 0)
+          panic("bget: no buffers");
+        // clear the mapping from (b_oldest->dev, b_oldest->blockno)
+        // so that no double mapping to b_oldest; try another
+        // buffer if someone has just found this one.
+      } while(hash_clear(b_oldest) < 0);
+      b = b_oldest;
+      b->dev = dev;
+      b->blockno = blockno;
+      b->valid = 0;
+      b->refcnt = 1;
+      hash_set(b);
+      release(&bcache.lock);
+      statadd(STAT_BCACHE_MISS, 1);
+      goto found;
     }
   }
-  if (ticks_min != (uint)-1) // found one buf to evict
-  {
-    // clear the mapping from (b_oldest->dev, b_oldest->blockno) so that no double mapping to b_oldest
-    hash_clear(b_oldest->dev, b_oldest->blockno);
-    b_oldest->dev = dev;
-    b_oldest->blockno = blockno;
-    b_oldest->valid = 0;
-    b_oldest->refcnt = 1;
-    hash_set(dev, blockno, b_oldest);
-    release(&bcache.lock);
-    acquiresleep(&b_oldest->lock);
-    return b_oldest;
-  }
-  panic("bget: no buffers");
+  statadd(STAT_BCACHE_HIT, 1);
+
+found:
+  acquiresleep(&b->lock);
+  b->ticks_recently_touched = ticks;
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -190,18 +197,37 @@ bread(uint dev, uint blockno)
 
   b = bget(dev, blockno);
   if(!b->valid) {
+    TRACE(TR_BREAD_MISS, blockno);
+    if(myproc())
+      myproc()->ru.ru_inblock++;
     virtio_disk_rw(b->dev, b, 0);
     b->valid = 1;
   }
   return b;
 }
 
+// Return a locked buf for the indicated block, filled with
+// zeros rather than read from disk, for a caller that is
+// about to write over the block's old contents.
+struct buf*
+bzeroed(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  memset(b->data, 0, BSIZE);
+  b->valid = 1;
+  return b;
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
 {
   if(!holdingsleep(&b->lock))
     panic("bwrite");
+  if(myproc())
+    myproc()->ru.ru_oublock++;
   virtio_disk_rw(b->dev, b, 1);
 }
 
@@ -213,21 +239,27 @@ brelse(struct buf *b)
   if(!holdingsleep(&b->lock))
     panic("brelse");
 
-  b->refcnt--;
+  __sync_fetch_and_sub(&b->refcnt, 1);
   releasesleep(&b->lock);
 }
 
+// Release a locked buffer whose data is also cached
+// elsewhere (in the page cache), making it the first
+// candidate for reuse.
+void
+brelse_evict(struct buf *b)
+{
+  b->ticks_recently_touched = 0;
+  brelse(b);
+}
+
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
-  b->refcnt++;
-  release(&bcache.lock);
+  __sync_fetch_and_add(&b->refcnt, 1);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
-  b->refcnt--;
-  release(&bcache.lock);
+  __sync_fetch_and_sub(&b->refcnt, 1);
 }
 
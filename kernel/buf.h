@@ -5,8 +5,7 @@ struct buf {
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
-  struct buf *next;
+  struct buf *hnext; // hash bucket chain in bio.c
   uchar data[BSIZE];
   uint ticks_recently_touched;
 };
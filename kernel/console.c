@@ -20,7 +20,9 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "defs.h"
+#include "rusage.h"
 #include "proc.h"
+#include "poll.h"
 
 #define BACKSPACE 0x100
 #define C(x)  ((x)-'@')  // Control-x
@@ -58,30 +60,37 @@ struct {
 } cons;
 
 //
-// user write()s to the console go here.
+// user write()s to the console go here. copies a chunk
+// at a time into the uart's output ring, waiting for room
+// unless f is O_NONBLOCK.
 //
 int
 consolewrite(struct file *f, int user_src, uint64 src, int n)
 {
-  int i;
+  char buf[128];
+  int i, m, r;
 
-  acquire(&cons.lock);
-  for(i = 0; i < n; i++){
-    char c;
-    if(either_copyin(&c, user_src, src+i, 1) == -1)
+  for(i = 0; i < n; i += r){
+    m = n - i < sizeof(buf) ? n - i : sizeof(buf);
+    if(either_copyin(buf, user_src, src+i, m) == -1)
+      break;
+    r = uartwrite(buf, m, f->nonblock);
+    if(r < m){
+      i += r;
       break;
-    consputc(c);
+    }
   }
-  release(&cons.lock);
-
-  return n;
+  if(i == 0 && n > 0)
+    return -1;
+  return i;
 }
 
 //
 // user read()s from the console go here.
 // copy (up to) a whole input line to dst.
 // user_dist indicates whether dst is a user
-// or kernel address.
+// or kernel address. if f is O_NONBLOCK,
+// fail rather than wait for a line.
 //
 int
 consoleread(struct file *f, int user_dst, uint64 dst, int n)
@@ -96,7 +105,7 @@ consoleread(struct file *f, int user_dst, uint64 dst, int n)
     // wait until interrupt handler has put some
     // input into cons.buffer.
     while(cons.r == cons.w){
-      if(myproc()->killed){
+      if(myproc()->killed || (f->nonblock && n == target)){
         release(&cons.lock);
         return -1;
       }
@@ -133,6 +142,25 @@ consoleread(struct file *f, int user_dst, uint64 dst, int n)
   return target - n;
 }
 
+//
+// poll() on the console: readable once a whole line
+// (or end-of-file) has arrived, writable while the
+// uart's output ring has room.
+//
+int
+consolepoll(struct file *f)
+{
+  int r = 0;
+
+  if(uartwritable())
+    r |= POLLOUT;
+  acquire(&cons.lock);
+  if(cons.r != cons.w)
+    r |= POLLIN;
+  release(&cons.lock);
+  return r;
+}
+
 //
 // the console input interrupt handler.
 // uartintr() calls this for input character.
@@ -177,6 +205,7 @@ consoleintr(int c)
         // has arrived.
         cons.w = cons.e;
         wakeup(&cons.r);
+        pollwakeup();
       }
     }
     break;
@@ -192,8 +221,9 @@ consoleinit(void)
 
   uartinit();
 
-  // connect read and write system calls
-  // to consoleread and consolewrite.
+  // connect read, write and poll system calls
+  // to consoleread, consolewrite and consolepoll.
   devsw[CONSOLE].read = consoleread;
   devsw[CONSOLE].write = consolewrite;
+  devsw[CONSOLE].poll = consolepoll;
 }
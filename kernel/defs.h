@@ -1,18 +1,24 @@
 struct buf;
 struct context;
+struct epoll;
+struct iovec;
 struct file;
 struct inode;
 struct pipe;
 struct proc;
+struct rwlock;
 struct spinlock;
 struct sleeplock;
+struct spawn_action;
 struct stat;
 struct superblock;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+struct buf*     bzeroed(uint, uint);
 void            brelse(struct buf*);
+void            brelse_evict(struct buf*);
 void            bwrite(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
@@ -24,6 +30,9 @@ void            consputc(int);
 
 // exec.c
 int             exec(char*, char**);
+int             loadexec(struct proc*, char*, char**);
+int             execfault(struct proc*, uint64);
+void            execprefault(struct proc*, uint64, uint64);
 
 // file.c
 struct file*    filealloc(void);
@@ -33,9 +42,16 @@ void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
+int             filepoll(struct file*);
+int             filereadv(struct file*, struct iovec*, int, int);
+int             filewritev(struct file*, struct iovec*, int, int);
+int             fileseek(struct file*, int, int);
+int             filetruncate(struct file*, int);
+int             fileprealloc(struct file*, int, int);
 
 // fs.c
 void            fsinit(int);
+void            bcommitted(int);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
@@ -50,46 +66,111 @@ int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, int, uint64, uint, uint);
+int             readblocks(struct inode*, int, uint64, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
+int             writeblocks(struct inode*, int, uint64, uint, uint);
+int             iflush(struct inode*);
+int             iprealloc(struct inode*, uint, uint);
+int             itruncate(struct inode*, uint);
+void            itruncd(void);
 
 // ramdisk.c
 void            ramdiskinit(void);
 void            ramdiskintr(void);
 void            ramdiskrw(struct buf*);
 
+// futex.c
+void            futexinit(void);
+int             futex_wait(uint64, int);
+int             futex_wake(uint64, int);
+
 // kalloc.c
 void*           kalloc(void);
 void            kfree(void *);
 void            kinit();
 void            set_ref_count(uint8 *addr, uint8 count);
 uint8           get_ref_count(uint8 *addr);
+uint8           add_ref_count(uint8 *addr, int d);
 
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
 void            begin_op(int);
 void            end_op(int);
+void            log_sync(int);
 void            crash_op(int,int);
 
+// pagecache.c
+void            pagecacheinit(void);
+uint64          pagecache_get(struct inode*, uint, int);
+int             pagecache_reclaim(void);
+int             pagecache_invalidate(struct inode*, uint, uint);
+void            pagecache_truncate(struct inode*, uint);
+void            pagecache_drop(struct inode*);
+void            pagecache_dirty(struct inode*, uint);
+int             pagecache_nextdirty(struct inode*, uint, uint64*);
+void            pagecache_clean(struct inode*, uint);
+void            pagecache_flush(struct inode*, int);
+void            pagecache_throttle(struct inode*);
+void            pageflushd(void);
+
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
-int             piperead(struct pipe*, uint64, int);
-int             pipewrite(struct pipe*, uint64, int);
+int             piperead(struct pipe*, uint64, int, int);
+int             pipewrite(struct pipe*, uint64, int, int);
+int             pipepoll(struct pipe*, int);
+
+// poll.c
+void            pollinit(void);
+void            pollwakeup(void);
+void            polltick(void);
+int             poll(uint64, int, int);
+int             epollalloc(struct file**);
+void            epollclose(struct epoll*);
+int             epollctl(struct file*, int, int, uint64);
+int             epollwait(struct file*, uint64, int, int);
 
 // printf.c
 void            printf(char*, ...);
+void            klog(int, char*, ...);
 void            panic(char*) __attribute__((noreturn));
-void            printfinit(void);
+int             snprintf(char*, int, char*, ...);
+
+// klog.c
+struct ratelimit {
+  uint start;     // ticks when the interval began
+  int n;          // messages in it so far
+  int missed;     // and how many of them were suppressed
+};
+void            kloginit(void);
+void            klogput(int, char*, int);
+void            klogtick(void);
+void            klogd(void);
+void            klogpanic(void);
+int             ratelimit(struct ratelimit*);
+
+// klog() at most a few times a second from one call site.
+#define klog_ratelimited(level, ...) \
+  do { static struct ratelimit rl_; if(ratelimit(&rl_)) klog((level), __VA_ARGS__); } while(0)
 
 // proc.c
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
+int             clone(uint64, uint64, uint64);
+struct proc*    kthread(struct proc*, void (*)(void), void*);
+void            kthreadreap(struct proc*);
+int             vfork(void);
+void            vforkdone(struct proc*);
+int             spawn(char*, char**, struct spawn_action*, int);
 int             growproc(int);
 pagetable_t     proc_pagetable(struct proc *);
-void            proc_freepagetable(pagetable_t, uint64);
+void            proc_freepagetable(pagetable_t, uint64, uint64);
+void            proc_setsz(struct proc*, uint64);
+uint64          shrinkproc(struct proc*, uint64);
+struct spinlock* vmlock(pagetable_t);
 int             kill(int);
 struct cpu*     mycpu(void);
 struct cpu*     getmycpu(void);
@@ -101,11 +182,19 @@ void            setproc(struct proc*);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
 int             wait(uint64);
+int             join(uint64);
 void            wakeup(void*);
+int             wakeupn(void*, int);
 void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
+int             mapsysring(struct proc*);
+void            tlbinval(pagetable_t, uint64, uint64);
+uint64          usersatp(struct proc*);
+void            rucharge(struct proc*, uint64*);
+int             getrusage(int, uint64);
+int             getprocs(uint64, int);
 
 // swtch.S
 void            swtch(struct context*, struct context*);
@@ -113,18 +202,47 @@ void            swtch(struct context*, struct context*);
 // spinlock.c
 void            acquire(struct spinlock*);
 int             holding(struct spinlock*);
+int             holdingany(void);
 void            initlock(struct spinlock*, char*);
+void            initmcslock(struct spinlock*, char*);
 void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
 uint64          sys_ntas(void);
 
+// prof.c
+extern int      profiling;
+void            profinit(void);
+void            profsample(uint64, uint64, int);
+
+// rcu.c
+void            rcuinit(void);
+void            rcu_online(void);
+void            rcu_read_lock(void);
+void            rcu_read_unlock(void);
+void            rcu_quiescent(void);
+int             kfree_rcu(void*);
+int             synchronize_rcu(void);
+
+// rwlock.c
+void            initrwlock(struct rwlock*, char*);
+void            acquireread(struct rwlock*);
+void            releaseread(struct rwlock*);
+void            acquirewrite(struct rwlock*);
+void            releasewrite(struct rwlock*);
+int             holdingwrite(struct rwlock*);
+
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
 
+// stats.c
+void            statsinit(void);
+void            statadd(int, uint64);
+void            statsyscall(int);
+
 // string.c
 int             memcmp(const void*, const void*, uint);
 void*           memmove(void*, const void*, uint);
@@ -141,6 +259,17 @@ int             argaddr(int, uint64 *);
 int             fetchstr(uint64, char*, int);
 int             fetchaddr(uint64, uint64*);
 void            syscall();
+char*           syscallname(int);
+uint64          syscallbatch(int, uint64*);
+
+// sysring.c
+void            sysringinit(void);
+void            aiostop(struct proc*);
+
+// trace.c
+extern int      tracing;
+void            traceinit(void);
+void            trace(int, uint64);
 
 // trap.c
 extern uint     ticks;
@@ -153,9 +282,13 @@ void            usertrapret(void);
 void            uartinit(void);
 void            uartintr(void);
 void            uartputc(int);
+int             uartwrite(char*, int, int);
+int             uartwritable(void);
+void            uartpanic(void);
 int             uartgetc(void);
 
 // vm.c
+extern uint     maxasid;
 void            kvminit(void);
 void            kvminithart(void);
 uint64          kvmpa(uint64);
@@ -168,6 +301,7 @@ uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
+uint64          uvmunmaprcu(pagetable_t, uint64, uint64);
 void            uvmclear(pagetable_t, uint64);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
@@ -176,6 +310,7 @@ int             copyinstr(pagetable_t, char *, uint64, uint64);
 void            free_pagetable(pagetable_t, uint64);
 int             handle_lazy_allocation(struct proc *, uint64);
 int             handle_store_fault(struct proc *, uint64);
+uint64          useraddr(struct proc *, uint64);
 void            vmprint(pagetable_t);
 pte_t*          find_pte_leaf(uint64);
 
@@ -213,3 +348,6 @@ void lst_push(struct list*, void *);
 void *lst_pop(struct list*);
 void lst_print(struct list*);
 int lst_empty(struct list*);
+
+// record a trace event (see trace.c); one branch when not tracing.
+#define TRACE(type, arg) do { if(tracing) trace((type), (arg)); } while(0)
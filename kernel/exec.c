@@ -3,23 +3,32 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "rusage.h"
 #include "proc.h"
 #include "defs.h"
 #include "elf.h"
 
-static int loadseg(pde_t *pgdir, uint64 addr, struct inode *ip, uint offset, uint sz);
-
+// Replace p's user memory with the program at path,
+// with argv on its stack. p need not be the current
+// process, but the path is looked up relative to the
+// current directory. Returns argc, or -1 with p's old
+// image untouched.
+// The program's segments aren't read in here: execfault()
+// pages them in from the file as p touches them.
 int
-exec(char *path, char **argv)
+loadexec(struct proc *p, char *path, char **argv)
 {
   char *s, *last;
-  int i, off;
-  uint64 argc, sz, sp, ustack[MAXARG+1], stackbase;
+  int i, off, nseg;
+  uint64 argc, sz, sp, ustack[MAXARG+1], stackbase, oldtfva;
   struct elfhdr elf;
-  struct inode *ip;
+  struct inode *ip, *oldip;
   struct proghdr ph;
+  struct execseg seg[NEXECSEG];
   pagetable_t pagetable = 0, oldpagetable;
-  struct proc *p = myproc();
 
   begin_op(ROOTDEV);
 
@@ -37,8 +46,10 @@ exec(char *path, char **argv)
   if((pagetable = proc_pagetable(p)) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Note where the program's segments go; execfault()
+  // will read them in.
   sz = 0;
+  nseg = 0;
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -48,18 +59,25 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr + ph.memsz < ph.vaddr)
       goto bad;
-    if((sz = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz)) == 0)
+    if(ph.off + ph.filesz < ph.off || ph.off + ph.filesz > ip->size)
       goto bad;
-    if(ph.vaddr % PGSIZE != 0)
+    if(ph.vaddr + ph.memsz >= SYSRING)
       goto bad;
-    if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(nseg >= NEXECSEG)
       goto bad;
+    seg[nseg].va = ph.vaddr;
+    seg[nseg].memsz = ph.memsz;
+    seg[nseg].off = ph.off;
+    seg[nseg].filesz = ph.filesz;
+    seg[nseg].writable = (ph.flags & ELF_PROG_FLAG_WRITE) != 0;
+    nseg++;
+    if(ph.vaddr + ph.memsz > sz)
+      sz = ph.vaddr + ph.memsz;
   }
-  iunlockput(ip);
+  // keep the reference to ip, for execfault().
+  iunlock(ip);
   end_op(ROOTDEV);
-  ip = 0;
 
-  p = myproc();
   uint64 oldsz = p->sz;
 
   // Allocate two pages at the next page boundary.
@@ -106,48 +124,154 @@ exec(char *path, char **argv)
   // vmprint(pagetable);
   // Commit to the user image.
   oldpagetable = p->pagetable;
+  oldtfva = p->tfva;
+  oldip = p->execip;
   p->pagetable = pagetable;
+  p->asidgen = 0;  // the old ASID's TLB entries are for oldpagetable
   p->sz = sz;
+  p->execip = ip;
+  memmove(p->execseg, seg, sizeof(seg));
+  p->nexecseg = nseg;
   p->tf->epc = elf.entry;  // initial program counter = main
   p->tf->sp = sp; // initial stack pointer
-  proc_freepagetable(oldpagetable, oldsz);
+  // a clone() thread that execs leaves its group and
+  // becomes an ordinary child of its creator.
+  p->tfva = TRAPFRAME;
+  p->thread = 0;
+  aiostop(p);
+  proc_freepagetable(oldpagetable, oldsz, oldtfva);
+  if(oldip){
+    begin_op(ROOTDEV);
+    iput(oldip);
+    end_op(ROOTDEV);
+  }
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
 
  bad:
   if(pagetable)
-    proc_freepagetable(pagetable, sz);
+    proc_freepagetable(pagetable, sz, TRAPFRAME);
   if(ip){
-    iunlockput(ip);
+    if(holdingsleep(&ip->lock))
+      iunlockput(ip);
+    else {
+      begin_op(ROOTDEV);
+      iput(ip);
+    }
     end_op(ROOTDEV);
   }
   return -1;
 }
 
-// Load a program segment into pagetable at virtual address va.
-// va must be page-aligned
-// and the pages from va to va+sz must already be mapped.
-// Returns 0 on success, -1 on failure.
-static int
-loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz)
+int
+exec(char *path, char **argv)
 {
-  uint i, n;
-  uint64 pa;
-
-  if((va % PGSIZE) != 0)
-    panic("loadseg: va must be page aligned");
-
-  for(i = 0; i < sz; i += PGSIZE){
-    pa = walkaddr(pagetable, va + i);
-    if(pa == 0)
-      panic("loadseg: address should exist");
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
-      n = PGSIZE;
-    if(readi(ip, 0, (uint64)pa, offset+i, n) != n)
-      return -1;
+  struct proc *p = myproc();
+  int argc;
+
+  argc = loadexec(p, path, argv);
+  if(argc >= 0 && p->vfork)
+    vforkdone(p);
+  return argc;
+}
+
+// Map the page at va of p's program image, reading it in
+// from p->execip. A page that holds nothing but file data
+// comes from the inode's page cache and is shared with every
+// other process running the program, copy-on-write if its
+// segment is writable. Pages only partly backed by the file
+// get a private copy.
+// Returns 1 if no file data backs va (the caller should map
+// a zero page), 0 if va is now mapped, and -1 on failure.
+int
+execfault(struct proc *p, uint64 va)
+{
+  struct execseg *s, *share;
+  struct inode *ip = p->execip;
+  uint64 a, end, pa;
+  int i, perm, needread;
+
+  va = PGROUNDDOWN(va);
+  share = 0;
+  needread = 0;
+  for(i = 0; i < p->nexecseg; i++){
+    s = &p->execseg[i];
+    if(va + PGSIZE <= s->va || va >= s->va + s->filesz)
+      continue;
+    needread = 1;
+    if(s->va <= va && va + PGSIZE <= s->va + s->filesz &&
+       (s->off + (va - s->va)) % PGSIZE == 0)
+      share = s;
+  }
+  if(!needread)
+    return 1;
+
+  // reading the file may sleep. callers that hold spinlocks
+  // across copyin()/copyout() prefault with execprefault().
+  if(holdingany())
+    return -1;
+
+  ilock(ip);
+  if(walkaddr(p->pagetable, va) != 0){
+    // another thread sharing p's memory got here first.
+    iunlock(ip);
+    return 0;
+  }
+  if(share){
+    if((pa = pagecache_get(ip, (share->off + (va - share->va)) / PGSIZE, 0)) == 0)
+      goto bad;
+    perm = PTE_R | PTE_X | PTE_U;
+    if(share->writable)
+      perm |= PTE_COW;
+  } else {
+    if((pa = (uint64)kalloc()) == 0)
+      goto bad;
+    memset((void*)pa, 0, PGSIZE);
+    for(i = 0; i < p->nexecseg; i++){
+      s = &p->execseg[i];
+      a = va > s->va ? va : s->va;
+      end = va + PGSIZE < s->va + s->filesz ? va + PGSIZE : s->va + s->filesz;
+      if(a >= end)
+        continue;
+      if(readi(ip, 0, pa + (a - va), s->off + (a - s->va), end - a) != end - a){
+        kfree((void*)pa);
+        goto bad;
+      }
+    }
+    perm = PTE_R | PTE_W | PTE_X | PTE_U;
+  }
+  iunlock(ip);
+
+  if(mappages(p->pagetable, va, PGSIZE, pa, perm) != 0){
+    kfree((void*)pa);
+    return -1;
   }
-  
   return 0;
+
+ bad:
+  iunlock(ip);
+  return -1;
+}
+
+// Page in the file-backed pages of p's program image in
+// [va, va+n), so that copyin() and copyout() find them mapped
+// later, when they may be running with spinlocks held.
+void
+execprefault(struct proc *p, uint64 va, uint64 n)
+{
+  struct execseg *s;
+  uint64 a, end;
+  int i;
+
+  for(i = 0; i < p->nexecseg; i++){
+    s = &p->execseg[i];
+    a = va > s->va ? va : s->va;
+    end = va + n < s->va + s->filesz ? va + n : s->va + s->filesz;
+    if(va + n < va || end > p->sz)
+      end = p->sz;
+    for(a = PGROUNDDOWN(a); a < end; a += PGSIZE){
+      if(walkaddr(p->pagetable, a) == 0)
+        execfault(p, a);
+    }
+  }
 }
@@ -3,3 +3,13 @@
 #define O_RDWR    0x002
 #define O_CREATE  0x200
 #define O_NOFOLLOW 0x008
+#define O_NONBLOCK 0x800  // pipes and the console fail rather than wait
+
+// lseek() whence
+#define SEEK_SET  0
+#define SEEK_CUR  1
+#define SEEK_END  2
+
+// fcntl() commands
+#define F_GETFL   3   // return the O_NONBLOCK flag
+#define F_SETFL   4   // set it
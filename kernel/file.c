@@ -11,6 +11,10 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "stat.h"
+#include "fcntl.h"
+#include "poll.h"
+#include "uio.h"
+#include "rusage.h"
 #include "proc.h"
 
 struct devsw devsw[NDEV];
@@ -35,6 +39,7 @@ filealloc(void)
   for(f = ftable.file; f < ftable.file + NFILE; f++){
     if(f->ref == 0){
       f->ref = 1;
+      f->nonblock = 0;
       release(&ftable.lock);
       return f;
     }
@@ -75,6 +80,8 @@ fileclose(struct file *f)
 
   if(ff.type == FD_PIPE){
     pipeclose(ff.pipe, ff.writable);
+  } else if(ff.type == FD_EPOLL){
+    epollclose(ff.ep);
   } else if(ff.type == FD_INODE || ff.type == FD_DEVICE){
     begin_op(ff.ip->dev);
     iput(ff.ip);
@@ -101,27 +108,56 @@ filestat(struct file *f, uint64 addr)
   return -1;
 }
 
+// Return which of POLLIN, POLLOUT, POLLERR and POLLHUP
+// describe f right now; see poll.c.
+int
+filepoll(struct file *f)
+{
+  int r;
+
+  if(f->type == FD_PIPE){
+    r = pipepoll(f->pipe, f->writable);
+  } else if(f->type == FD_DEVICE){
+    if(f->major < 0 || f->major >= NDEV)
+      return POLLERR;
+    if(devsw[f->major].poll)
+      r = devsw[f->major].poll(f);
+    else
+      r = POLLIN | POLLOUT;
+  } else if(f->type == FD_INODE){
+    // files never make a reader or writer wait.
+    r = POLLIN | POLLOUT;
+  } else {
+    return 0;
+  }
+  if(!f->readable)
+    r &= ~POLLIN;
+  if(!f->writable)
+    r &= ~POLLOUT;
+  return r;
+}
+
 // Read from file f.
 // addr is a user virtual address.
 int
 fileread(struct file *f, uint64 addr, int n)
 {
+  struct iovec iov;
   int r = 0;
 
   if(f->readable == 0)
     return -1;
 
   if(f->type == FD_PIPE){
-    r = piperead(f->pipe, addr, n);
+    r = piperead(f->pipe, addr, n, f->nonblock);
   } else if(f->type == FD_DEVICE){
     if(f->major < 0 || f->major >= NDEV || !devsw[f->major].read)
       return -1;
     r = devsw[f->major].read(f, 1, addr, n);
   } else if(f->type == FD_INODE){
-    ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
-      f->off += r;
-    iunlock(f->ip);
+    iov.iov_base = (void *)addr;
+    iov.iov_len = n;
+    r = filereadv(f, &iov, 1, -1);
   } else {
     panic("fileread");
   }
@@ -134,49 +170,241 @@ fileread(struct file *f, uint64 addr, int n)
 int
 filewrite(struct file *f, uint64 addr, int n)
 {
-  int r, ret = 0;
+  struct iovec iov;
+  int ret = 0;
 
   if(f->writable == 0)
     return -1;
 
   if(f->type == FD_PIPE){
-    ret = pipewrite(f->pipe, addr, n);
+    ret = pipewrite(f->pipe, addr, n, f->nonblock);
   } else if(f->type == FD_DEVICE){
     if(f->major < 0 || f->major >= NDEV || !devsw[f->major].write)
       return -1;
     ret = devsw[f->major].write(f, 1, addr, n);
   } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
-    // this really belongs lower down, since writei()
-    // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
-
-      begin_op(f->ip->dev);
-      ilock(f->ip);
-      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
-        f->off += r;
-      iunlock(f->ip);
-      end_op(f->ip->dev);
+    iov.iov_base = (void *)addr;
+    iov.iov_len = n;
+    ret = filewritev(f, &iov, 1, -1);
+  } else {
+    panic("filewrite");
+  }
+
+  return ret;
+}
+
+// Read into the cnt buffers at iov, in order, from file f at
+// offset off, or at f->off if off is -1, advancing it. The
+// buffers are user addresses. A file's buffers are filled in
+// one pass under ip->lock, so no write comes between them.
+// Pipes and devices have no offset to read at.
+int
+filereadv(struct file *f, struct iovec *iov, int cnt, int off)
+{
+  int i, r, tot;
+  uint o;
+
+  if(f->readable == 0)
+    return -1;
 
+  if(f->type != FD_INODE){
+    if(off != -1)
+      return -1;
+    // fill later buffers only with what has already arrived.
+    tot = 0;
+    for(i = 0; i < cnt; i++){
+      if(i == 0)
+        r = fileread(f, (uint64)iov[i].iov_base, iov[i].iov_len);
+      else if(f->type == FD_PIPE)
+        r = piperead(f->pipe, (uint64)iov[i].iov_base, iov[i].iov_len, 1);
+      else
+        break;
       if(r < 0)
+        return i == 0 ? -1 : tot;
+      tot += r;
+      if(r < iov[i].iov_len)
+        break;
+    }
+    return tot;
+  }
+
+  ilock(f->ip);
+  o = (off == -1) ? f->off : off;
+  tot = 0;
+  for(i = 0; i < cnt; i++){
+    if((r = readi(f->ip, 1, (uint64)iov[i].iov_base, o + tot, iov[i].iov_len)) < 0){
+      if(i == 0)
+        tot = -1;
+      break;
+    }
+    tot += r;
+    if(r < iov[i].iov_len)
+      break;
+  }
+  if(off == -1 && tot > 0)
+    f->off += tot;
+  iunlock(f->ip);
+  return tot;
+}
+
+// Write the cnt buffers at iov, in order, to file f at offset
+// off, or at f->off if off is -1, advancing it. The buffers
+// are user addresses. Returns the bytes written, which is
+// fewer than asked for if a write fell short, or -1 if none
+// could be written.
+int
+filewritev(struct file *f, struct iovec *iov, int cnt, int off)
+{
+  int max, i, n1, r, left, tot;
+  uint64 done;
+  uint o;
+
+  if(f->writable == 0)
+    return -1;
+
+  tot = 0;
+  if(f->type != FD_INODE){
+    if(off != -1)
+      return -1;
+    for(i = 0; i < cnt; i++){
+      if((r = filewrite(f, (uint64)iov[i].iov_base, iov[i].iov_len)) < 0)
+        break;
+      tot += r;
+      if(r < iov[i].iov_len)
+        break;
+    }
+    return (tot > 0 || i == cnt) ? tot : -1;
+  }
+
+  // each transaction writes as many of the buffers as fit.
+  i = 0;
+  done = 0;
+  o = (off == -1) ? 0 : off;
+  r = 0;
+  while(i < cnt && r >= 0){
+    begin_op(f->ip->dev);
+    ilock(f->ip);
+    if(off == -1)
+      o = f->off;
+    // write a few blocks at a time to avoid exceeding the
+    // maximum log transaction size. a regular file's data
+    // goes to the page cache, or if that fails, straight to
+    // disk (see writeblocks()), so for one of those the log
+    // only needs room for the i-node, the indirect blocks and
+    // the bitmap blocks: no more than two bitmap and three
+    // indirect blocks per N_INDERECT_L1 data blocks. anything else is logged in full, which
+    // needs the i-node, an indirect block, allocation blocks,
+    // and 2 blocks of slop for non-aligned writes.
+    if(f->ip->type == T_FILE)
+      max = N_INDERECT_L1 * BSIZE;
+    else
+      max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+    for(left = max; i < cnt && left > 0; left -= r){
+      n1 = iov[i].iov_len - done;
+      if(n1 > left)
+        n1 = left;
+      if((r = writei(f->ip, 1, (uint64)iov[i].iov_base + done, o, n1)) < 0)
         break;
       if(r != n1)
         panic("short filewrite");
-      i += r;
+      tot += r;
+      o += r;
+      if((done += r) == iov[i].iov_len){
+        i++;
+        done = 0;
+      }
     }
-    ret = (i == n ? n : -1);
-  } else {
-    panic("filewrite");
+    if(off == -1)
+      f->off = o;
+    iunlock(f->ip);
+    end_op(f->ip->dev);
+    if(f->ip->type == T_FILE)
+      pagecache_throttle(f->ip);
   }
+  return (tot > 0 || i == cnt) ? tot : -1;
+}
 
-  return ret;
+// Move f's offset to off bytes from the start of the file,
+// the current offset or the end, as whence says. The offset
+// may be past the end of the file: a write there leaves a hole.
+// Returns the new offset, or -1.
+int
+fileseek(struct file *f, int off, int whence)
+{
+  int base;
+
+  if(f->type != FD_INODE)
+    return -1;
+  ilock(f->ip);
+  if(whence == SEEK_SET)
+    base = 0;
+  else if(whence == SEEK_CUR)
+    base = f->off;
+  else if(whence == SEEK_END)
+    base = f->ip->size;
+  else
+    base = -1;
+  if(base < 0 || base + off < 0 || base + off > MAXFILE*BSIZE){
+    iunlock(f->ip);
+    return -1;
+  }
+  f->off = base + off;
+  iunlock(f->ip);
+  return f->off;
+}
+
+// Set the size of the regular file f to size. Shrinking a
+// big file may take several transactions.
+int
+filetruncate(struct file *f, int size)
+{
+  int r;
+
+  if(f->type != FD_INODE || !f->writable || size < 0)
+    return -1;
+  do {
+    begin_op(f->ip->dev);
+    ilock(f->ip);
+    r = itruncate(f->ip, size);
+    iunlock(f->ip);
+    end_op(f->ip->dev);
+  } while(r == 1);
+  return r;
 }
 
+// Give the len bytes at off in the regular file f disk blocks
+// now, zero-filled where there were none, and contiguous as far
+// as possible, so later writes there can't run out of space.
+// The file grows to off+len if it is shorter. Returns -1 if
+// the disk fills up first.
+int
+fileprealloc(struct file *f, int off, int len)
+{
+  struct inode *ip = f->ip;
+  uint bn, end;
+  int r;
+
+  if(f->type != FD_INODE || !f->writable || off < 0 || len <= 0 ||
+     (uint)off + len > MAXFILE*BSIZE || ip->type != T_FILE)
+    return -1;
+  bn = off / BSIZE;
+  end = ((uint)off + len + BSIZE - 1) / BSIZE;
+  // as many blocks as fit in each transaction.
+  for(;;){
+    begin_op(ip->dev);
+    ilock(ip);
+    if((r = iprealloc(ip, bn, end - bn)) < 0){
+      iunlock(ip);
+      end_op(ip->dev);
+      return -1;
+    }
+    bn += r;
+    r = 0;
+    if(bn == end && off + len > ip->size)
+      r = itruncate(ip, off + len);
+    iunlock(ip);
+    end_op(ip->dev);
+    if(bn == end)
+      return r;
+  }
+}
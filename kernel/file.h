@@ -1,13 +1,15 @@
 struct file {
-  enum { FD_NONE, FD_PIPE, FD_INODE, FD_DEVICE } type;
+  enum { FD_NONE, FD_PIPE, FD_INODE, FD_DEVICE, FD_EPOLL } type;
   int ref; // reference count
   char readable;
   char writable;
+  char nonblock;     // O_NONBLOCK
   struct pipe *pipe; // FD_PIPE
   struct inode *ip;  // FD_INODE and FD_DEVICE
   uint off;          // FD_INODE and FD_DEVICE
   short major;       // FD_DEVICE
   short minor;       // FD_DEVICE
+  struct epoll *ep;  // FD_EPOLL
 };
 
 #define major(dev)  ((dev) >> 16 & 0xFFFF)
@@ -28,15 +30,24 @@ struct inode {
   short nlink;
   uint size;
   uint addrs[N_DIRECT+2];
+
+  uint64 *pages;      // page cache, see pagecache.c
+  struct inode *pcnext; // next inode with cached pages
+  int ndirty;         // dirty pages, guarded by pagecache_lock
+  int ondirty;        // on the dirty list?
+  struct inode *dirtynext; // next inode on the dirty list
+  struct inode *truncnext; // next inode for itruncd
 };
 
 // map major device number to device functions.
 struct devsw {
   int (*read)(struct file *, int, uint64, int);
   int (*write)(struct file *, int, uint64, int);
+  int (*poll)(struct file *);   // or 0 if it never blocks
 };
 
 extern struct devsw devsw[];
 
 #define DISK 0
 #define CONSOLE 1
+#define STATS   2
@@ -15,6 +15,8 @@
 #include "param.h"
 #include "stat.h"
 #include "spinlock.h"
+#include "rwlock.h"
+#include "rusage.h"
 #include "proc.h"
 #include "sleeplock.h"
 #include "fs.h"
@@ -22,7 +24,9 @@
 #include "file.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
-static void itrunc(struct inode *);
+#define FLUSHBATCH 64 // most pages iflush() writes at once
+static int itrunc(struct inode *);
+static void iorphans(int);
 // there should be one superblock per disk device, but we run with
 // only one device
 struct superblock sb;
@@ -45,6 +49,7 @@ void fsinit(int dev)
   if (sb.magic != FSMAGIC)
     panic("invalid file system");
   initlog(dev, &sb);
+  iorphans(dev);
 }
 
 // Zero a block.
@@ -61,9 +66,30 @@ bzero(int dev, int bno)
 
 // Blocks.
 
-// Allocate a zeroed disk block.
+// Blocks freed by the transaction that hasn't committed yet.
+// They stay allocated in effect until it does: data is written
+// in place, so if one were handed out again and written, a crash
+// before the commit would leave the old owner pointing at the
+// new owner's data. Each block's bit is protected by the lock
+// on its bitmap block, and bcommitted() clears them all.
+static uchar bfreed[NDISK][FSSIZE / 8 + 1];
+#define BFREED(dev, b) (bfreed[dev][(b) / 8] & (1 << ((b) % 8)))
+
+// The log calls this once a transaction has committed, while
+// no others are under way.
+void
+bcommitted(int dev)
+{
+  memset(bfreed[dev], 0, sizeof(bfreed[dev]));
+}
+
+// Allocate a run of up to n contiguous disk blocks, starting
+// at the first free one and described by the same bitmap
+// block. Sets *got to how many it allocated, and returns the
+// first, or 0 if the disk is full. The caller must write all
+// of them itself before the transaction commits.
 static uint
-balloc(uint dev)
+ballocrun(uint dev, uint n, uint *got)
 {
   int b, bi, m;
   struct buf *bp;
@@ -75,18 +101,39 @@ balloc(uint dev)
     for (bi = 0; bi < BPB && b + bi < sb.size; bi++)
     {
       m = 1 << (bi % 8);
-      if ((bp->data[bi / 8] & m) == 0)
-      {                        // Is block free?
-        bp->data[bi / 8] |= m; // Mark block in use.
+      if ((bp->data[bi / 8] & m) == 0 && !BFREED(dev, b + bi))
+      { // Is block free?
+        for (*got = 0; *got < n && bi + *got < BPB && b + bi + *got < sb.size; (*got)++)
+        {
+          m = 1 << ((bi + *got) % 8);
+          if ((bp->data[(bi + *got) / 8] & m) || BFREED(dev, b + bi + *got))
+            break;
+          bp->data[(bi + *got) / 8] |= m; // Mark block in use.
+        }
         log_write(bp);
         brelse(bp);
-        bzero(dev, b + bi);
         return b + bi;
       }
     }
     brelse(bp);
   }
-  panic("balloc: out of blocks");
+  *got = 0;
+  return 0;
+}
+
+// Allocate a disk block, zeroed through the log if zero.
+// Otherwise the caller must write all of the block itself
+// before the transaction commits.
+static uint
+balloc(uint dev, int zero)
+{
+  uint b, got;
+
+  if ((b = ballocrun(dev, 1, &got)) == 0)
+    panic("balloc: out of blocks");
+  if (zero)
+    bzero(dev, b);
+  return b;
 }
 
 // Free a disk block.
@@ -102,6 +149,7 @@ bfree(int dev, uint b)
   if ((bp->data[bi / 8] & m) == 0)
     panic("freeing free block");
   bp->data[bi / 8] &= ~m;
+  bfreed[dev][b / 8] |= 1 << (b % 8);
   log_write(bp);
   brelse(bp);
 }
@@ -166,10 +214,14 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The icache.lock spin-lock protects the allocation of icache
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold icache.lock while using any of those fields.
+// The icache.lock reader-writer lock protects the allocation
+// of icache entries. Since ip->ref indicates whether an entry
+// is free, and ip->dev and ip->inum indicate which i-node an
+// entry holds, one must hold icache.lock while using any of
+// those fields. Holding it for reading is enough to look
+// entries up and to raise ip->ref of an entry in use (with an
+// atomic add, since other readers may do the same); changing
+// dev or inum, or lowering ref, needs it for writing.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
@@ -177,15 +229,22 @@ bfree(int dev, uint b)
 
 struct
 {
-  struct spinlock lock;
+  struct rwlock lock;
   struct inode inode[NINODE];
 } icache;
 
+// Inodes that itruncd is to free, linked through ip->truncnext.
+static struct {
+  struct spinlock lock;
+  struct inode *head;
+} truncq;
+
 void iinit()
 {
   int i = 0;
 
-  initlock(&icache.lock, "icache");
+  initrwlock(&icache.lock, "icache");
+  initlock(&truncq.lock, "truncq");
   for (i = 0; i < NINODE; i++)
   {
     initsleeplock(&icache.inode[i].lock, "inode");
@@ -250,16 +309,30 @@ iget(uint dev, uint inum)
 {
   struct inode *ip, *empty;
 
-  acquire(&icache.lock);
+  // Is the inode already cached and in use? Most lookups
+  // are, and only need the lock for reading.
+  acquireread(&icache.lock);
+  for (ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++)
+  {
+    if (ip->ref > 0 && ip->dev == dev && ip->inum == inum)
+    {
+      __sync_fetch_and_add(&ip->ref, 1);
+      releaseread(&icache.lock);
+      return ip;
+    }
+  }
+  releaseread(&icache.lock);
 
-  // Is the inode already cached?
+  acquirewrite(&icache.lock);
+
+  // Look again, now that no one else can add it.
   empty = 0;
   for (ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++)
   {
     if (ip->ref > 0 && ip->dev == dev && ip->inum == inum)
     {
       ip->ref++;
-      release(&icache.lock);
+      releasewrite(&icache.lock);
       return ip;
     }
     if (empty == 0 && ip->ref == 0) // Remember empty slot.
@@ -271,11 +344,12 @@ iget(uint dev, uint inum)
     panic("iget: no inodes");
 
   ip = empty;
+  pagecache_drop(ip);
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
-  release(&icache.lock);
+  releasewrite(&icache.lock);
 
   return ip;
 }
@@ -285,9 +359,9 @@ iget(uint dev, uint inum)
 struct inode *
 idup(struct inode *ip)
 {
-  acquire(&icache.lock);
-  ip->ref++;
-  release(&icache.lock);
+  acquireread(&icache.lock);
+  __sync_fetch_and_add(&ip->ref, 1);
+  releaseread(&icache.lock);
   return ip;
 }
 
@@ -338,7 +412,7 @@ void iunlock(struct inode *ip)
 // case it has to free the inode.
 void iput(struct inode *ip)
 {
-  acquire(&icache.lock);
+  acquirewrite(&icache.lock);
 
   if (ip->ref == 1 && ip->valid && ip->nlink == 0)
   {
@@ -348,20 +422,25 @@ void iput(struct inode *ip)
     // so this acquiresleep() won't block (or deadlock).
     acquiresleep(&ip->lock);
 
-    release(&icache.lock);
+    releasewrite(&icache.lock);
 
-    itrunc(ip);
+    if (itrunc(ip))
+    {
+      // itruncd has ip, and our reference, now.
+      releasesleep(&ip->lock);
+      return;
+    }
     ip->type = 0;
     iupdate(ip);
     ip->valid = 0;
 
     releasesleep(&ip->lock);
 
-    acquire(&icache.lock);
+    acquirewrite(&icache.lock);
   }
 
   ip->ref--;
-  release(&icache.lock);
+  releasewrite(&icache.lock);
 }
 
 // Common idiom: unlock, then put.
@@ -378,20 +457,33 @@ void iunlockput(struct inode *ip)
 // are listed in ip->addrs[]. The remaining blocks can be
 // acquired from the two level indirect blocks
 
-// Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// Allocate a data block for ip. If fresh is set, the caller
+// will write the whole block itself (see writeblocks()), so
+// it isn't zeroed, and *fresh tells the caller it's new.
 static uint
-bmap(struct inode *ip, uint bn)
+dalloc(struct inode *ip, int *fresh)
+{
+  if (fresh == 0)
+    return balloc(ip->dev, 1);
+  *fresh = 1;
+  return balloc(ip->dev, 0);
+}
+
+// Find the slot that holds the disk block address of the
+// nth block in inode ip: in ip->addrs[], or in an indirect
+// block, which is returned locked in *bpp (otherwise *bpp is
+// 0) for the caller to log_write() if it changes the slot, and
+// to brelse(). If alloc, allocate missing indirect blocks;
+// otherwise return 0 if they aren't there.
+static uint *
+bslot(struct inode *ip, uint bn, int alloc, struct buf **bpp)
 {
   uint addr, *a;
   struct buf *bp;
 
+  *bpp = 0;
   if (bn < N_DIRECT)
-  {
-    if ((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
-    return addr;
-  }
+    return &ip->addrs[bn];
   bn -= N_DIRECT;
 
   // handle first level indrect blocks
@@ -399,16 +491,13 @@ bmap(struct inode *ip, uint bn)
   {
     // Load first levle indirect block, allocating if necessary.
     if ((addr = ip->addrs[INDEX_INDERECT_L1]) == 0)
-      ip->addrs[INDEX_INDERECT_L1] = addr = balloc(ip->dev);
-    bp = bread(ip->dev, addr);
-    a = (uint *)bp->data;
-    if ((addr = a[bn]) == 0)
     {
-      a[bn] = addr = balloc(ip->dev);
-      log_write(bp);
+      if (!alloc)
+        return 0;
+      ip->addrs[INDEX_INDERECT_L1] = addr = balloc(ip->dev, 1);
     }
-    brelse(bp);
-    return addr;
+    *bpp = bread(ip->dev, addr);
+    return (uint *)(*bpp)->data + bn;
   }
   bn -= N_INDERECT_L1;
 
@@ -418,28 +507,261 @@ bmap(struct inode *ip, uint bn)
     uint index = bn / N_INDERECT_L1;  // L1 block addr
     uint offset = bn % N_INDERECT_L1; // L2 block addr
     if ((addr = ip->addrs[INDEX_INDERECT_L2]) == 0)
-      ip->addrs[INDEX_INDERECT_L2] = addr = balloc(ip->dev);
+    {
+      if (!alloc)
+        return 0;
+      ip->addrs[INDEX_INDERECT_L2] = addr = balloc(ip->dev, 1);
+    }
 
     bp = bread(ip->dev, addr); // L1 block
     a = (uint *)bp->data;
-    if ((addr = a[index]) == 0)
+    if ((addr = a[index]) == 0 && alloc)
     {
-      a[index] = addr = balloc(ip->dev);
+      a[index] = addr = balloc(ip->dev, 1);
       log_write(bp);
     }
     brelse(bp);
+    if (addr == 0)
+      return 0;
+
+    *bpp = bread(ip->dev, addr); // L2 block
+    return (uint *)(*bpp)->data + offset;
+  }
+  panic("bmap: out of range");
+}
+
+// Return the disk block address of the nth block in inode ip.
+// If there is no such block, bmap allocates one; see dalloc()
+// for fresh, which may be 0.
+static uint
+bmap(struct inode *ip, uint bn, int *fresh)
+{
+  uint addr, *slot;
+  struct buf *bp;
+
+  slot = bslot(ip, bn, 1, &bp);
+  if ((addr = *slot) == 0)
+  {
+    *slot = addr = dalloc(ip, fresh);
+    if (bp)
+      log_write(bp);
+  }
+  if (bp)
+    brelse(bp);
+  return addr;
+}
+
+// Return the disk block address of the nth block in inode ip,
+// or 0 if it has none (a hole, or data not yet written back).
+static uint
+blookup(struct inode *ip, uint bn)
+{
+  uint addr, *slot;
+  struct buf *bp;
+
+  if ((slot = bslot(ip, bn, 0, &bp)) == 0)
+    return 0;
+  addr = *slot;
+  if (bp)
+    brelse(bp);
+  return addr;
+}
+
+// Blocks being freed in one transaction. Each bitmap block
+// they're in takes a block of the log; freeing a big file takes
+// several transactions, so as not to overflow the log, or hold
+// it open for long.
+struct freebatch {
+  int maxbm, nbm;  // bitmap blocks it may change, and has
+  int maxfree, nfree; // blocks it may free, and has
+  int full;        // has it turned one away?
+  uint bm[MAXOPBLOCKS];
+};
+
+// Free block b, if fb has room for it. Returns 0 if not.
+static int
+bfreeb(struct inode *ip, uint b, struct freebatch *fb)
+{
+  int i;
+
+  if (fb->nfree == fb->maxfree)
+    goto full;
+  for (i = 0; i < fb->nbm; i++)
+    if (fb->bm[i] == BBLOCK(b, sb))
+      break;
+  if (i == fb->nbm)
+  {
+    if (fb->nbm == fb->maxbm)
+      goto full;
+    fb->bm[fb->nbm++] = BBLOCK(b, sb);
+  }
+  bfree(ip->dev, b);
+  fb->nfree++;
+  return 1;
+
+full:
+  fb->full = 1;
+  return 0;
+}
+
+// Free the blocks in a[k] to a[n-1], last first, and clear
+// their entries, as far as fb has room. Returns the index
+// from which a[] is all zeros.
+static uint
+bfreearray(struct inode *ip, uint *a, uint k, uint n, struct freebatch *fb)
+{
+  while (n > k && (a[n - 1] == 0 || bfreeb(ip, a[n - 1], fb)))
+    a[--n] = 0;
+  return n;
+}
+
+// Free the entries of the indirect block at *addrp from k on,
+// and if k is 0, the block itself, as far as fb has room.
+// Returns the index from which its entries are freed; if that
+// is k, and k is 0, *addrp is 0 unless fb ran out of room.
+static uint
+bfreeind(struct inode *ip, uint *addrp, uint k, struct freebatch *fb)
+{
+  struct buf *bp;
+  uint n;
+
+  if (*addrp == 0)
+    return k;
+  bp = bread(ip->dev, *addrp);
+  n = bfreearray(ip, (uint *)bp->data, k, N_INDERECT_L1, fb);
+  if (n == 0 && bfreeb(ip, *addrp, fb))
+    *addrp = 0;
+  else
+    log_write(bp);
+  brelse(bp);
+  return n;
+}
 
-    bp = bread(ip->dev, addr); // L2 block
+// Free ip's blocks from the nth on, last first, and the
+// indirect blocks left empty, as far as fb has room; if it
+// runs out, fb->full is set. Returns the number of the block
+// from which ip has no data blocks. Caller must write ip.
+static uint
+bfreeto(struct inode *ip, uint bn, struct freebatch *fb)
+{
+  uint base, first, j, k, n, *a;
+  struct buf *bp;
+
+  base = N_DIRECT + N_INDERECT_L1;
+  first = bn > base ? bn - base : 0;
+  if (ip->addrs[INDEX_INDERECT_L2])
+  {
+    bp = bread(ip->dev, ip->addrs[INDEX_INDERECT_L2]);
     a = (uint *)bp->data;
-    if ((addr = a[offset]) == 0)
+    n = 0;
+    for (j = N_INDERECT_L1; j > first / N_INDERECT_L1; j--)
+    {
+      k = (j - 1 == first / N_INDERECT_L1) ? first % N_INDERECT_L1 : 0;
+      if ((n = bfreeind(ip, &a[j - 1], k, fb)) > k || (k == 0 && a[j - 1]))
+        break;
+    }
+    if (j == first / N_INDERECT_L1 && first == 0 &&
+        bfreeb(ip, ip->addrs[INDEX_INDERECT_L2], fb))
+    {
+      brelse(bp);
+      ip->addrs[INDEX_INDERECT_L2] = 0;
+    }
+    else
     {
-      a[offset] = addr = balloc(ip->dev);
       log_write(bp);
+      brelse(bp);
+      if (j > first / N_INDERECT_L1)
+        return base + (j - 1) * N_INDERECT_L1 + n;
+      if (first == 0)
+        return base;
     }
-    brelse(bp);
-    return addr;
   }
-  panic("bmap: out of range");
+
+  base = N_DIRECT;
+  first = bn > base ? bn - base : 0;
+  if (first < N_INDERECT_L1)
+  {
+    if ((n = bfreeind(ip, &ip->addrs[INDEX_INDERECT_L1], first, fb)) > first ||
+        (first == 0 && ip->addrs[INDEX_INDERECT_L1]))
+      return base + n;
+  }
+
+  if (bn < N_DIRECT)
+    return bfreearray(ip, ip->addrs, bn, N_DIRECT, fb);
+  return bn;
+}
+
+// Make everything past the end of ip read as zero, before the
+// file grows or after it shrinks: drop cached pages past it,
+// and zero the rest of its last page. Caller must hold ip->lock
+// and be inside a transaction. Returns 0, or -1 if out of memory.
+static int
+izeropast(struct inode *ip)
+{
+  uint64 pa;
+  uint off;
+
+  pagecache_truncate(ip, PGROUNDUP(ip->size) / PGSIZE);
+  if ((off = ip->size % PGSIZE) == 0)
+    return 0;
+  if ((pa = pagecache_get(ip, ip->size / PGSIZE, 1)) == 0)
+    return -1;
+  memset((char *)pa + off, 0, PGSIZE - off);
+  pagecache_dirty(ip, ip->size / PGSIZE);
+  kfree((void *)pa);
+  return 0;
+}
+
+// Shrink ip to size bytes, freeing the blocks past it, last
+// first, as far as fb has room. Returns 1 if there are more.
+// Caller must hold ip->lock and be inside a transaction.
+static int
+ishrink(struct inode *ip, uint size, struct freebatch *fb)
+{
+  uint bn, end;
+
+  bn = (size + BSIZE - 1) / BSIZE;
+  end = bfreeto(ip, bn, fb);
+  if (end == bn)
+    ip->size = size;
+  else if (end * BSIZE < ip->size)
+    ip->size = end * BSIZE;
+  // dirty pages past the end mustn't be written back.
+  pagecache_truncate(ip, PGROUNDUP(ip->size) / PGSIZE);
+  iupdate(ip);
+  return fb->full;
+}
+
+// Add ip to the on-disk list of inodes whose blocks itruncd
+// is freeing, or remove it. Caller must be inside a transaction.
+static void
+orphan(struct inode *ip, int add)
+{
+  struct buf *bp;
+  uint *o;
+  int i;
+
+  bp = bread(ip->dev, 1);
+  o = (uint *)(bp->data + ORPHANOFF);
+  for (i = 0; i < NORPHAN; i++)
+    if (o[i] == (add ? 0 : ip->inum))
+      break;
+  if (i == NORPHAN)
+    panic("orphan");
+  o[i] = add ? ip->inum : 0;
+  log_write(bp);
+  brelse(bp);
+}
+
+// Give ip, and the caller's reference to it, to itruncd.
+static void
+itruncq(struct inode *ip)
+{
+  acquire(&truncq.lock);
+  ip->truncnext = truncq.head;
+  truncq.head = ip;
+  wakeup(&truncq);
+  release(&truncq.lock);
 }
 
 // Truncate inode (discard contents).
@@ -447,63 +769,108 @@ bmap(struct inode *ip, uint bn)
 // to it (no directory entries referring to it)
 // and has no in-memory reference to it (is
 // not an open file or current directory).
-static void
+// Frees what fits in the caller's transaction. If that isn't
+// all, puts ip on the orphan list, so that fsinit() can find
+// it after a crash, and hands it to itruncd, with the caller's
+// reference; returns 1 then, 0 if it's done.
+static int
 itrunc(struct inode *ip)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
+  struct freebatch fb = {.maxbm = 2, .maxfree = 64};
 
-  for (i = 0; i < N_DIRECT; i++)
-  {
-    if (ip->addrs[i])
-    {
-      bfree(ip->dev, ip->addrs[i]);
-      ip->addrs[i] = 0;
-    }
-  }
+  pagecache_drop(ip);
+  if (ishrink(ip, 0, &fb) == 0)
+    return 0;
+  orphan(ip, 1);
+  itruncq(ip);
+  return 1;
+}
 
-  if (ip->addrs[N_DIRECT]) // L1 indirect block is not free
-  {
-    bp = bread(ip->dev, ip->addrs[N_DIRECT]);
-    a = (uint *)bp->data;
-    for (j = 0; j < N_INDERECT_L1; j++)
-    {
-      if (a[j])
-        bfree(ip->dev, a[j]);
-    }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[N_DIRECT]);
-    ip->addrs[N_DIRECT] = 0;
-  }
+// The kernel thread that frees the blocks of unlinked files
+// too big for iput() to free in one transaction, a
+// transaction at a time. Started by userinit().
+void
+itruncd(void)
+{
+  struct freebatch fb;
+  struct inode *ip;
+  int more;
+
+  // still holding p->lock from scheduler.
+  release(&myproc()->lock);
 
-  if (ip->addrs[N_DIRECT+1]) // L2 indirect block is not free
+  for (;;)
   {
-    bp = bread(ip->dev, ip->addrs[N_DIRECT]);
-    a = (uint *)bp->data;
-    for (j = 0; j < N_INDERECT_L1; j++)
+    acquire(&truncq.lock);
+    while ((ip = truncq.head) == 0)
+      sleep(&truncq, &truncq.lock);
+    truncq.head = ip->truncnext;
+    release(&truncq.lock);
+
+    do
     {
-      if (a[j])
+      begin_op(ip->dev);
+      ilock(ip);
+      // log room for the inode, the superblock and three
+      // indirect blocks, besides the bitmap blocks.
+      fb = (struct freebatch){.maxbm = MAXOPBLOCKS - 5, .maxfree = 1024};
+      if ((more = ishrink(ip, 0, &fb)) == 0)
       {
-        struct buf* bp_L1 = bread(ip->dev, a[j]);
-        uint* blk_data = (uint *)bp_L1->data;
-        for(int k = 0; j < N_INDERECT_L1; k++)
-        {
-          if(blk_data[k])
-          {
-            bfree(ip->dev, blk_data[k]);
-          }
-        }
-        bfree(ip->dev, a[j]);
+        orphan(ip, 0);
+        ip->type = 0;
+        iupdate(ip);
+        ip->valid = 0;
       }
-    }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[N_DIRECT]);
-    ip->addrs[N_DIRECT] = 0;
+      iunlock(ip);
+      end_op(ip->dev);
+    } while (more);
+    begin_op(ip->dev);
+    iput(ip);
+    end_op(ip->dev);
   }
+}
 
-  ip->size = 0;
+// Finish freeing the inodes whose blocks itruncd was freeing
+// when the system stopped.
+static void
+iorphans(int dev)
+{
+  struct buf *bp;
+  uint o[NORPHAN];
+  int i;
+
+  bp = bread(dev, 1);
+  memmove(o, bp->data + ORPHANOFF, sizeof(o));
+  brelse(bp);
+  for (i = 0; i < NORPHAN; i++)
+    if (o[i])
+      itruncq(iget(dev, o[i]));
+}
+
+// Set the size of regular file ip, freeing the blocks past a
+// smaller one; a larger one leaves a hole, which reads as
+// zeros. Frees as many blocks as fit in one transaction, and
+// returns 1 if the caller should call again, in another, to
+// free more; 0 when it's done, or -1. Caller must hold ip->lock
+// and be inside a transaction.
+int
+itruncate(struct inode *ip, uint size)
+{
+  struct freebatch fb = {.maxbm = MAXOPBLOCKS - 4, .maxfree = 1024};
+
+  if (ip->type != T_FILE || size > MAXFILE * BSIZE)
+    return -1;
+  // blocks are freed from the end, so the file only ever
+  // shows its old data up to its current size.
+  if (size < ip->size && ishrink(ip, size, &fb))
+    return 1;
+  // the last page may hold old data past the end of the file,
+  // which it mustn't show when it grows.
+  if (izeropast(ip) < 0)
+    return -1;
+  ip->size = size;
   iupdate(ip);
+  return 0;
 }
 
 // Copy stat information from inode.
@@ -517,17 +884,288 @@ void stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Read n bytes at off from ip's disk blocks, through the
+// buffer cache. Regular files' data is cached in the page
+// cache, so their buffers are released to be evicted first.
+// Blocks that haven't been allocated read as zeros.
+// Caller must hold ip->lock. Returns the bytes copied.
+int readblocks(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
+{
+  static char zeros[BSIZE];
+  uint tot, m, addr;
+  struct buf *bp;
+  int r;
+
+  for (tot = 0; tot < n; tot += m, off += m, dst += m)
+  {
+    m = min(n - tot, BSIZE - off % BSIZE);
+    if ((addr = blookup(ip, off / BSIZE)) == 0)
+    {
+      if (either_copyout(user_dst, dst, zeros, m) == -1)
+        break;
+      continue;
+    }
+    bp = bread(ip->dev, addr);
+    r = either_copyout(user_dst, dst, bp->data + (off % BSIZE), m);
+    if (ip->type == T_FILE)
+      brelse_evict(bp);
+    else
+      brelse(bp);
+    if (r == -1)
+      break;
+  }
+  return tot;
+}
+
+// Write n bytes at off to ip's disk blocks. Caller must hold
+// ip->lock and be inside a transaction. Returns the bytes
+// copied.
+//
+// Directories and the like go through the buffer cache and
+// the log. A regular file's data is written straight to its
+// home location instead, before the transaction that points
+// ip at it can commit, so the log holds only metadata and a
+// crash can lose a write but never leave ip pointing at a
+// block that was never written. (It can, though, leave new
+// data in a block whose freeing hadn't committed yet.)
+int writeblocks(struct inode *ip, int user_src, uint64 src, uint off, uint n)
+{
+  uint tot, m, bno;
+  struct buf *bp;
+  int direct, fresh, r;
+
+  direct = (ip->type == T_FILE);
+  for (tot = 0; tot < n; tot += m, off += m, src += m)
+  {
+    fresh = 0;
+    bno = bmap(ip, off / BSIZE, direct ? &fresh : 0);
+    m = min(n - tot, BSIZE - off % BSIZE);
+    // no need to read a block that's new or about to be
+    // overwritten in full.
+    if (direct && (fresh || m == BSIZE))
+      bp = bzeroed(ip->dev, bno);
+    else
+      bp = bread(ip->dev, bno);
+    r = either_copyin(bp->data + (off % BSIZE), user_src, src, m);
+    if (!direct)
+    {
+      if (r != -1)
+        log_write(bp);
+      brelse(bp);
+    }
+    else if (r != -1 || fresh)
+    {
+      // a fresh block must be written even so, since ip
+      // now points at it.
+      bwrite(bp);
+      brelse_evict(bp);
+    }
+    else
+    {
+      // the buffer no longer matches the disk.
+      bp->valid = 0;
+      brelse(bp);
+    }
+    if (r == -1)
+      break;
+  }
+  return tot;
+}
+
+// Which block holds the address of the nth block of a file:
+// 0 for the inode itself, 1 for the first level indirect
+// block, and 2 and up for the second level ones.
+static int
+bregion(uint bn)
+{
+  if (bn < N_DIRECT)
+    return 0;
+  bn -= N_DIRECT;
+  if (bn < N_INDERECT_L1)
+    return 1;
+  return 2 + (bn - N_INDERECT_L1) / N_INDERECT_L1;
+}
+
+// The blocks that iflush() and iprealloc() allocate in one
+// transaction, and the log space that they may take.
+struct allocbatch {
+  int nlog;    // log blocks it may have used
+  int region;  // bregion() of the last block allocated
+  int l2;      // allocated in a second level block yet?
+  uint run;    // next block of the current run
+  uint nrun;   // blocks left in it
+  uint bm;     // bitmap block the run came from
+  int full;    // the disk ran out of blocks
+};
+
+static void
+abegin(struct allocbatch *a)
+{
+  a->nlog = 1; // the inode's block
+  a->region = -1;
+  a->l2 = 0;
+  a->run = a->nrun = a->bm = 0;
+  a->full = 0;
+}
+
+// Allocate a block for the nth block of ip, which has none,
+// and point ip at it. The caller must write all of the block
+// before the transaction commits. want is how many blocks it
+// expects to need in all, which sets the length of new runs.
+// Returns 0 if the allocation might take more log space than
+// is left (the log blocks for a bitmap block, and indirect
+// blocks, with theirs, that are new to the batch), unless
+// force, or if the disk is full, when it sets a->full.
+static uint
+aalloc(struct inode *ip, uint bn, struct allocbatch *a, uint want, int force)
+{
+  uint addr, *slot;
+  struct buf *bp;
+  int r, ind;
+
+  r = bregion(bn);
+  ind = 0;
+  if (r != a->region && r > 0)
+    ind = (r > 1 && !a->l2) ? 4 : 2;
+  // a new run may come from a bitmap block new to the batch;
+  // the data block itself is written in place, not logged.
+  if (!force && a->nlog + ind + (a->nrun == 0) > MAXOPBLOCKS)
+    return 0;
+  if (r != a->region)
+  {
+    a->nlog += ind;
+    a->region = r;
+    a->l2 |= (r > 1);
+  }
+  if (a->nrun == 0)
+  {
+    if ((a->run = ballocrun(ip->dev, want, &a->nrun)) == 0)
+    {
+      a->full = 1;
+      return 0;
+    }
+    if (BBLOCK(a->run, sb) != a->bm)
+    {
+      a->bm = BBLOCK(a->run, sb);
+      a->nlog++;
+    }
+  }
+  // iflush() and iprealloc() both rely on this.
+  if (!force && a->nlog > MAXOPBLOCKS)
+    panic("aalloc: log");
+  addr = a->run++;
+  a->nrun--;
+  slot = bslot(ip, bn, 1, &bp);
+  *slot = addr;
+  if (bp)
+  {
+    log_write(bp);
+    brelse(bp);
+  }
+  return addr;
+}
+
+// Give back the rest of the last run.
+static void
+aend(struct inode *ip, struct allocbatch *a)
+{
+  for (; a->nrun > 0; a->nrun--)
+    bfree(ip->dev, a->run++);
+}
+
+// Write some of ip's dirty cached pages (see pagecache.c) to
+// disk: up to FLUSHBATCH of them, or as many as fit in one
+// transaction. Data that has no disk blocks yet gets them
+// here, allocated in runs, so that a file written in order is
+// laid out in order. Like writeblocks(), writes the data in
+// place before the transaction that points ip at it commits.
+// Caller must hold ip->lock and be inside a transaction.
+// Returns the number of pages cleaned.
+int
+iflush(struct inode *ip)
+{
+  struct allocbatch a;
+  uint bn, end, addr, want;
+  struct buf *bp;
+  int idx, n, wrote;
+  uint64 pa;
+
+  n = wrote = 0;
+  abegin(&a);
+  for (idx = pagecache_nextdirty(ip, 0, &pa); idx >= 0 && n < FLUSHBATCH;
+       idx = pagecache_nextdirty(ip, idx + 1, &pa))
+  {
+    bn = idx * (PGSIZE / BSIZE);
+    end = min(bn + PGSIZE / BSIZE, (ip->size + BSIZE - 1) / BSIZE);
+    for (; bn < end; bn++)
+    {
+      // the first page always gets written, unless the disk
+      // is full. a page left half written stays dirty, and is
+      // written again.
+      want = min(ip->ndirty, FLUSHBATCH - n) * (PGSIZE / BSIZE) - bn % (PGSIZE / BSIZE);
+      if ((addr = blookup(ip, bn)) == 0 &&
+          (addr = aalloc(ip, bn, &a, want, n == 0)) == 0)
+        goto out;
+      bp = bzeroed(ip->dev, addr);
+      memmove(bp->data, (char *)pa + (bn % (PGSIZE / BSIZE)) * BSIZE, BSIZE);
+      bwrite(bp);
+      brelse_evict(bp);
+      wrote = 1;
+    }
+    pagecache_clean(ip, idx);
+    n++;
+  }
+
+out:
+  aend(ip, &a);
+  if (n > 0 || wrote)
+    iupdate(ip);
+  return n;
+}
+
+// Give ip's blocks bn to bn+nb-1 that have no disk blocks
+// zeroed ones, allocated in runs, as many as fit in one
+// transaction. Caller must hold ip->lock and be inside a
+// transaction. Returns how many of the nb blocks it did, or
+// -1 if the disk filled up; the blocks it got stay ip's.
+int
+iprealloc(struct inode *ip, uint bn, uint nb)
+{
+  struct allocbatch a;
+  struct buf *bp;
+  uint i, addr;
+
+  abegin(&a);
+  for (i = 0; i < nb; i++)
+  {
+    if (blookup(ip, bn + i) != 0)
+      continue;
+    if ((addr = aalloc(ip, bn + i, &a, nb - i, 0)) == 0)
+      break;
+    bp = bzeroed(ip->dev, addr);
+    bwrite(bp);
+    brelse_evict(bp);
+  }
+  aend(ip, &a);
+  iupdate(ip);
+  return a.full ? -1 : i;
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
 // otherwise, dst is a kernel address.
+// Regular files are read through the page cache.
 int readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 {
   uint tot, m;
-  struct buf *bp;
+  uint64 pa;
+  int r;
 
-  if (off > ip->size || off + n < off)
+  if (off + n < off)
     return -1;
+  if (off >= ip->size)
+    return 0;
   if (off + n > ip->size)
     n = ip->size - off;
   // if use virtual address, check if it's within the process size
@@ -535,45 +1173,74 @@ int readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
     return -1;
   }
 
+  if (ip->type != T_FILE)
+    return readblocks(ip, user_dst, dst, off, n);
+
   for (tot = 0; tot < n; tot += m, off += m, dst += m)
   {
-    bp = bread(ip->dev, bmap(ip, off / BSIZE));
-    m = min(n - tot, BSIZE - off % BSIZE);
-    if (either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1)
+    m = min(n - tot, PGSIZE - off % PGSIZE);
+    if ((pa = pagecache_get(ip, off / PGSIZE, 0)) == 0)
     {
-      brelse(bp);
-      break;
+      // no memory for the page; read around the cache.
+      if (readblocks(ip, user_dst, dst, off, m) != m)
+        break;
+      continue;
     }
-    brelse(bp);
+    r = either_copyout(user_dst, dst, (char *)pa + off % PGSIZE, m);
+    kfree((void *)pa);
+    if (r == -1)
+      break;
   }
-  return n;
+  return tot;
 }
 
 // Write data to inode.
 // Caller must hold ip->lock.
 // If user_src==1, then src is a user virtual address;
 // otherwise, src is a kernel address.
+// Regular files are written to the page cache, which writes
+// them back to disk later; see iflush().
 int writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
 {
   uint tot, m;
-  struct buf *bp;
+  uint64 pa;
+  int r, around;
 
-  if (off > ip->size || off + n < off)
+  if (off + n < off || off + n > MAXFILE * BSIZE)
     return -1;
-  if (off + n > MAXFILE * BSIZE)
+  // only a regular file can have a hole, which reads as zeros.
+  if (off > ip->size && (ip->type != T_FILE || izeropast(ip) < 0))
     return -1;
 
-  for (tot = 0; tot < n; tot += m, off += m, src += m)
+  around = 0;
+  if (ip->type != T_FILE)
   {
-    bp = bread(ip->dev, bmap(ip, off / BSIZE));
-    m = min(n - tot, BSIZE - off % BSIZE);
-    if (either_copyin(bp->data + (off % BSIZE), user_src, src, m) == -1)
+    tot = writeblocks(ip, user_src, src, off, n);
+    off += tot;
+    around = 1;
+  }
+  else
+  {
+    for (tot = 0; tot < n; tot += m, off += m, src += m)
     {
-      brelse(bp);
-      break;
+      m = min(n - tot, PGSIZE - off % PGSIZE);
+      if ((pa = pagecache_get(ip, off / PGSIZE, 1)) == 0)
+      {
+        // no memory for the page; write around the cache,
+        // unless it holds data that isn't on disk yet.
+        if (pagecache_invalidate(ip, off, m) < 0 ||
+            writeblocks(ip, user_src, src, off, m) != m)
+          break;
+        around = 1;
+        continue;
+      }
+      // even a failed copy may have changed the page.
+      r = either_copyin((char *)pa + off % PGSIZE, user_src, src, m);
+      pagecache_dirty(ip, off / PGSIZE);
+      kfree((void *)pa);
+      if (r == -1)
+        break;
     }
-    log_write(bp);
-    brelse(bp);
   }
 
   if (n > 0)
@@ -581,9 +1248,11 @@ int writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
     if (off > ip->size)
       ip->size = off;
     // write the i-node back to disk even if the size didn't change
-    // because the loop above might have called bmap() and added a new
-    // block to ip->addrs[].
-    iupdate(ip);
+    // because writeblocks() might have called bmap() and added a new
+    // block to ip->addrs[]. Otherwise the new size goes to disk
+    // with the data, from iflush().
+    if (around)
+      iupdate(ip);
   }
 
   return n;
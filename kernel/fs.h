@@ -24,6 +24,14 @@ struct superblock {
 
 #define FSMAGIC 0x10203040
 
+// Inodes with no links whose blocks are still being freed,
+// a transaction at a time, so that fsinit() can finish the job
+// after a crash: an array of inode numbers kept at the end of
+// the superblock's block, with 0 for a free slot. No more can
+// be in memory at once than NINODE.
+#define NORPHAN   64
+#define ORPHANOFF (BSIZE - NORPHAN * sizeof(uint))
+
 #define N_DIRECT 11
 #define N_INDERECT_L1 (BSIZE / sizeof(uint)) 
 #define N_INDERECT_L2 N_INDERECT_L1*N_INDERECT_L1
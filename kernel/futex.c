@@ -0,0 +1,68 @@
+//
+// Futexes: let user processes sleep on a word of their memory.
+// Sleepers are keyed by the word's physical address, so
+// processes sharing a page (clone() threads, or COW-shared
+// pages after fork()) find each other.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "rusage.h"
+#include "proc.h"
+#include "defs.h"
+#include "futex.h"
+
+// serializes the check of *addr in futex_wait()
+// against futex_wake(), so no wakeup is lost.
+struct spinlock futex_lock;
+
+void
+futexinit(void)
+{
+  initlock(&futex_lock, "futex");
+}
+
+// If the int at user address addr still holds val,
+// sleep until futex_wake() on the same word.
+// Return 0 when woken (perhaps spuriously), or -1 if
+// the word had changed or addr is bad.
+int
+futex_wait(uint64 addr, int val)
+{
+  struct proc *p = myproc();
+  uint64 pa;
+
+  if(addr % sizeof(int) != 0 || (pa = useraddr(p, addr)) == 0)
+    return -1;
+
+  acquire(&futex_lock);
+  if(*(int*)pa != val || p->killed){
+    release(&futex_lock);
+    return -1;
+  }
+  sleep((void*)pa, &futex_lock);
+  release(&futex_lock);
+  return 0;
+}
+
+// Wake up to n processes sleeping on the int at
+// user address addr. Return the number woken, or -1
+// if addr is bad.
+int
+futex_wake(uint64 addr, int n)
+{
+  struct proc *p = myproc();
+  uint64 pa;
+  int woken;
+
+  if(addr % sizeof(int) != 0 || (pa = useraddr(p, addr)) == 0)
+    return -1;
+
+  acquire(&futex_lock);
+  woken = wakeupn((void*)pa, n);
+  release(&futex_lock);
+  return woken;
+}
@@ -42,7 +42,7 @@ static uint8* ref_count_start;
 void
 kinit()
 {
-  initlock(&kmems.lock, "kmems");
+  initmcslock(&kmems.lock, "kmems");
   ref_count_start = (uint8 *)end;
   init_ref_count(end, 8*PGSIZE);
   kmems.cyclic_iter = 0;
@@ -129,6 +129,24 @@ void set_ref_count(uint8 *addr, uint8 count)
   REF_COUNT(addr) = count;
 }
 
+// Add d to the ref count of the page at addr and return the
+// new count. Atomic, since a shared page's count changes on
+// many CPUs at once; RISC-V has no byte-sized atomics, so this
+// updates the aligned word the count is in.
+uint8 add_ref_count(uint8 *addr, int d)
+{
+  uint8 *c = &REF_COUNT(addr);
+  uint *w = (uint *)((uint64)c & ~3L);
+  int shift = ((uint64)c & 3) * 8;
+  uint old, new;
+
+  old = __atomic_load_n(w, __ATOMIC_RELAXED);
+  do {
+    new = (old & ~(0xffU << shift)) | ((((old >> shift) + d) & 0xff) << shift);
+  } while(!__atomic_compare_exchange_n(w, &old, new, 1, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+  return new >> shift;
+}
+
 // Free the page of physical memory pointed at by v,
 // which normally should have been returned by a
 // call to kalloc().  (The exception is when
@@ -147,8 +165,7 @@ kfree(void *pa)
   if (((uint64)pa % PGSIZE) != 0 || (char *)pa < end + 8 * PGSIZE || (uint64)pa >= PHYSTOP)
     panic("kfree");
   // printf("ref_count(%p): %d\n", pa, REF_COUNT(pa));
-  REF_COUNT(pa) -= 1;
-  if (REF_COUNT(pa) == 0)
+  if (add_ref_count((uint8 *)pa, -1) == 0)
   {
     // Fill with junk to catch dangling refs.
     memset(pa, 1, PGSIZE);
@@ -188,12 +205,18 @@ kalloc(void)
   else
   {
     release(&kmems.item[cpu_id].lock);
-    if(borrow_mem(cpu_id))
+    // take pages from other CPUs, or failing that, from
+    // the file page cache.
+    if(borrow_mem(cpu_id) || pagecache_reclaim() > 0)
     {
       acquire(&kmems.item[cpu_id].lock);
       r = kmems.item[cpu_id].freelist;
-      kmems.item[cpu_id].freelist = r->next;
-      kmems.item[cpu_id].page_num--;
+      if(r)
+      {
+        kmems.item[cpu_id].freelist = r->next;
+        kmems.item[cpu_id].page_num--;
+        REF_COUNT(r) = 1;
+      }
       release(&kmems.item[cpu_id].lock);
     }
   }
@@ -0,0 +1,299 @@
+//
+// The kernel log. printf() and klog() format a message and
+// append it to a ring of the CPU's own, with interrupts off, so
+// logging takes no lock and never waits for the console. klogd,
+// a kernel thread, moves messages from the CPUs' rings to the
+// log, oldest first, and writes those at KL_INFO or more urgent
+// to the console. dmesg() reads the log.
+//
+// Until klogd starts, and once panic() is called, messages are
+// also written straight to the console, as printf() used to.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "rusage.h"
+#include "proc.h"
+#include "defs.h"
+#include "klog.h"
+
+#define NKSTAGE      64   // messages per CPU ring; a power of two
+#define NKLOG        512  // messages the log keeps; a power of two
+#define KLOGBURST    10   // see ratelimit()
+#define KLOGINTERVAL 50   // ticks
+
+// messages waiting for klogd.
+static struct kstage {
+  uint64 head;       // messages staged; written by the owning CPU
+  uint64 tail;       // messages taken; written by klogd
+  uint dropped;      // messages lost because the ring was full
+  struct klogmsg msg[NKSTAGE];
+  char shown[NKSTAGE];  // already written to the console
+} stages[NCPU];
+
+static struct {
+  struct spinlock lock;
+  uint64 seq;        // messages ever logged
+  struct klogmsg msg[NKLOG];
+} kl;
+
+// serializes console output before klogd starts.
+static struct spinlock bootlock;
+
+static int klogging;    // klogd is running
+static int klogsync;    // panic() was called
+static int klogwaiting; // klogd is asleep
+
+void
+kloginit(void)
+{
+  initlock(&kl.lock, "klog");
+  initlock(&bootlock, "klogboot");
+}
+
+static void
+klogwrite(char *s, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++)
+    consputc(s[i]);
+}
+
+// Wake klogd. wakeup() takes every process's lock, so this is
+// only safe if the caller holds no spinlock, which might be one
+// of them; otherwise klogtick() wakes it on the next tick.
+static void
+klogwake(void)
+{
+  __sync_synchronize();
+  if(__atomic_load_n(&klogwaiting, __ATOMIC_SEQ_CST) == 0)
+    return;
+  acquire(&kl.lock);
+  wakeup(&klogwaiting);
+  release(&kl.lock);
+}
+
+// Log the n characters at buf, at level; printf() and klog()
+// call this with what they formatted. Text that doesn't fit
+// in one message is split over several.
+void
+klogput(int level, char *buf, int n)
+{
+  struct kstage *s;
+  struct klogmsg *m;
+  struct proc *p;
+  int off, len, sync, canwake;
+
+  if(__atomic_load_n(&klogsync, __ATOMIC_ACQUIRE)){
+    klogwrite(buf, n);
+    return;
+  }
+  sync = __atomic_load_n(&klogging, __ATOMIC_ACQUIRE) == 0;
+  if(sync && level <= KL_INFO){
+    acquire(&bootlock);
+    klogwrite(buf, n);
+    release(&bootlock);
+  }
+
+  push_off();
+  canwake = mycpu()->noff == 1;
+  s = &stages[cpuid()];
+  p = mycpu()->proc;
+  for(off = 0; off < n; off += len){
+    len = n - off < KLOGMSG-1 ? n - off : KLOGMSG-1;
+    if(s->head - __atomic_load_n(&s->tail, __ATOMIC_ACQUIRE) == NKSTAGE){
+      __atomic_fetch_add(&s->dropped, 1, __ATOMIC_RELAXED);
+      continue;
+    }
+    m = &s->msg[s->head & (NKSTAGE-1)];
+    m->time = *(volatile uint64 *)CLINT_MTIME;
+    m->pid = p ? p->pid : 0;
+    m->level = level;
+    m->cpu = cpuid();
+    memmove(m->text, buf + off, len);
+    m->text[len] = 0;
+    s->shown[s->head & (NKSTAGE-1)] = sync;
+    // publish the message after writing it.
+    __atomic_store_n(&s->head, s->head + 1, __ATOMIC_RELEASE);
+  }
+  pop_off();
+  if(canwake)
+    klogwake();
+}
+
+// Are there messages for klogd?
+static int
+klogpending(void)
+{
+  struct kstage *s;
+
+  for(s = stages; s < &stages[NCPU]; s++)
+    if(s->tail != __atomic_load_n(&s->head, __ATOMIC_ACQUIRE) ||
+       __atomic_load_n(&s->dropped, __ATOMIC_RELAXED))
+      return 1;
+  return 0;
+}
+
+// Called by clockintr(), for messages logged where klogwake()
+// couldn't be.
+void
+klogtick(void)
+{
+  if(__atomic_load_n(&klogwaiting, __ATOMIC_SEQ_CST) && klogpending()){
+    acquire(&kl.lock);
+    wakeup(&klogwaiting);
+    release(&kl.lock);
+  }
+}
+
+// Move the oldest staged message to the log, and copy it to
+// *m. A CPU that dropped messages gets a message saying so.
+// Returns 0 if there was nothing to move.
+static int
+klogtake(struct klogmsg *m, int *shown)
+{
+  struct kstage *s, *old;
+  uint n;
+  int c;
+
+  old = 0;
+  for(c = 0; c < NCPU; c++){
+    s = &stages[c];
+    if((n = __atomic_exchange_n(&s->dropped, 0, __ATOMIC_RELAXED)) != 0){
+      m->time = *(volatile uint64 *)CLINT_MTIME;
+      m->pid = 0;
+      m->level = KL_WARN;
+      m->cpu = c;
+      snprintf(m->text, KLOGMSG, "klog: cpu %d dropped %d messages\n", c, n);
+      *shown = 0;
+      goto log;
+    }
+    if(s->tail == __atomic_load_n(&s->head, __ATOMIC_ACQUIRE))
+      continue;
+    if(old == 0 ||
+       s->msg[s->tail & (NKSTAGE-1)].time < old->msg[old->tail & (NKSTAGE-1)].time)
+      old = s;
+  }
+  if(old == 0)
+    return 0;
+  *m = old->msg[old->tail & (NKSTAGE-1)];
+  *shown = old->shown[old->tail & (NKSTAGE-1)];
+  // the owner may now reuse the slot.
+  __atomic_store_n(&old->tail, old->tail + 1, __ATOMIC_RELEASE);
+
+log:
+  acquire(&kl.lock);
+  m->seq = kl.seq;
+  kl.msg[kl.seq++ & (NKLOG-1)] = *m;
+  release(&kl.lock);
+  return 1;
+}
+
+// The log thread, started by userinit().
+void
+klogd(void)
+{
+  struct klogmsg m;
+  int shown;
+
+  // still holding p->lock from scheduler.
+  release(&myproc()->lock);
+
+  __atomic_store_n(&klogging, 1, __ATOMIC_RELEASE);
+  for(;;){
+    acquire(&kl.lock);
+    for(;;){
+      // klogwake() checks klogwaiting after staging a message.
+      __atomic_store_n(&klogwaiting, 1, __ATOMIC_SEQ_CST);
+      if(klogpending())
+        break;
+      sleep(&klogwaiting, &kl.lock);
+    }
+    __atomic_store_n(&klogwaiting, 0, __ATOMIC_SEQ_CST);
+    release(&kl.lock);
+
+    while(klogtake(&m, &shown)){
+      if(!shown && m.level <= KL_INFO)
+        uartwrite(m.text, strlen(m.text), 0);
+    }
+  }
+}
+
+// Called by panic(): write the messages klogd hasn't got to,
+// one CPU's after another, and from now on write messages
+// straight to the console. Takes no locks, since the caller
+// may hold any of them.
+void
+klogpanic(void)
+{
+  struct kstage *s;
+  struct klogmsg *m;
+  uint64 t;
+
+  uartpanic();
+  if(__atomic_exchange_n(&klogsync, 1, __ATOMIC_ACQ_REL))
+    return;
+  for(s = stages; s < &stages[NCPU]; s++){
+    for(t = s->tail; t != __atomic_load_n(&s->head, __ATOMIC_ACQUIRE); t++){
+      m = &s->msg[t & (NKSTAGE-1)];
+      if(!s->shown[t & (NKSTAGE-1)] && m->level <= KL_INFO)
+        klogwrite(m->text, strlen(m->text));
+    }
+  }
+}
+
+// Whether a message from the call site rl belongs to may be
+// logged: at most KLOGBURST in KLOGINTERVAL ticks. Says how
+// many were suppressed when the next interval starts. Racy,
+// but only in how many get through. Use klog_ratelimited().
+int
+ratelimit(struct ratelimit *rl)
+{
+  uint now = ticks;
+  int missed;
+
+  if(now - rl->start >= KLOGINTERVAL){
+    rl->start = now;
+    __atomic_store_n(&rl->n, 0, __ATOMIC_RELAXED);
+    missed = __atomic_exchange_n(&rl->missed, 0, __ATOMIC_RELAXED);
+    if(missed)
+      klog(KL_WARN, "klog: %d messages suppressed\n", missed);
+  }
+  if(__atomic_fetch_add(&rl->n, 1, __ATOMIC_RELAXED) < KLOGBURST)
+    return 1;
+  __atomic_fetch_add(&rl->missed, 1, __ATOMIC_RELAXED);
+  return 0;
+}
+
+// dmesg(struct klogmsg *m, int n, uint64 seq): copy up to n
+// messages from the log to m, starting with message seq, or
+// the oldest the log still has if that is later. Returns the
+// number copied.
+uint64
+sys_dmesg(void)
+{
+  struct klogmsg m;
+  uint64 dst, seq;
+  int n, got;
+
+  if(argaddr(0, &dst) < 0 || argint(1, &n) < 0 || argaddr(2, &seq) < 0 || n < 0)
+    return -1;
+  for(got = 0; got < n; got++){
+    acquire(&kl.lock);
+    if(kl.seq > NKLOG && seq < kl.seq - NKLOG)
+      seq = kl.seq - NKLOG;   // overwritten
+    if(seq >= kl.seq){
+      release(&kl.lock);
+      break;
+    }
+    m = kl.msg[seq++ & (NKLOG-1)];
+    release(&kl.lock);
+    if(copyout(myproc()->pagetable, dst + got*sizeof(m), (char *)&m, sizeof(m)) < 0)
+      return -1;
+  }
+  return got;
+}
@@ -0,0 +1,18 @@
+// Kernel log messages, as returned by dmesg().
+
+#define KL_ERR    0   // something failed
+#define KL_WARN   1   // something looks wrong
+#define KL_INFO   2   // printf()'s level
+#define KL_DEBUG  3   // kept in the log, but not shown on the console
+#define NKLEVEL   4
+
+#define KLOGMSG   104 // bytes of text in a message
+
+struct klogmsg {
+  uint64 seq;     // messages logged before this one
+  uint64 time;    // CLINT mtime ticks (10 MHz on qemu)
+  int pid;        // process running, or 0
+  ushort level;   // KL_*
+  ushort cpu;
+  char text[KLOGMSG];  // null-terminated; a line, or part of one
+};
@@ -0,0 +1,12 @@
+// Per-lock contention statistics, as returned by lockstat().
+// Times are in ticks of the CLINT timer (10 MHz on qemu).
+// NLOCKPC is in param.h.
+struct lockstat {
+  char name[16];
+  uint64 n;          // acquire()s
+  uint64 nspin;      // times around the spin loop
+  uint64 waittime;   // total time spent waiting to acquire
+  uint64 holdtime;   // total time held
+  uint64 pcs[NLOCKPC];    // call sites of acquire()
+  uint64 npcs[NLOCKPC];   // acquires from each call site
+};
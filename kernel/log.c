@@ -6,6 +6,8 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "stats.h"
+#include "trace.h"
 
 // Simple logging that allows concurrent FS system calls.
 //
@@ -29,6 +31,10 @@
 //   block C
 //   ...
 // Log appends are synchronous.
+//
+// Only metadata goes through the log. Regular files' data
+// is written in place before the transaction commits; see
+// writeblocks() in fs.c.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
@@ -43,6 +49,7 @@ struct log {
   int size;
   int outstanding; // how many FS sys calls are executing.
   int committing;  // in commit(), please wait.
+  int ncommit;     // commits so far, for log_sync()
   int dev;
   struct logheader lh;
 };
@@ -168,11 +175,29 @@ end_op(int dev)
     commit(dev);
     acquire(&log[dev].lock);
     log[dev].committing = 0;
+    log[dev].ncommit++;
     wakeup(&log);
     release(&log[dev].lock);
   }
 }
 
+// Wait until the operations that have ended so far are on
+// disk. The last outstanding end_op() commits, so there is
+// only something to wait for while others are in progress,
+// or a commit that includes ours is.
+void
+log_sync(int dev)
+{
+  int n;
+
+  acquire(&log[dev].lock);
+  n = log[dev].ncommit;
+  while((log[dev].outstanding > 0 || log[dev].committing) &&
+        log[dev].ncommit == n)
+    sleep(&log, &log[dev].lock);
+  release(&log[dev].lock);
+}
+
 // Copy modified blocks from cache to log.
 static void
 write_log(int dev)
@@ -193,11 +218,15 @@ static void
 commit(int dev)
 {
   if (log[dev].lh.n > 0) {
+    TRACE(TR_COMMIT, dev);
     write_log(dev);     // Write modified blocks from cache to log
     write_head(dev);    // Write header to disk -- the real commit
     install_trans(dev); // Now install writes to home locations
     log[dev].lh.n = 0;
     write_head(dev);    // Erase the transaction from the log
+    bcommitted(dev);    // Blocks it freed may be reused
+    statadd(STAT_LOG_COMMIT, 1);
+    TRACE(TR_COMMIT_END, dev);
   }
 }
 
@@ -16,21 +16,29 @@ main()
 {
   if(cpuid() == 0){
     consoleinit();
-    printfinit();
+    kloginit();      // kernel log, for printf()
     printf("\n");
     printf("xv6 kernel is booting\n");
     printf("\n");
     kinit();         // physical page allocator
+    rcuinit();       // deferred frees for lockless readers
     kvminit();       // create kernel page table
     kvminithart();   // turn on paging
     procinit();      // process table
+    futexinit();     // futex sleep lock
     trapinit();      // trap vectors
     trapinithart();  // install kernel trap vector
     plicinit();      // set up interrupt controller
     plicinithart();  // ask PLIC for device interrupts
     binit();         // buffer cache
     iinit();         // inode cache
+    pagecacheinit(); // file page cache
     fileinit();      // file table
+    pollinit();      // poll() and epoll
+    sysringinit();   // batched and asynchronous system calls
+    statsinit();     // stats device
+    traceinit();     // event tracing
+    profinit();      // sampling profiler
     virtio_disk_init(minor(ROOTDEV)); // emulated hard disk
     userinit();      // first user process
     __sync_synchronize();
@@ -45,5 +53,6 @@ main()
     plicinithart();   // ask PLIC for device interrupts
   }
 
+  rcu_online();
   scheduler();        
 }
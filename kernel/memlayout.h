@@ -63,6 +63,18 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   ...
+//   SYSRING (batched system calls, see sysring.c)
+//   THREADFRAME(i) (p->tf of clone() threads)
 //   TRAPFRAME (p->tf, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+
+// threads made by clone() share their creator's page table,
+// so each maps its trapframe below TRAPFRAME, at a page
+// chosen by its slot in proc[].
+#define THREADFRAME(i) (TRAPFRAME - ((i)+1)*PGSIZE)
+
+// the page a process shares with the kernel to submit
+// system calls in batches, if it has asked for one.
+#define SYSRING (THREADFRAME(NPROC-1) - PGSIZE)
@@ -0,0 +1,486 @@
+//
+// Page cache: whole pages of file data, kept with the
+// in-memory inode and indexed by page number within the file.
+// readi() and writei() go through it for regular files, so
+// the buffer cache mostly holds metadata. execfault() maps
+// these pages straight into processes, so all processes
+// running a program share one copy of its text.
+//
+// Writes only change the cached pages and mark them dirty.
+// Disk blocks for the data are allocated, in runs as long as
+// possible, only when the pages are written back (see
+// iflush() in fs.c): by fsync(), by a writer that has left too
+// many pages dirty, or by the pageflushd kernel thread, which
+// wakes every FLUSHTICKS, or sooner when kalloc() is short of
+// memory. kalloc() reclaims clean pages that aren't in use
+// whenever it runs out of memory.
+//
+// An inode's pages hang off a two-level radix tree of
+// page-sized nodes with 512 entries each, which covers more
+// than MAXFILE. A slot holds the page's address, or'd with
+// PCDIRTY if it is dirty. A cached page holds one reference
+// (see the reference counts in kalloc.c), and each mapping of
+// it holds another, so a page outlives its eviction from the
+// cache until the last process unmaps it. An inode with dirty
+// pages is on the dirty list, which holds a reference to it,
+// so it stays in the inode cache until it has been written.
+//
+// Callers hold the inode's sleep-lock while filling, dirtying,
+// cleaning or invalidating its pages; pagecache_lock guards
+// the tree nodes themselves, the dirty bits and counts, and
+// the lists of inodes that have pages and dirty pages.
+// The one thing that changes a tree without the inode's lock
+// is pagecache_reclaim(), which only ever clears leaf slots.
+// So pagecache_get() can find a cached page without taking
+// pagecache_lock, inside an RCU read-side section (see
+// rcu.c), and reclaim frees pages with kfree_rcu() so that
+// such a lookup can still take a reference to the page.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "rusage.h"
+#include "proc.h"
+
+#define PCFANOUT  512
+#define PCX(level, idx) (((idx) >> (9*(level))) & (PCFANOUT-1))
+
+#define PCDIRTY   1ULL
+#define PCPAGE(slot) ((slot) & ~PCDIRTY)
+
+// how many pages pagecache_reclaim() tries to free at once.
+#define PCRECLAIM 32
+
+#define FLUSHTICKS 30    // how often pageflushd writes dirty pages
+#define DIRTYMAX   1024  // dirty pages before writers must help
+
+struct spinlock pagecache_lock;
+
+// inodes with cached pages, linked through ip->pcnext.
+static struct inode *pcinodes;
+
+// inodes with dirty pages, linked through ip->dirtynext.
+static struct inode *dirtyinodes;
+static int ndirty;         // dirty pages in all
+static int flushwanted;    // kalloc() wants pageflushd to run
+
+void
+pagecacheinit(void)
+{
+  initlock(&pagecache_lock, "pagecache");
+}
+
+// Return the address of the tree slot for page idx of ip.
+// If alloc, create missing tree nodes; otherwise return 0
+// if they don't exist. Caller must hold pagecache_lock.
+static uint64 *
+pcslot(struct inode *ip, uint idx, int alloc)
+{
+  uint64 *leaf;
+
+  if(ip->pages == 0){
+    if(!alloc || (ip->pages = kalloc()) == 0)
+      return 0;
+    memset(ip->pages, 0, PGSIZE);
+    ip->pcnext = pcinodes;
+    pcinodes = ip;
+  }
+  leaf = (uint64 *)ip->pages[PCX(1, idx)];
+  if(leaf == 0){
+    if(!alloc || (leaf = kalloc()) == 0)
+      return 0;
+    memset(leaf, 0, PGSIZE);
+    ip->pages[PCX(1, idx)] = (uint64)leaf;
+  }
+  return &leaf[PCX(0, idx)];
+}
+
+// Look up page idx of ip without locking.
+// Caller must hold ip->lock and be an RCU reader.
+static uint64
+pclookup(struct inode *ip, uint idx)
+{
+  uint64 *leaf;
+
+  if(ip->pages == 0)
+    return 0;
+  leaf = (uint64 *)ip->pages[PCX(1, idx)];
+  if(leaf == 0)
+    return 0;
+  return PCPAGE(__atomic_load_n(&leaf[PCX(0, idx)], __ATOMIC_ACQUIRE));
+}
+
+// Return the physical address of a page holding page idx
+// of ip's data, reading it from disk if it isn't cached.
+// The caller gets a reference to the page, which it drops
+// with kfree(). Bytes past the end of the file read as zero.
+// If write, the caller is about to change the page: idx may
+// be past the end of the file, and if processes have the
+// cached page mapped, it is replaced by a copy, leaving them
+// the old contents. Otherwise returns 0 if idx is past the
+// end of the file. Also returns 0 if out of memory.
+// Caller must hold ip->lock.
+uint64
+pagecache_get(struct inode *ip, uint idx, int write)
+{
+  uint64 *slot, pa;
+  char *mem;
+  uint off, n;
+
+  if(idx >= PCFANOUT*PCFANOUT)
+    return 0;
+  off = idx*PGSIZE;
+  if(off >= ip->size && !write)
+    return 0;
+
+  if(!write){
+    rcu_read_lock();
+    if((pa = pclookup(ip, idx)) != 0)
+      add_ref_count((uint8 *)pa, 1);
+    rcu_read_unlock();
+    if(pa)
+      return pa;
+  }
+
+  acquire(&pagecache_lock);
+  if((slot = pcslot(ip, idx, 1)) == 0){
+    release(&pagecache_lock);
+    return 0;
+  }
+  if((pa = PCPAGE(*slot)) != 0){
+    // the cache's is the only reference unless the page is
+    // mapped, since ip->lock excludes other readers.
+    if(write && get_ref_count((uint8 *)pa) > 1){
+      if((mem = kalloc()) == 0){
+        release(&pagecache_lock);
+        return 0;
+      }
+      memmove(mem, (char *)pa, PGSIZE);
+      kfree((void *)pa);
+      pa = (uint64)mem;
+      __atomic_store_n(slot, pa | (*slot & PCDIRTY), __ATOMIC_RELEASE);
+    }
+    add_ref_count((uint8 *)pa, 1);
+    release(&pagecache_lock);
+    return pa;
+  }
+  release(&pagecache_lock);
+
+  // ip->lock keeps anyone else from filling the slot
+  // while readblocks() sleeps.
+  if((mem = kalloc()) == 0)
+    return 0;
+  memset(mem, 0, PGSIZE);
+  n = off < ip->size ? ip->size - off : 0;
+  if(n > PGSIZE)
+    n = PGSIZE;
+  if(readblocks(ip, 0, (uint64)mem, off, n) != n){
+    kfree(mem);
+    return 0;
+  }
+
+  acquire(&pagecache_lock);
+  slot = pcslot(ip, idx, 0);
+  set_ref_count((uint8 *)mem, 2); // the cache's and the caller's
+  __atomic_store_n(slot, (uint64)mem, __ATOMIC_RELEASE);
+  release(&pagecache_lock);
+  return (uint64)mem;
+}
+
+// Mark page idx of ip, which is cached, as changed.
+// Caller must hold ip->lock.
+void
+pagecache_dirty(struct inode *ip, uint idx)
+{
+  uint64 *slot;
+
+  acquire(&pagecache_lock);
+  if((slot = pcslot(ip, idx, 0)) == 0 || *slot == 0)
+    panic("pagecache_dirty");
+  if((*slot & PCDIRTY) == 0){
+    *slot |= PCDIRTY;
+    ip->ndirty++;
+    ndirty++;
+  }
+  if(!ip->ondirty){
+    // like idup(), but the caller's reference keeps ip from
+    // being recycled, and iget() takes pagecache_lock inside
+    // icache.lock.
+    ip->ondirty = 1;
+    __sync_fetch_and_add(&ip->ref, 1);
+    ip->dirtynext = dirtyinodes;
+    dirtyinodes = ip;
+  }
+  release(&pagecache_lock);
+}
+
+// Return the index of the first dirty page of ip at or after
+// idx, and set *pa to its address, or return -1 if there is
+// none. Caller must hold ip->lock, which keeps the page from
+// being replaced or dropped.
+int
+pagecache_nextdirty(struct inode *ip, uint idx, uint64 *pa)
+{
+  uint64 *leaf;
+  int r;
+
+  r = -1;
+  acquire(&pagecache_lock);
+  if(ip->pages && ip->ndirty > 0){
+    for(; idx < PCFANOUT*PCFANOUT; idx++){
+      if((leaf = (uint64 *)ip->pages[PCX(1, idx)]) == 0){
+        idx |= PCFANOUT-1;  // skip the whole leaf
+        continue;
+      }
+      if(leaf[PCX(0, idx)] & PCDIRTY){
+        *pa = PCPAGE(leaf[PCX(0, idx)]);
+        r = idx;
+        break;
+      }
+    }
+  }
+  release(&pagecache_lock);
+  return r;
+}
+
+// Mark page idx of ip as matching the disk again.
+// Caller must hold ip->lock.
+void
+pagecache_clean(struct inode *ip, uint idx)
+{
+  uint64 *slot;
+
+  acquire(&pagecache_lock);
+  if((slot = pcslot(ip, idx, 0)) != 0 && (*slot & PCDIRTY)){
+    *slot &= ~PCDIRTY;
+    ip->ndirty--;
+    ndirty--;
+  }
+  release(&pagecache_lock);
+}
+
+// Drop the cached pages of ip that overlap the n bytes at
+// off, after the file's data there has changed on disk.
+// Processes that have them mapped keep their (now private)
+// copies. Returns -1, leaving them, if any are dirty.
+// Caller must hold ip->lock, or be the only user of ip.
+int
+pagecache_invalidate(struct inode *ip, uint off, uint n)
+{
+  uint64 *slot;
+  uint idx;
+
+  if(n == 0)
+    return 0;
+  acquire(&pagecache_lock);
+  if(ip->pages){
+    for(idx = off / PGSIZE; idx <= (off + n - 1) / PGSIZE; idx++){
+      if((slot = pcslot(ip, idx, 0)) != 0 && (*slot & PCDIRTY)){
+        release(&pagecache_lock);
+        return -1;
+      }
+    }
+    for(idx = off / PGSIZE; idx <= (off + n - 1) / PGSIZE; idx++){
+      if((slot = pcslot(ip, idx, 0)) != 0 && *slot != 0){
+        kfree((void *)*slot);
+        *slot = 0;
+      }
+    }
+  }
+  release(&pagecache_lock);
+  return 0;
+}
+
+// Drop ip's cached pages from page idx on, dirty or not,
+// when the file shrinks. Processes that have them mapped keep
+// their (now private) copies. Caller must hold ip->lock.
+void
+pagecache_truncate(struct inode *ip, uint idx)
+{
+  uint64 *leaf;
+  uint i, j;
+
+  acquire(&pagecache_lock);
+  if(ip->pages){
+    for(i = PCX(1, idx); i < PCFANOUT; i++){
+      if((leaf = (uint64 *)ip->pages[i]) == 0)
+        continue;
+      for(j = (i == PCX(1, idx)) ? PCX(0, idx) : 0; j < PCFANOUT; j++){
+        if(leaf[j] & PCDIRTY){
+          ip->ndirty--;
+          ndirty--;
+        }
+        if(leaf[j]){
+          kfree((void *)PCPAGE(leaf[j]));
+          leaf[j] = 0;
+        }
+      }
+    }
+  }
+  release(&pagecache_lock);
+}
+
+// Drop all of ip's cached pages, dirty or not, and the tree
+// that indexes them, e.g. when the file is truncated.
+void
+pagecache_drop(struct inode *ip)
+{
+  struct inode **pp;
+  int i;
+
+  pagecache_truncate(ip, 0);
+  acquire(&pagecache_lock);
+  if(ip->pages){
+    for(i = 0; i < PCFANOUT; i++)
+      if(ip->pages[i])
+        kfree((void *)ip->pages[i]);
+    kfree(ip->pages);
+    ip->pages = 0;
+    for(pp = &pcinodes; *pp; pp = &(*pp)->pcnext){
+      if(*pp == ip){
+        *pp = ip->pcnext;
+        break;
+      }
+    }
+    ip->pcnext = 0;
+  }
+  release(&pagecache_lock);
+}
+
+// Free up to PCRECLAIM clean cached pages that nobody has
+// mapped or is using. Called by kalloc() when it runs out of
+// memory. Clean pages can simply be dropped; dirty ones have
+// to wait for pageflushd, which this asks to hurry.
+// A lockless lookup may be about to take a reference to any
+// of them, so they go through kfree_rcu(); if the caller holds
+// no spinlock, wait for them to be freed. Returns the number
+// of pages freed.
+int
+pagecache_reclaim(void)
+{
+  static struct inode *next;
+  struct inode *ip;
+  uint64 *leaf;
+  int i, j, pass, freed, canwait;
+
+  // kalloc() may be called from inside the page cache.
+  canwait = !holdingany();
+  push_off();
+  if(holding(&pagecache_lock)){
+    pop_off();
+    return 0;
+  }
+  pop_off();
+
+  acquire(&pagecache_lock);
+  freed = 0;
+  // start where the last call stopped, so that no one
+  // file loses all its pages first.
+  for(pass = 0; pass < 2 && freed < PCRECLAIM; pass++){
+    ip = next;
+    if(pass == 1 || ip == 0 || ip->pages == 0)
+      ip = pcinodes;
+    for(; ip && freed < PCRECLAIM; ip = ip->pcnext){
+      for(i = 0; i < PCFANOUT && freed < PCRECLAIM; i++){
+        if((leaf = (uint64 *)ip->pages[i]) == 0)
+          continue;
+        for(j = 0; j < PCFANOUT && freed < PCRECLAIM; j++){
+          if(leaf[j] & PCDIRTY){
+            flushwanted = 1;
+            continue;
+          }
+          if(leaf[j] && get_ref_count((uint8 *)leaf[j]) == 1){
+            if(kfree_rcu((void *)leaf[j]) < 0)
+              goto out;
+            __atomic_store_n(&leaf[j], 0, __ATOMIC_RELEASE);
+            freed++;
+          }
+        }
+      }
+      next = ip->pcnext;
+    }
+  }
+out:
+  release(&pagecache_lock);
+  if(canwait)
+    return synchronize_rcu();
+  return 0;
+}
+
+// Write ip's dirty pages to disk, a transaction's worth at a
+// time: the ones dirty when it's called, or if !all, just one
+// transaction's worth. Caller must not hold ip->lock or be
+// inside a transaction.
+void
+pagecache_flush(struct inode *ip, int all)
+{
+  int n, left;
+
+  left = -1;
+  do {
+    begin_op(ip->dev);
+    ilock(ip);
+    if(left < 0)
+      left = ip->ndirty;
+    n = iflush(ip);
+    iunlock(ip);
+    end_op(ip->dev);
+    left -= n;
+  } while(all && n > 0 && left > 0);
+}
+
+// Called by writers: if too much is dirty, wake pageflushd,
+// and write some of ip's pages before dirtying more.
+void
+pagecache_throttle(struct inode *ip)
+{
+  if(__atomic_load_n(&ndirty, __ATOMIC_RELAXED) < DIRTYMAX)
+    return;
+  acquire(&tickslock);
+  flushwanted = 1;
+  wakeup(&ticks);
+  release(&tickslock);
+  pagecache_flush(ip, 0);
+}
+
+// The write-back thread, started by userinit().
+void
+pageflushd(void)
+{
+  struct inode *ip;
+  uint t0;
+
+  // still holding p->lock from scheduler.
+  release(&myproc()->lock);
+
+  for(;;){
+    acquire(&tickslock);
+    t0 = ticks;
+    while(ticks - t0 < FLUSHTICKS && !flushwanted)
+      sleep(&ticks, &tickslock);
+    release(&tickslock);
+    flushwanted = 0;
+
+    // the dirty list's reference keeps each inode cached.
+    for(;;){
+      acquire(&pagecache_lock);
+      if((ip = dirtyinodes) != 0){
+        dirtyinodes = ip->dirtynext;
+        ip->ondirty = 0;
+      }
+      release(&pagecache_lock);
+      if(ip == 0)
+        break;
+      pagecache_flush(ip, 1);
+      begin_op(ip->dev);
+      iput(ip);
+      end_op(ip->dev);
+    }
+  }
+}
@@ -10,5 +10,7 @@
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
 #define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
 #define FSSIZE       200000  // size of file system in blocks
+#define NEXECSEG      4  // max loadable segments in a program
+#define NLOCKPC       4  // call sites of acquire() kept per lock
 #define MAXPATH      128   // maximum file path name
 #define NDISK        2
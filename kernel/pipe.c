@@ -1,22 +1,43 @@
+//
+// Pipes. Each pipe's data is a ring of whole pages, which
+// starts as one page and grows, up to PIPEPAGES, when the
+// writer keeps finding it full. Reads and writes copy a run of
+// bytes at a time: as much as fits before the end of a page.
+//
+// Readers and writers only wake each other when it's worth it:
+// a reader sleeps until the pipe is no longer empty, but is
+// only woken once the writer sleeps or finishes its write; a
+// writer sleeps until enough space is free for the rest of its
+// write, or half the ring, whichever is less.
+//
+
 #include "types.h"
 #include "riscv.h"
 #include "defs.h"
 #include "param.h"
 #include "spinlock.h"
+#include "rusage.h"
 #include "proc.h"
 #include "fs.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "poll.h"
 
-#define PIPESIZE 512
+#define PIPEPAGES 4  // most pages in a pipe's ring
+#define PIPEGROW  4  // times the writer finds the ring full before it grows
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
-  uint nread;     // number of bytes read
-  uint nwrite;    // number of bytes written
+  char *pages[PIPEPAGES]; // the ring
+  int npages;
+  uint size;      // bytes in the ring: npages*PGSIZE
+  uint nread;     // number of bytes read, modulo size
+  uint nwrite;    // number of bytes written, less what nread dropped
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  int rwait;      // a reader is sleeping until there's data
+  uint wwait;     // free bytes a sleeping writer waits for, or 0
+  int nfull;      // writes that found the ring full since it was last empty
 };
 
 int
@@ -30,11 +51,13 @@ pipealloc(struct file **f0, struct file **f1)
     goto bad;
   if((pi = (struct pipe*)kalloc()) == 0)
     goto bad;
+  memset(pi, 0, sizeof(*pi));
+  if((pi->pages[0] = kalloc()) == 0)
+    goto bad;
+  pi->npages = 1;
+  pi->size = PGSIZE;
   pi->readopen = 1;
   pi->writeopen = 1;
-  pi->nwrite = 0;
-  pi->nread = 0;
-  memset(&pi->lock, 0, sizeof(pi->lock));
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
   (*f0)->writable = 0;
@@ -55,6 +78,16 @@ pipealloc(struct file **f0, struct file **f1)
   return -1;
 }
 
+static void
+pipefree(struct pipe *pi)
+{
+  int i;
+
+  for(i = 0; i < pi->npages; i++)
+    kfree(pi->pages[i]);
+  kfree((char*)pi);
+}
+
 void
 pipeclose(struct pipe *pi, int writable)
 {
@@ -66,62 +99,165 @@ pipeclose(struct pipe *pi, int writable)
     pi->readopen = 0;
     wakeup(&pi->nwrite);
   }
+  pollwakeup();
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
-    kfree((char*)pi);
+    pipefree(pi);
   } else
     release(&pi->lock);
 }
 
+// Add a page to pi's ring, which is full. The new page goes
+// after page k, the one that nread is in. The oldest bytes,
+// from nread to the end of page k, move to the same place
+// in the new page, which leaves a page of free space from
+// there back to nread's old place in page k.
+// Returns 0, or -1 if the ring can't grow.
+// Caller must hold pi->lock.
+static int
+pipegrow(struct pipe *pi)
+{
+  uint r, k, i;
+  char *mem;
+
+  if(pi->npages == PIPEPAGES || (mem = kalloc()) == 0)
+    return -1;
+  r = pi->nread % pi->size;
+  k = r / PGSIZE;
+  memmove(mem + r % PGSIZE, pi->pages[k] + r % PGSIZE, PGSIZE - r % PGSIZE);
+  for(i = pi->npages; i > k + 1; i--)
+    pi->pages[i] = pi->pages[i-1];
+  pi->pages[k+1] = mem;
+  pi->npages++;
+  pi->nread = (k+1)*PGSIZE + r % PGSIZE;
+  pi->nwrite = pi->nread + pi->size;
+  pi->size += PGSIZE;
+  pi->nfull = 0;
+  return 0;
+}
+
+// Write n bytes from user address addr to pi. If nonblock,
+// write only as much as fits, and fail if nothing does.
 int
-pipewrite(struct pipe *pi, uint64 addr, int n)
+pipewrite(struct pipe *pi, uint64 addr, int n, int nonblock)
 {
-  int i;
-  char ch;
+  int i, m;
+  uint off, want;
   struct proc *pr = myproc();
 
   acquire(&pi->lock);
-  for(i = 0; i < n; i++){
-    while(pi->nwrite == pi->nread + PIPESIZE){  //DOC: pipewrite-full
-      if(pi->readopen == 0 || myproc()->killed){
+  for(i = 0; i < n; i += m){
+    while(pi->nwrite == pi->nread + pi->size){  //DOC: pipewrite-full
+      if(pi->readopen == 0 || pr->killed){
         release(&pi->lock);
         return -1;
       }
-      wakeup(&pi->nread);
+      // a writer that keeps filling the ring gets a bigger one.
+      if(++pi->nfull >= PIPEGROW && pipegrow(pi) == 0)
+        break;
+      if(nonblock)
+        goto out;
+      if(pi->rwait){
+        pi->rwait = 0;
+        wakeup(&pi->nread);
+      }
+      if(pi->nwrite != pi->nread)
+        pollwakeup();
+      want = n - i < pi->size / 2 ? n - i : pi->size / 2;
+      if(pi->wwait == 0 || want < pi->wwait)
+        pi->wwait = want;
       sleep(&pi->nwrite, &pi->lock);
     }
-    if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
+    // copy up to the end of the page, or as much as is free.
+    off = pi->nwrite % pi->size;
+    m = PGSIZE - off % PGSIZE;
+    if(m > pi->size - (pi->nwrite - pi->nread))
+      m = pi->size - (pi->nwrite - pi->nread);
+    if(m > n - i)
+      m = n - i;
+    if(copyin(pr->pagetable, pi->pages[off / PGSIZE] + off % PGSIZE, addr + i, m) == -1)
       break;
-    pi->data[pi->nwrite++ % PIPESIZE] = ch;
+    pi->nwrite += m;
+  }
+out:
+  if(pi->rwait && pi->nwrite != pi->nread){
+    pi->rwait = 0;
+    wakeup(&pi->nread);
   }
-  wakeup(&pi->nread);
+  if(i > 0)
+    pollwakeup();
   release(&pi->lock);
-  return n;
+  if(nonblock && i == 0 && n > 0)
+    return -1;
+  return i;
 }
 
+// Read up to n bytes from pi to user address addr, waiting
+// for some to arrive unless nonblock.
 int
-piperead(struct pipe *pi, uint64 addr, int n)
+piperead(struct pipe *pi, uint64 addr, int n, int nonblock)
 {
-  int i;
+  int i, m;
+  uint off;
   struct proc *pr = myproc();
-  char ch;
 
   acquire(&pi->lock);
   while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
-    if(myproc()->killed){
+    if(myproc()->killed || nonblock){
       release(&pi->lock);
       return -1;
     }
+    // the writer isn't keeping ahead of us.
+    pi->nfull = 0;
+    pi->rwait = 1;
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
-      break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
+  for(i = 0; i < n && pi->nread != pi->nwrite; i += m){  //DOC: piperead-copy
+    off = pi->nread % pi->size;
+    m = PGSIZE - off % PGSIZE;
+    if(m > pi->nwrite - pi->nread)
+      m = pi->nwrite - pi->nread;
+    if(m > n - i)
+      m = n - i;
+    if(copyout(pr->pagetable, addr + i, pi->pages[off / PGSIZE] + off % PGSIZE, m) == -1)
       break;
+    pi->nread += m;
+    // keep the counters below 2*size so they never wrap, since
+    // size needn't divide 2^32.
+    if(pi->nread >= pi->size){
+      pi->nread -= pi->size;
+      pi->nwrite -= pi->size;
+    }
+  }
+  if(pi->wwait && pi->size - (pi->nwrite - pi->nread) >= pi->wwait){
+    pi->wwait = 0;
+    wakeup(&pi->nwrite);  //DOC: piperead-wakeup
   }
-  wakeup(&pi->nwrite);  //DOC: piperead-wakeup
+  if(i > 0)
+    pollwakeup();
   release(&pi->lock);
   return i;
 }
+
+// What poll() would report for the read end of pi,
+// or the write end if writable.
+int
+pipepoll(struct pipe *pi, int writable)
+{
+  int r = 0;
+
+  acquire(&pi->lock);
+  if(writable){
+    if(pi->readopen == 0)
+      r = POLLERR;
+    else if(pi->nwrite != pi->nread + pi->size)
+      r = POLLOUT;
+  } else {
+    if(pi->nread != pi->nwrite)
+      r = POLLIN;
+    if(pi->writeopen == 0)
+      r |= POLLIN | POLLHUP;   // read() returns 0
+  }
+  release(&pi->lock);
+  return r;
+}
@@ -0,0 +1,298 @@
+//
+// Waiting on many file descriptors at once: poll(), and
+// epoll sets, which remember a list of descriptors to watch.
+//
+// Rather than have every pipe and device keep a list of who
+// is polling it, there is one wait channel for all pollers.
+// Whatever might make a descriptor ready (data written to a
+// pipe, a line typed at the console, a pipe end closed) calls
+// pollwakeup(), which bumps pollseq and wakes them all; each
+// then asks filepoll() about its own descriptors again. That
+// costs nothing while no one is polling, and pollers are few.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "rusage.h"
+#include "proc.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "poll.h"
+
+#define NPOLLFD 64  // most pollfds in one poll()
+
+// the descriptors an epoll set watches, by number in the
+// process that waits on it. each fd is in the set at most once.
+struct epoll {
+  struct spinlock lock;
+  int n;
+  struct {
+    int fd;
+    uint events;
+    uint64 data;
+  } watch[NOFILE];
+};
+
+struct spinlock polllock;
+static uint pollseq;   // bumped by pollwakeup(); pollers sleep on it
+static int npollers;   // processes in pollwait()
+static int ntimed;     // those of them with a timeout
+
+void
+pollinit(void)
+{
+  initlock(&polllock, "poll");
+}
+
+// Something may have become ready: make pollers look again.
+// Callers change the state that filepoll() reports before
+// calling this, under the same lock filepoll() takes to read
+// it, so a poller either sees the change or is woken.
+void
+pollwakeup(void)
+{
+  if(__atomic_load_n(&npollers, __ATOMIC_SEQ_CST) == 0)
+    return;
+  acquire(&polllock);
+  pollseq++;
+  wakeup(&pollseq);
+  release(&polllock);
+}
+
+// Called by clockintr() so that pollers with a timeout can
+// notice that it has run out.
+void
+polltick(void)
+{
+  if(__atomic_load_n(&ntimed, __ATOMIC_SEQ_CST) == 0)
+    return;
+  acquire(&polllock);
+  wakeup(&pollseq);
+  release(&polllock);
+}
+
+// Call scan(arg) until it returns non-zero, or timeout ticks
+// have passed; a timeout of -1 means forever, 0 means scan
+// once. Returns what scan() last returned, or -1 if the
+// process was killed.
+static int
+pollwait(int (*scan)(void *), void *arg, int timeout)
+{
+  struct proc *p = myproc();
+  uint seq, start;
+  int n;
+
+  __atomic_fetch_add(&npollers, 1, __ATOMIC_SEQ_CST);
+  if(timeout > 0)
+    __atomic_fetch_add(&ntimed, 1, __ATOMIC_SEQ_CST);
+  start = ticks;
+  for(;;){
+    seq = __atomic_load_n(&pollseq, __ATOMIC_SEQ_CST);
+    n = scan(arg);
+    if(n != 0 || timeout == 0 || (timeout > 0 && ticks - start >= timeout))
+      break;
+    if(p->killed){
+      n = -1;
+      break;
+    }
+    acquire(&polllock);
+    while(pollseq == seq && !p->killed &&
+          (timeout < 0 || ticks - start < timeout))
+      sleep(&pollseq, &polllock);
+    release(&polllock);
+  }
+  if(timeout > 0)
+    __atomic_fetch_sub(&ntimed, 1, __ATOMIC_SEQ_CST);
+  __atomic_fetch_sub(&npollers, 1, __ATOMIC_SEQ_CST);
+  return n;
+}
+
+struct pollset {
+  struct pollfd fds[NPOLLFD];
+  int n;
+};
+
+// Fill in revents for each of the pollfds, and
+// return how many have any.
+static int
+pollscan(void *arg)
+{
+  struct pollset *s = arg;
+  struct pollfd *pfd;
+  struct file *f;
+  int n;
+
+  n = 0;
+  for(pfd = s->fds; pfd < s->fds + s->n; pfd++){
+    if(pfd->fd < 0)
+      pfd->revents = 0;   // a way to skip an entry
+    else if(pfd->fd >= NOFILE || (f = myproc()->ofile[pfd->fd]) == 0)
+      pfd->revents = POLLNVAL;
+    else
+      pfd->revents = filepoll(f) & (pfd->events | POLLERR | POLLHUP);
+    if(pfd->revents)
+      n++;
+  }
+  return n;
+}
+
+// Wait for one of the nfds pollfds at user address addr
+// to be ready; see pollwait() for timeout. Returns how many
+// are ready, 0 if the timeout ran out, or -1.
+int
+poll(uint64 addr, int nfds, int timeout)
+{
+  struct proc *p = myproc();
+  struct pollset s;
+  int n;
+
+  if(nfds < 0 || nfds > NPOLLFD)
+    return -1;
+  s.n = nfds;
+  if(copyin(p->pagetable, (char *)s.fds, addr, nfds * sizeof(struct pollfd)) < 0)
+    return -1;
+  if((n = pollwait(pollscan, &s, timeout)) < 0)
+    return -1;
+  if(copyout(p->pagetable, addr, (char *)s.fds, nfds * sizeof(struct pollfd)) < 0)
+    return -1;
+  return n;
+}
+
+// Allocate an epoll set and a file that refers to it.
+int
+epollalloc(struct file **f)
+{
+  struct epoll *ep;
+
+  if((*f = filealloc()) == 0)
+    return -1;
+  if((ep = (struct epoll *)kalloc()) == 0){
+    fileclose(*f);
+    return -1;
+  }
+  memset(ep, 0, sizeof(*ep));
+  initlock(&ep->lock, "epoll");
+  (*f)->type = FD_EPOLL;
+  (*f)->readable = 0;
+  (*f)->writable = 0;
+  (*f)->ep = ep;
+  return 0;
+}
+
+void
+epollclose(struct epoll *ep)
+{
+  kfree((char *)ep);
+}
+
+// Add fd to the epoll set f, remove it, or change what is
+// watched for; for the first and last, the struct epoll_event
+// at user address addr says what. Returns 0, or -1.
+int
+epollctl(struct file *f, int op, int fd, uint64 addr)
+{
+  struct epoll *ep = f->ep;
+  struct epoll_event ev;
+  struct file *wf;
+  int i;
+
+  if(f->type != FD_EPOLL || fd < 0 || fd >= NOFILE)
+    return -1;
+  if(op != EPOLL_CTL_DEL){
+    // epoll sets can't watch each other.
+    if((wf = myproc()->ofile[fd]) == 0 || wf->type == FD_EPOLL)
+      return -1;
+    if(copyin(myproc()->pagetable, (char *)&ev, addr, sizeof(ev)) < 0)
+      return -1;
+  }
+
+  acquire(&ep->lock);
+  for(i = 0; i < ep->n; i++)
+    if(ep->watch[i].fd == fd)
+      break;
+  switch(op){
+  case EPOLL_CTL_ADD:
+    if(i < ep->n)
+      goto bad;
+    ep->n++;
+    ep->watch[i].fd = fd;
+    // fall through
+  case EPOLL_CTL_MOD:
+    if(i == ep->n)
+      goto bad;
+    ep->watch[i].events = ev.events;
+    ep->watch[i].data = ev.data;
+    break;
+  case EPOLL_CTL_DEL:
+    if(i == ep->n)
+      goto bad;
+    ep->watch[i] = ep->watch[--ep->n];
+    break;
+  default:
+    goto bad;
+  }
+  release(&ep->lock);
+  return 0;
+
+bad:
+  release(&ep->lock);
+  return -1;
+}
+
+struct epollscan {
+  struct epoll *ep;
+  struct epoll_event ev[NOFILE];
+  int max;
+};
+
+// Collect up to s->max ready descriptors from s->ep.
+// A watched fd that has since been closed is ignored.
+static int
+epollscan(void *arg)
+{
+  struct epollscan *s = arg;
+  struct epoll *ep = s->ep;
+  struct file *f;
+  uint r;
+  int i, n;
+
+  n = 0;
+  acquire(&ep->lock);
+  for(i = 0; i < ep->n && n < s->max; i++){
+    if((f = myproc()->ofile[ep->watch[i].fd]) == 0)
+      continue;
+    r = filepoll(f) & (ep->watch[i].events | POLLERR | POLLHUP);
+    if(r){
+      s->ev[n].events = r;
+      s->ev[n].data = ep->watch[i].data;
+      n++;
+    }
+  }
+  release(&ep->lock);
+  return n;
+}
+
+// Wait for descriptors in the epoll set f to be ready, and
+// copy up to max struct epoll_events for them to user address
+// addr; see pollwait() for timeout. Returns how many were
+// copied, 0 if the timeout ran out, or -1.
+int
+epollwait(struct file *f, uint64 addr, int max, int timeout)
+{
+  struct epollscan s;
+  int n;
+
+  if(f->type != FD_EPOLL || max <= 0)
+    return -1;
+  s.ep = f->ep;
+  s.max = max < NOFILE ? max : NOFILE;
+  if((n = pollwait(epollscan, &s, timeout)) < 0)
+    return -1;
+  if(copyout(myproc()->pagetable, addr, (char *)s.ev, n * sizeof(struct epoll_event)) < 0)
+    return -1;
+  return n;
+}
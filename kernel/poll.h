@@ -0,0 +1,23 @@
+// Events for poll() and epollwait(); see poll.c.
+#define POLLIN   0x1    // reading won't block
+#define POLLOUT  0x4    // writing won't block
+#define POLLERR  0x8    // writing would fail: no one is reading
+#define POLLHUP  0x10   // no one is writing any more
+#define POLLNVAL 0x20   // fd isn't open
+
+struct pollfd {
+  int fd;
+  short events;     // what to wait for
+  short revents;    // what happened; POLLERR, POLLHUP and
+                    // POLLNVAL are reported whether asked for or not
+};
+
+// epollctl() operations
+#define EPOLL_CTL_ADD 1   // watch fd
+#define EPOLL_CTL_DEL 2   // stop watching fd
+#define EPOLL_CTL_MOD 3   // change the events or data for fd
+
+struct epoll_event {
+  uint events;
+  uint64 data;      // returned with the events, for the caller
+};
@@ -1,5 +1,5 @@
 //
-// formatted console output -- printf, panic.
+// formatted output -- printf, klog, snprintf, panic.
 //
 
 #include <stdarg.h>
@@ -13,71 +13,73 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "defs.h"
+#include "rusage.h"
 #include "proc.h"
+#include "klog.h"
 
 volatile int panicked = 0;
 
-// lock to avoid interleaving concurrent printf's.
-static struct {
-  struct spinlock lock;
-  int locking;
-} pr;
-
 static char digits[] = "0123456789abcdef";
 
+// snprintf()'s output buffer.
+struct sbuf {
+  char *buf;
+  int sz;
+  int n;   // characters formatted so far, even if they didn't fit
+};
+
 static void
-printint(int xx, int base, int sign)
+sputc(struct sbuf *sb, int c)
 {
-  char buf[16];
-  int i;
-  uint x;
+  if(sb->n < sb->sz - 1)
+    sb->buf[sb->n] = c;
+  sb->n++;
+}
 
-  if(sign && (sign = xx < 0))
-    x = -xx;
-  else
-    x = xx;
+static void
+sprintint(struct sbuf *sb, uint64 x, int base, int neg)
+{
+  char buf[65];
+  int i;
 
   i = 0;
   do {
     buf[i++] = digits[x % base];
   } while((x /= base) != 0);
-
-  if(sign)
+  if(neg)
     buf[i++] = '-';
-
   while(--i >= 0)
-    consputc(buf[i]);
+    sputc(sb, buf[i]);
 }
 
 static void
-printptr(uint64 x)
+sprintptr(struct sbuf *sb, uint64 x)
 {
   int i;
-  consputc('0');
-  consputc('x');
-  for (i = 0; i < (sizeof(uint64) * 2); i++, x <<= 4)
-    consputc(digits[x >> (sizeof(uint64) * 8 - 4)]);
+
+  sputc(sb, '0');
+  sputc(sb, 'x');
+  for(i = 0; i < sizeof(uint64) * 2; i++, x <<= 4)
+    sputc(sb, digits[x >> (sizeof(uint64) * 8 - 4)]);
 }
 
-// Print to the console. only understands %d, %x, %p, %s.
-void
-printf(char *fmt, ...)
+// Format into buf, which holds sz bytes, understanding %d, %x,
+// %b (binary), %p, %s, and %l for a uint64 in decimal. The
+// result is always null-terminated, and truncated if it doesn't
+// fit. Returns the length it would have had with room for it all.
+static int
+vsnprintf(char *buf, int sz, char *fmt, va_list ap)
 {
-  va_list ap;
-  int i, c, locking;
+  struct sbuf sb;
+  int i, c, d;
   char *s;
 
-  locking = pr.locking;
-  if(locking)
-    acquire(&pr.lock);
-
-  if (fmt == 0)
-    panic("null fmt");
-
-  va_start(ap, fmt);
+  sb.buf = buf;
+  sb.sz = sz;
+  sb.n = 0;
   for(i = 0; (c = fmt[i] & 0xff) != 0; i++){
     if(c != '%'){
-      consputc(c);
+      sputc(&sb, c);
       continue;
     }
     c = fmt[++i] & 0xff;
@@ -85,42 +87,93 @@ printf(char *fmt, ...)
       break;
     switch(c){
     case 'd':
-      printint(va_arg(ap, int), 10, 1);
+      d = va_arg(ap, int);
+      sprintint(&sb, d < 0 ? -(uint64)d : d, 10, d < 0);
       break;
-    case 'b':
-      printint(va_arg(ap, int), 2, 1);
+    case 'l':
+      sprintint(&sb, va_arg(ap, uint64), 10, 0);
       break;
     case 'x':
-      printint(va_arg(ap, int), 16, 1);
+      sprintint(&sb, va_arg(ap, uint), 16, 0);
+      break;
+    case 'b':
+      sprintint(&sb, va_arg(ap, uint), 2, 0);
       break;
     case 'p':
-      printptr(va_arg(ap, uint64));
+      sprintptr(&sb, va_arg(ap, uint64));
       break;
     case 's':
       if((s = va_arg(ap, char*)) == 0)
         s = "(null)";
       for(; *s; s++)
-        consputc(*s);
+        sputc(&sb, *s);
       break;
     case '%':
-      consputc('%');
+      sputc(&sb, '%');
       break;
     default:
       // Print unknown % sequence to draw attention.
-      consputc('%');
-      consputc(c);
+      sputc(&sb, '%');
+      sputc(&sb, c);
       break;
     }
   }
+  if(sz > 0)
+    buf[sb.n < sz ? sb.n : sz - 1] = 0;
+  return sb.n;
+}
+
+// Format into buf, which holds sz bytes; see vsnprintf().
+int
+snprintf(char *buf, int sz, char *fmt, ...)
+{
+  va_list ap;
+  int n;
+
+  va_start(ap, fmt);
+  n = vsnprintf(buf, sz, fmt, ap);
+  va_end(ap);
+  return n;
+}
 
-  if(locking)
-    release(&pr.lock);
+static void
+vklog(int level, char *fmt, va_list ap)
+{
+  char buf[256];
+  int n;
+
+  if(fmt == 0)
+    panic("null fmt");
+  n = vsnprintf(buf, sizeof(buf), fmt, ap);
+  klogput(level, buf, n < sizeof(buf) ? n : sizeof(buf) - 1);
+}
+
+// Log a message at level KL_* (see klog.c).
+void
+klog(int level, char *fmt, ...)
+{
+  va_list ap;
+
+  va_start(ap, fmt);
+  vklog(level, fmt, ap);
+  va_end(ap);
+}
+
+// Log a message at KL_INFO, which klogd writes to the console.
+void
+printf(char *fmt, ...)
+{
+  va_list ap;
+
+  va_start(ap, fmt);
+  vklog(KL_INFO, fmt, ap);
+  va_end(ap);
 }
 
 void
 panic(char *s)
 {
-  pr.locking = 0;
+  klogpanic();
   printf("PANIC: ");
   printf(s);
   printf("\n");
@@ -129,10 +182,3 @@ panic(char *s)
   for(;;)
     ;
 }
-
-void
-printfinit(void)
-{
-  initlock(&pr.lock, "pr");
-  pr.locking = 1;
-}
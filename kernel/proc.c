@@ -6,7 +6,11 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "file.h"
+#include "rusage.h"
 #include "proc.h"
+#include "spawn.h"
+#include "stats.h"
+#include "trace.h"
 #include "defs.h"
 
 struct cpu cpus[NCPU];
@@ -18,6 +22,30 @@ struct proc *initproc;
 int nextpid = 1;
 struct spinlock pid_lock;
 
+// protects the reference counts on shared user page tables.
+struct spinlock vm_lock;
+
+// serialize changes to the size of user address spaces, which
+// clone() threads share; see vmlock().
+#define NVMLOCK 16
+static struct spinlock vmlocks[NVMLOCK];
+
+// ASIDs are handed out in order, and when they run out, a new
+// generation starts. a process whose p->asidgen isn't current
+// gets a new one when it next returns to user space.
+struct spinlock asid_lock;
+uint64 asidgen = 1;
+uint nextasid = 1;
+
+// tlbinval() flushes ranges of more pages than this by ASID.
+#define TLBPAGES 16
+
+// the user page tables that have been loaded into satp, one bit
+// per root page; tlbinval() has nothing to do for the others,
+// such as the one fork() or exec() is filling in.
+static uint ptloaded[(PHYSTOP - KERNBASE) / PGSIZE / 32];
+#define PTINDEX(pt) (((uint64)(pt) - KERNBASE) / PGSIZE)
+
 extern void forkret(void);
 static void wakeup1(struct proc *chan);
 
@@ -27,8 +55,13 @@ void
 procinit(void)
 {
   struct proc *p;
+  int i;
   
   initlock(&pid_lock, "nextpid");
+  initlock(&vm_lock, "vm");
+  for(i = 0; i < NVMLOCK; i++)
+    initlock(&vmlocks[i], "vmsize");
+  initlock(&asid_lock, "asid");
   for(p = proc; p < &proc[NPROC]; p++) {
       initlock(&p->lock, "proc");
 
@@ -122,6 +155,18 @@ found:
 
   // An empty user page table.
   p->pagetable = proc_pagetable(p);
+  p->tfva = TRAPFRAME;
+  p->thread = 0;
+  p->vfork = 0;
+  p->ustack = 0;
+  p->execip = 0;
+  p->nexecseg = 0;
+  p->asidgen = 0;
+  p->tlbstale = 0;
+  p->aio = 0;
+  p->karg = 0;
+  memset(&p->ru, 0, sizeof(p->ru));
+  memset(&p->cru, 0, sizeof(p->cru));
 
   // Set up new context to start executing at forkret,
   // which returns to user space.
@@ -146,11 +191,17 @@ freeproc(struct proc *p)
   if(p->tf)
     kfree((void*)p->tf);
   p->tf = 0;
+  if(p->tf_sigalarm_save)
+    kfree((void*)p->tf_sigalarm_save);
+  p->tf_sigalarm_save = 0;
   if(p->pagetable)
-    proc_freepagetable(p->pagetable, p->sz);
+    proc_freepagetable(p->pagetable, p->sz, p->tfva);
   p->pagetable = 0;
   p->sz = 0;
   p->pid = 0;
+  p->thread = 0;
+  p->ustack = 0;
+  p->nexecseg = 0;
   p->parent = 0;
   p->name[0] = 0;
   p->chan = 0;
@@ -185,13 +236,214 @@ proc_pagetable(struct proc *p)
 
 // Free a process's page table, and free the
 // physical memory it refers to.
+// tfva is where this process's trapframe is mapped.
+// Threads made by clone() share one page table, and the
+// reference count of its root page says how many; only
+// the last one to leave frees the user memory.
 void
-proc_freepagetable(pagetable_t pagetable, uint64 sz)
+proc_freepagetable(pagetable_t pagetable, uint64 sz, uint64 tfva)
 {
+  uint8 ref;
+
+  uvmunmap(pagetable, tfva, PGSIZE, 0);
+
+  acquire(&vm_lock);
+  ref = get_ref_count((uint8 *)pagetable);
+  if(ref > 1){
+    set_ref_count((uint8 *)pagetable, ref - 1);
+    release(&vm_lock);
+    return;
+  }
+  release(&vm_lock);
+
+  // no one uses it now, and its root page may be a new page
+  // table's soon.
+  __atomic_and_fetch(&ptloaded[PTINDEX(pagetable) / 32],
+                     ~(1U << (PTINDEX(pagetable) % 32)), __ATOMIC_SEQ_CST);
   uvmunmap(pagetable, TRAMPOLINE, PGSIZE, 0);
-  uvmunmap(pagetable, TRAPFRAME, PGSIZE, 0);
-  if(sz > 0)
-    uvmfree(pagetable, sz);
+  uvmunmap(pagetable, SYSRING, PGSIZE, 1);
+  uvmfree(pagetable, sz);
+}
+
+// Map a zeroed page at SYSRING in p's page table for
+// batched system calls, unless one is already there.
+// fork() doesn't copy it, and exec() drops it.
+int
+mapsysring(struct proc *p)
+{
+  char *mem;
+  int r;
+
+  // vm_lock keeps two threads from mapping it at once.
+  acquire(&vm_lock);
+  r = 0;
+  if(walkaddr(p->pagetable, SYSRING) == 0){
+    if((mem = kalloc()) == 0){
+      r = -1;
+    } else {
+      memset(mem, 0, PGSIZE);
+      if(mappages(p->pagetable, SYSRING, PGSIZE, (uint64)mem,
+                  PTE_R | PTE_W | PTE_U) != 0){
+        kfree(mem);
+        r = -1;
+      }
+    }
+  }
+  release(&vm_lock);
+  return r;
+}
+
+// The lock to hold while growing or shrinking the user memory
+// that pagetable maps and setting its size, so that threads
+// sharing it can't map a page twice, lose one, or disagree on
+// the size. Like the page table's reference count, it is found
+// from the root page: address spaces hash to a few locks.
+struct spinlock*
+vmlock(pagetable_t pagetable)
+{
+  return &vmlocks[(uint64)pagetable / PGSIZE % NVMLOCK];
+}
+
+// Set the size of p's user memory, and of every
+// clone() thread that shares it. Caller must hold
+// vmlock(p->pagetable).
+void
+proc_setsz(struct proc *p, uint64 sz)
+{
+  struct proc *pp;
+
+  for(pp = proc; pp < &proc[NPROC]; pp++){
+    // sharepagetable() holds a new thread's lock while it
+    // waits for the vmlock, but only points the thread at
+    // the page table once it has it.
+    if(pp != p && pp->pagetable != p->pagetable)
+      continue;
+    acquire(&pp->lock);
+    if(pp == p || (pp->state != UNUSED && pp->pagetable == p->pagetable))
+      pp->sz = sz;
+    release(&pp->lock);
+  }
+}
+
+// Shrink p's user memory by n bytes. Threads sharing it may
+// still reach the pages through their TLBs until they next
+// enter the kernel, so the pages are freed after a grace
+// period. When too many are already waiting for one, let go
+// of the vmlock, wait, and carry on. Returns the old size.
+uint64
+shrinkproc(struct proc *p, uint64 n)
+{
+  struct spinlock *lk = vmlock(p->pagetable);
+  uint64 sz, oldsz, newsz, end;
+
+  acquire(lk);
+  oldsz = sz = p->sz;
+  for(;;){
+    if(n > sz)
+      n = sz;
+    newsz = sz - n;
+    end = uvmunmaprcu(p->pagetable, PGROUNDUP(newsz),
+                      PGROUNDUP(sz) - PGROUNDUP(newsz));
+    if(end == PGROUNDUP(newsz))
+      break;
+    if(end < sz){
+      n -= sz - end;
+      proc_setsz(p, end);
+    }
+    release(lk);
+    synchronize_rcu();
+    acquire(lk);
+    sz = p->sz;
+  }
+  if(PGROUNDUP(newsz) < PGROUNDUP(oldsz))
+    free_pagetable(p->pagetable, PGROUNDUP(newsz));
+  proc_setsz(p, newsz);
+  release(lk);
+  return oldsz;
+}
+
+// Note that the mappings of the n bytes at va in pagetable
+// have changed (all of them, if n is 0). Flush them from this
+// CPU's TLB if the current process uses pagetable, and make
+// every process that uses it flush its ASID before it next
+// runs on any other CPU. Like before ASIDs, a thread running
+// on another CPU meanwhile sees the change only when it next
+// enters the kernel.
+void
+tlbinval(pagetable_t pagetable, uint64 va, uint64 n)
+{
+  struct proc *p, *me;
+  uint64 a;
+  int id;
+
+  if(maxasid == 0)
+    return;  // userret flushes the whole TLB
+  // a page table no CPU has loaded can't be in any TLB;
+  // usersatp() marks it before anyone loads it.
+  __sync_synchronize();
+  if((__atomic_load_n(&ptloaded[PTINDEX(pagetable) / 32], __ATOMIC_SEQ_CST) &
+      (1U << (PTINDEX(pagetable) % 32))) == 0)
+    return;
+  push_off();
+  me = mycpu()->proc;
+  id = cpuid();
+  for(p = proc; p < &proc[NPROC]; p++){
+    if(p->state == UNUSED || p->pagetable != pagetable)
+      continue;
+    if(p != me || p->asidgen != asidgen){
+      __atomic_store_n(&p->tlbstale, ~0, __ATOMIC_RELEASE);
+      continue;
+    }
+    __atomic_or_fetch(&p->tlbstale, ~(1 << id), __ATOMIC_RELEASE);
+    if(n == 0 || n > TLBPAGES*PGSIZE){
+      sfence_vma_asid(p->asid);
+    } else {
+      for(a = PGROUNDDOWN(va); a < va + n; a += PGSIZE)
+        sfence_vma_page(a, p->asid);
+    }
+  }
+  pop_off();
+}
+
+// The satp value that runs p's user code. Gives p an ASID
+// if it has none from the current generation, starting a new
+// generation when they run out, and flushes this CPU's TLB
+// of whatever it may hold for that ASID that's stale.
+// Called with interrupts off, on the way to user space.
+uint64
+usersatp(struct proc *p)
+{
+  struct cpu *c = mycpu();
+  int id = cpuid();
+
+  if(maxasid == 0)
+    return MAKE_SATP(p->pagetable);
+
+  if(p->asidgen != __atomic_load_n(&asidgen, __ATOMIC_ACQUIRE)){
+    acquire(&asid_lock);
+    if(nextasid > maxasid){
+      // every CPU flushes its whole TLB before using
+      // an ASID from the new generation.
+      asidgen++;
+      nextasid = 1;
+    }
+    p->asid = nextasid++;
+    p->asidgen = asidgen;
+    release(&asid_lock);
+  }
+
+  if(c->asidgen != p->asidgen){
+    c->asidgen = p->asidgen;
+    __atomic_and_fetch(&p->tlbstale, ~(1 << id), __ATOMIC_ACQUIRE);
+    sfence_vma();
+  } else if(p->tlbstale & (1 << id)){
+    __atomic_and_fetch(&p->tlbstale, ~(1 << id), __ATOMIC_ACQUIRE);
+    sfence_vma_asid(p->asid);
+  }
+  if((ptloaded[PTINDEX(p->pagetable) / 32] & (1U << (PTINDEX(p->pagetable) % 32))) == 0)
+    __atomic_or_fetch(&ptloaded[PTINDEX(p->pagetable) / 32],
+                      1U << (PTINDEX(p->pagetable) % 32), __ATOMIC_SEQ_CST);
+  return MAKE_SATP(p->pagetable) | SATP_ASID(p->asid);
 }
 
 // a user program that calls exec("/init")
@@ -230,6 +482,12 @@ userinit(void)
   p->state = RUNNABLE;
 
   release(&p->lock);
+
+  // the page cache's write-back thread, the one that frees
+  // big files, and the one that writes the kernel log.
+  if(kthread(p, pageflushd, 0) == 0 || kthread(p, itruncd, 0) == 0 ||
+     kthread(p, klogd, 0) == 0)
+    panic("userinit: kthread");
 }
 
 // Grow or shrink user memory by n bytes.
@@ -239,19 +497,35 @@ growproc(int n)
 {
   uint sz;
   struct proc *p = myproc();
+  struct spinlock *lk = vmlock(p->pagetable);
 
+  if(n < 0){
+    shrinkproc(p, -n);
+    return 0;
+  }
+  acquire(lk);
   sz = p->sz;
   if(n > 0){
     if((sz = uvmalloc(p->pagetable, sz, sz + n)) == 0) {
+      release(lk);
       return -1;
     }
-  } else if(n < 0){
-    sz = uvmdealloc(p->pagetable, sz, sz + n);
   }
-  p->sz = sz;
+  proc_setsz(p, sz);
+  release(lk);
   return 0;
 }
 
+// Let np page in p's program image on demand too.
+static void
+copyexec(struct proc *np, struct proc *p)
+{
+  if(p->execip)
+    np->execip = idup(p->execip);
+  memmove(np->execseg, p->execseg, sizeof(p->execseg));
+  np->nexecseg = p->nexecseg;
+}
+
 // Create a new process, copying the parent.
 // Sets up child kernel stack to return as if from fork() system call.
 int
@@ -287,6 +561,78 @@ fork(void)
     if(p->ofile[i])
       np->ofile[i] = filedup(p->ofile[i]);
   np->cwd = idup(p->cwd);
+  copyexec(np, p);
+
+  safestrcpy(np->name, p->name, sizeof(p->name));
+
+  pid = np->pid;
+
+  np->state = RUNNABLE;
+
+  release(&np->lock);
+
+  return pid;
+}
+
+// Swap np's fresh page table for p's, and map np's
+// trapframe at a page of its own below TRAPFRAME.
+static int
+sharepagetable(struct proc *np, struct proc *p)
+{
+  proc_freepagetable(np->pagetable, 0, TRAPFRAME);
+  np->pagetable = 0;
+  np->tfva = THREADFRAME(np - proc);
+  if(mappages(p->pagetable, np->tfva, PGSIZE,
+              (uint64)(np->tf), PTE_R | PTE_W) != 0)
+    return -1;
+  acquire(&vm_lock);
+  set_ref_count((uint8 *)p->pagetable, get_ref_count((uint8 *)p->pagetable) + 1);
+  release(&vm_lock);
+  // a sibling may be in sbrk(); see proc_setsz().
+  acquire(vmlock(p->pagetable));
+  np->pagetable = p->pagetable;
+  np->sz = p->sz;
+  release(vmlock(p->pagetable));
+  return 0;
+}
+
+// Create a child that borrows the caller's memory instead
+// of copying it, and sleep until the child calls exec() or
+// exit(). Since the child runs on the caller's stack, it
+// should do nothing else.
+int
+vfork(void)
+{
+  int i, pid;
+  struct proc *np;
+  struct proc *p = myproc();
+
+  // Allocate process.
+  if((np = allocproc()) == 0){
+    return -1;
+  }
+
+  if(sharepagetable(np, p) < 0){
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+
+  np->parent = p;
+  np->vfork = 1;
+
+  // copy saved user registers.
+  *(np->tf) = *(p->tf);
+
+  // Cause vfork to return 0 in the child.
+  np->tf->a0 = 0;
+
+  // increment reference counts on open file descriptors.
+  for(i = 0; i < NOFILE; i++)
+    if(p->ofile[i])
+      np->ofile[i] = filedup(p->ofile[i]);
+  np->cwd = idup(p->cwd);
+  copyexec(np, p);
 
   safestrcpy(np->name, p->name, sizeof(p->name));
 
@@ -296,9 +642,194 @@ fork(void)
 
   release(&np->lock);
 
+  // wait for the child to give our memory back.
+  // it clears np->vfork before waking us (see
+  // vforkdone()), and we hold p->lock from the
+  // check to the sleep, so the wakeup can't be lost.
+  acquire(&p->lock);
+  while(np->vfork && np->parent == p && !p->killed)
+    sleep(&np->vfork, &p->lock);
+  release(&p->lock);
+
   return pid;
 }
 
+// p, a vfork() child, no longer uses its parent's
+// memory; let the parent continue.
+void
+vforkdone(struct proc *p)
+{
+  p->vfork = 0;
+  wakeup(&p->vfork);
+}
+
+// Start a child running the program at path with arguments
+// argv, without copying the caller's memory first. The child
+// inherits the caller's open files, then applies the nact file
+// actions in acts. Returns the child's pid, or -1.
+int
+spawn(char *path, char **argv, struct spawn_action *acts, int nact)
+{
+  int i, fd, pid, argc;
+  struct file *f;
+  struct proc *np;
+  struct proc *p = myproc();
+
+  // Allocate process.
+  if((np = allocproc()) == 0){
+    return -1;
+  }
+  // loading the program sleeps, so np->lock can't be held
+  // across it; USED keeps allocproc() from reusing np.
+  np->state = USED;
+  release(&np->lock);
+
+  memset(np->tf, 0, sizeof(*np->tf));
+  if((argc = loadexec(np, path, argv)) < 0)
+    goto bad;
+  np->tf->a0 = argc;
+
+  for(i = 0; i < NOFILE; i++)
+    if(p->ofile[i])
+      np->ofile[i] = filedup(p->ofile[i]);
+  np->cwd = idup(p->cwd);
+
+  for(i = 0; i < nact; i++){
+    fd = acts[i].fd;
+    if(fd < 0 || fd >= NOFILE || np->ofile[fd] == 0)
+      goto badfiles;
+    switch(acts[i].op){
+    case SPAWN_CLOSE:
+      f = np->ofile[fd];
+      np->ofile[fd] = 0;
+      fileclose(f);
+      break;
+    case SPAWN_DUP2:
+      if(acts[i].newfd < 0 || acts[i].newfd >= NOFILE)
+        goto badfiles;
+      if(acts[i].newfd == fd)
+        break;
+      if((f = np->ofile[acts[i].newfd]) != 0)
+        fileclose(f);
+      np->ofile[acts[i].newfd] = filedup(np->ofile[fd]);
+      break;
+    default:
+      goto badfiles;
+    }
+  }
+
+  acquire(&np->lock);
+  np->parent = p;
+  pid = np->pid;
+  np->state = RUNNABLE;
+  release(&np->lock);
+
+  return pid;
+
+ badfiles:
+  for(i = 0; i < NOFILE; i++){
+    if(np->ofile[i]){
+      fileclose(np->ofile[i]);
+      np->ofile[i] = 0;
+    }
+  }
+  begin_op(ROOTDEV);
+  iput(np->cwd);
+  iput(np->execip);
+  end_op(ROOTDEV);
+  np->cwd = 0;
+  np->execip = 0;
+ bad:
+  acquire(&np->lock);
+  freeproc(np);
+  release(&np->lock);
+  return -1;
+}
+
+// Create a new thread that runs fn(arg) on the user stack
+// page at stack, sharing the caller's page table, open files
+// and current directory. Each thread has its own trapframe
+// and kernel stack. The thread ends by calling exit(), and
+// its creator reaps it with join().
+int
+clone(uint64 fn, uint64 arg, uint64 stack)
+{
+  int i, pid;
+  struct proc *np;
+  struct proc *p = myproc();
+
+  // Allocate process.
+  if((np = allocproc()) == 0){
+    return -1;
+  }
+
+  if(sharepagetable(np, p) < 0){
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+
+  np->parent = p;
+  np->thread = 1;
+  np->ustack = stack;
+
+  // start at fn(arg), on top of the stack page.
+  *(np->tf) = *(p->tf);
+  np->tf->epc = fn;
+  np->tf->a0 = arg;
+  np->tf->ra = 0;
+  np->tf->sp = (stack + PGSIZE) & ~0xfL;
+
+  // share the open files.
+  for(i = 0; i < NOFILE; i++)
+    if(p->ofile[i])
+      np->ofile[i] = filedup(p->ofile[i]);
+  np->cwd = idup(p->cwd);
+  copyexec(np, p);
+
+  safestrcpy(np->name, p->name, sizeof(p->name));
+
+  pid = np->pid;
+
+  np->state = RUNNABLE;
+
+  release(&np->lock);
+
+  return pid;
+}
+
+// Start a kernel thread that shares p's memory, so that it
+// can copy to and from p's user space, and runs fn() with
+// myproc()->karg set to arg. fn() must first release
+// myproc()->lock, as forkret() does, and never returns to
+// user space; it ends with exit(). No one joins the thread;
+// p may stop it and free it with kthreadreap(), or it is
+// killed along with p's clone() threads, after which init
+// reaps it. Returns the thread, or 0.
+struct proc*
+kthread(struct proc *p, void (*fn)(void), void *arg)
+{
+  struct proc *np;
+
+  if((np = allocproc()) == 0)
+    return 0;
+  if(sharepagetable(np, p) < 0){
+    freeproc(np);
+    release(&np->lock);
+    return 0;
+  }
+  np->parent = p;
+  np->thread = KTHREAD;
+  np->karg = arg;
+  np->cwd = idup(p->cwd);
+  copyexec(np, p);
+  safestrcpy(np->name, p->name, sizeof(p->name));
+  np->context.ra = (uint64)fn;
+  np->state = RUNNABLE;
+  release(&np->lock);
+  return np;
+}
+
 // Pass p's abandoned children to init.
 // Caller must hold p->lock.
 void
@@ -316,6 +847,8 @@ reparent(struct proc *p)
       // because only the parent changes it, and we're the parent.
       acquire(&pp->lock);
       pp->parent = initproc;
+      // init reaps orphaned threads with wait().
+      pp->thread = 0;
       // we should wake up init here, but that would require
       // initproc->lock, which would be a deadlock, since we hold
       // the lock on one of init's children (pp). this is why
@@ -325,6 +858,25 @@ reparent(struct proc *p)
   }
 }
 
+// Kill the clone() threads that share p's address space.
+static void
+killthreads(struct proc *p)
+{
+  struct proc *pp;
+
+  for(pp = proc; pp < &proc[NPROC]; pp++){
+    if(pp == p)
+      continue;
+    acquire(&pp->lock);
+    if(pp->thread && pp->state != UNUSED && pp->pagetable == p->pagetable){
+      pp->killed = 1;
+      if(pp->state == SLEEPING)
+        pp->state = RUNNABLE;
+    }
+    release(&pp->lock);
+  }
+}
+
 // Exit the current process.  Does not return.
 // An exited process remains in the zombie state
 // until its parent calls wait().
@@ -336,6 +888,13 @@ exit(int status)
   if(p == initproc)
     panic("init exiting");
 
+  // A process takes its clone() threads down with it.
+  // A vfork() child just hands the memory back.
+  if(p->vfork)
+    vforkdone(p);
+  else if(!p->thread)
+    killthreads(p);
+
   // Close all open files.
   for(int fd = 0; fd < NOFILE; fd++){
     if(p->ofile[fd]){
@@ -347,8 +906,11 @@ exit(int status)
 
   begin_op(ROOTDEV);
   iput(p->cwd);
+  if(p->execip)
+    iput(p->execip);
   end_op(ROOTDEV);
   p->cwd = 0;
+  p->execip = 0;
 
   // we might re-parent a child to init. we can't be precise about
   // waking up init, since we can't acquire its lock once we've
@@ -390,10 +952,34 @@ exit(int status)
   panic("zombie exit");
 }
 
-// Wait for a child process to exit and return its pid.
-// Return -1 if this process has no children.
-int
-wait(uint64 addr)
+// Charge the time since p last started running, entered
+// the kernel or left it to *t, and restart the clock.
+void
+rucharge(struct proc *p, uint64 *t)
+{
+  uint64 now = *(volatile uint64 *)CLINT_MTIME;
+
+  *t += now - p->rustamp;
+  p->rustamp = now;
+}
+
+static void
+ruadd(struct rusage *to, struct rusage *from)
+{
+  uint64 *t = (uint64 *)to, *f = (uint64 *)from;
+  int i;
+
+  for(i = 0; i < sizeof(*to) / sizeof(uint64); i++)
+    t[i] += f[i];
+}
+
+// Wait for a child to exit and return its pid.
+// Reaps clone() threads if thread is set, and
+// other children otherwise. Copies the child's exit
+// status (or, for a thread, its user stack) to addr.
+// Return -1 if this process has no such children.
+static int
+reap(uint64 addr, int thread)
 {
   struct proc *np;
   int havekids, pid;
@@ -414,16 +1000,30 @@ wait(uint64 addr)
         // np->parent can't change between the check and the acquire()
         // because only the parent changes it, and we're the parent.
         acquire(&np->lock);
+        if(np->thread != thread){
+          release(&np->lock);
+          continue;
+        }
         havekids = 1;
         if(np->state == ZOMBIE){
           // Found one.
           pid = np->pid;
-          if(addr != 0 && copyout(p->pagetable, addr, (char *)&np->xstate,
-                                  sizeof(np->xstate)) < 0) {
+          if(addr != 0 &&
+             (thread ? copyout(p->pagetable, addr, (char *)&np->ustack,
+                               sizeof(np->ustack))
+                     : copyout(p->pagetable, addr, (char *)&np->xstate,
+                               sizeof(np->xstate))) < 0) {
             release(&np->lock);
             release(&p->lock);
             return -1;
           }
+          // a thread's usage is the process's own.
+          if(thread){
+            ruadd(&p->ru, &np->ru);
+          } else {
+            ruadd(&p->cru, &np->ru);
+            ruadd(&p->cru, &np->cru);
+          }
           freeproc(np);
           release(&np->lock);
           release(&p->lock);
@@ -444,6 +1044,48 @@ wait(uint64 addr)
   }
 }
 
+// Wait for a child process to exit and return its pid.
+// Return -1 if this process has no children.
+int
+wait(uint64 addr)
+{
+  return reap(addr, 0);
+}
+
+// Wait for a clone() thread to exit and return its pid,
+// storing the thread's user stack at addr.
+// Return -1 if this process has no threads.
+int
+join(uint64 addr)
+{
+  return reap(addr, 1);
+}
+
+// Wait for t, a kernel thread of the calling process that
+// has been told to stop, to exit, and free it. No one else
+// joins it, so it would otherwise stay a zombie, with its
+// share of the memory, until the process exits.
+void
+kthreadreap(struct proc *t)
+{
+  struct proc *p = myproc();
+
+  acquire(&p->lock);
+  for(;;){
+    acquire(&t->lock);
+    if(t->state == ZOMBIE){
+      ruadd(&p->ru, &t->ru);
+      freeproc(t);
+      release(&t->lock);
+      break;
+    }
+    release(&t->lock);
+    // exit() wakes its parent.
+    sleep(p, &p->lock);
+  }
+  release(&p->lock);
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
@@ -467,6 +1109,9 @@ scheduler(void)
     // cause a lost wakeup.
     intr_off();
 
+    // no RCU reader survives a trip through the scheduler.
+    rcu_quiescent();
+
     int found = 0;
     for(p = proc; p < &proc[NPROC]; p++) {
       acquire(&p->lock);
@@ -476,6 +1121,8 @@ scheduler(void)
         // before jumping back to us.
         p->state = RUNNING;
         c->proc = p;
+        p->rustamp = *(volatile uint64 *)CLINT_MTIME;
+        statadd(STAT_CSWITCH, 1);
         swtch(&c->scheduler, &p->context);
 
         // Process is done running for now.
@@ -519,7 +1166,15 @@ sched(void)
   if(intr_get())
     panic("sched interruptible");
 
+  // scheduler() restarts the clock when p next runs.
+  rucharge(p, &p->ru.ru_stime);
+  if(p->state == SLEEPING)
+    p->ru.ru_nvcsw++;
+  else if(p->state == RUNNABLE)
+    p->ru.ru_nivcsw++;
+
   intena = mycpu()->intena;
+  TRACE(TR_SCHED, p->state);
   swtch(&p->context, &mycpu()->scheduler);
   mycpu()->intena = intena;
 }
@@ -606,6 +1261,25 @@ wakeup(void *chan)
   }
 }
 
+// Wake up at most n processes sleeping on chan.
+// Return the number woken.
+int
+wakeupn(void *chan, int n)
+{
+  struct proc *p;
+  int woken = 0;
+
+  for(p = proc; p < &proc[NPROC] && woken < n; p++) {
+    acquire(&p->lock);
+    if(p->state == SLEEPING && p->chan == chan) {
+      p->state = RUNNABLE;
+      woken++;
+    }
+    release(&p->lock);
+  }
+  return woken;
+}
+
 // Wake up p if it is sleeping in wait(); used by exit().
 // Caller must hold p->lock.
 static void
@@ -621,14 +1295,25 @@ wakeup1(struct proc *p)
 // Kill the process with the given pid.
 // The victim won't exit until it tries to return
 // to user space (see usertrap() in trap.c).
+// Kernel threads can't be killed: they end when the
+// kernel says so, and may own state others point to.
+// Looks for pid without locking each entry, since proc
+// structures are never freed, and then checks again with
+// the lock held.
 int
 kill(int pid)
 {
   struct proc *p;
 
   for(p = proc; p < &proc[NPROC]; p++){
+    if(__atomic_load_n(&p->pid, __ATOMIC_RELAXED) != pid)
+      continue;
     acquire(&p->lock);
     if(p->pid == pid){
+      if(p->thread == KTHREAD){
+        release(&p->lock);
+        return -1;
+      }
       p->killed = 1;
       if(p->state == SLEEPING){
         // Wake process from sleep().
@@ -672,31 +1357,95 @@ either_copyin(void *dst, int user_src, uint64 src, uint64 len)
   }
 }
 
+static char *states[] = {
+[UNUSED]    "unused",
+[USED]      "used  ",
+[SLEEPING]  "sleep ",
+[RUNNABLE]  "runble",
+[RUNNING]   "run   ",
+[ZOMBIE]    "zombie"
+};
+
+static char *
+procstate(struct proc *p)
+{
+  if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
+    return states[p->state];
+  return "???";
+}
+
+// Copy the calling process's resource usage, or the total
+// for its waited-for children, to addr.
+int
+getrusage(int who, uint64 addr)
+{
+  struct proc *p = myproc();
+  struct rusage *ru;
+
+  if(who == RUSAGE_SELF){
+    rucharge(p, &p->ru.ru_stime);
+    ru = &p->ru;
+  } else if(who == RUSAGE_CHILDREN){
+    ru = &p->cru;
+  } else {
+    return -1;
+  }
+  return copyout(p->pagetable, addr, (char *)ru, sizeof(*ru));
+}
+
+// Copy a struct procinfo for each process, up to n of them,
+// to addr. Returns the number of processes, which may be
+// more than n.
+int
+getprocs(uint64 addr, int n)
+{
+  struct procinfo pi;
+  struct proc *p;
+  int tot;
+
+  tot = 0;
+  for(p = proc; p < &proc[NPROC]; p++){
+    if(p->state == UNUSED)
+      continue;
+    if(tot < n){
+      memset(&pi, 0, sizeof(pi));
+      // copyout() may sleep, so fill pi under the lock
+      // and copy it afterwards.
+      acquire(&p->lock);
+      pi.pid = p->pid;
+      // like procdump(), read the parent's pid without its lock.
+      pi.ppid = p->parent ? p->parent->pid : 0;
+      safestrcpy(pi.state, procstate(p), sizeof(pi.state));
+      safestrcpy(pi.name, p->name, sizeof(pi.name));
+      pi.sz = p->sz;
+      pi.ru = p->ru;
+      release(&p->lock);
+      if(copyout(myproc()->pagetable, addr + tot*sizeof(pi),
+                 (char *)&pi, sizeof(pi)) < 0)
+        return -1;
+    }
+    tot++;
+  }
+  return tot;
+}
+
 // Print a process listing to console.  For debugging.
 // Runs when user types ^P on console.
 // No lock to avoid wedging a stuck machine further.
 void
 procdump(void)
 {
-  static char *states[] = {
-  [UNUSED]    "unused",
-  [SLEEPING]  "sleep ",
-  [RUNNABLE]  "runble",
-  [RUNNING]   "run   ",
-  [ZOMBIE]    "zombie"
-  };
   struct proc *p;
-  char *state;
+  uint64 ms;
 
   printf("\n");
   for(p = proc; p < &proc[NPROC]; p++){
     if(p->state == UNUSED)
       continue;
-    if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
-      state = states[p->state];
-    else
-      state = "???";
-    printf("%d %s %s", p->pid, state, p->name);
-    printf("\n");
+    ms = (p->ru.ru_utime + p->ru.ru_stime) / (RU_PER_TICK / 100);
+    // one printf() per line, so each is one log message.
+    printf("%d %s %s cpu %lms flt %l/%l io %l/%l\n", p->pid, procstate(p),
+           p->name, ms, p->ru.ru_minflt, p->ru.ru_majflt,
+           p->ru.ru_inblock, p->ru.ru_oublock);
   }
 }
@@ -18,19 +18,25 @@ struct context {
   uint64 s11;
 };
 
+#define NMCSNODE 8  // MCS locks a CPU can hold or wait for at once
+
 // Per-CPU state.
 struct cpu {
   struct proc *proc;          // The process running on this cpu, or null.
   struct context scheduler;   // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  struct mcsnode mcs[NMCSNODE];  // Queue nodes for MCS locks held or awaited.
+  int rcuonline;              // Has rcu_online() been called?
+  uint64 rcuepoch;            // RCU epoch at the last quiescent state.
+  uint64 asidgen;             // ASID generation this CPU's TLB is good for.
 };
 
 extern struct cpu cpus[NCPU];
 
 // per-process data for the trap handling code in trampoline.S.
 // sits in a page by itself just under the trampoline page in the
-// user page table. not specially mapped in the kernel page table.
+// user page table (or at THREADFRAME for threads made by clone()). not specially mapped in the kernel page table.
 // the sscratch register points here.
 // uservec in trampoline.S saves user registers in the trapframe,
 // then initializes registers from the trapframe's
@@ -40,7 +46,9 @@ extern struct cpu cpus[NCPU];
 // trapframe, switch to the user page table, and enter user space.
 // the trapframe includes callee-saved user registers like s0-s11 because the
 // return-to-user path via usertrapret() doesn't return through
-// the entire kernel call stack.
+// the entire kernel call stack. most system calls take a shorter
+// path, through usersyscall(), which saves only some registers
+// here; see syscallvec in trampoline.S.
 struct trapframe {
   /*   0 */ uint64 kernel_satp;   // kernel page table
   /*   8 */ uint64 kernel_sp;     // top of process's kernel stack
@@ -78,9 +86,22 @@ struct trapframe {
   /* 264 */ uint64 t4;
   /* 272 */ uint64 t5;
   /* 280 */ uint64 t6;
+  /* 288 */ uint64 kernel_syscall; // usersyscall()
+};
+
+// A loadable segment of a process's program file, paged in
+// on demand by execfault() rather than read in by exec().
+struct execseg {
+  uint64 va;                   // start of segment in user memory
+  uint64 memsz;                // bytes of memory
+  uint64 off;                  // file offset of va
+  uint64 filesz;               // bytes backed by the file; the rest are zero
+  int writable;
 };
 
-enum procstate { UNUSED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
+#define KTHREAD 2  // p->thread for kernel threads, which no one joins
+
+enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
 struct proc {
@@ -93,18 +114,34 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  int thread;                  // Made by clone(); reaped by join(), not wait(),
+                               // or KTHREAD if made by kthread()
+  int vfork;                   // vfork() child still borrowing its parent's memory
 
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
   uint64 sz;                   // Size of process memory (bytes)
   pagetable_t pagetable;       // Page table
+  uint asid;                   // Tags pagetable's TLB entries (see usersatp())
+  uint64 asidgen;              // Generation asid is from; 0 if none
+  uint tlbstale;               // CPUs that must flush asid before running p
   struct trapframe *tf;        // data page for trampoline.S
+  uint64 tfva;                 // User virtual address of tf
+  uint64 ustack;               // clone() threads: user stack, returned by join()
   struct trapframe *tf_sigalarm_save; // Save the trapframe to restore after sigreturn
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
+  struct inode *execip;        // Program file, for demand paging
+  struct execseg execseg[NEXECSEG]; // Segments paged in from execip
+  int nexecseg;
   char name[16];               // Process name (debugging)
   uint64 tick_interval;        // ticks after which sigalarm_handler execute
   uint64 tick_count;           // how many ticks have passed since sigalarm begins
   uint64 sigalarm_handler;
+  struct rusage ru;            // Resource usage (see rusage.h)
+  struct rusage cru;           // Summed over waited-for children
+  struct aio *aio;             // Runs asynchronous ring entries (see sysring.c)
+  void *karg;                  // kthread(): argument for the thread's function
+  uint64 rustamp;              // When ru_utime or ru_stime was last charged
 };
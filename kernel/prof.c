@@ -0,0 +1,170 @@
+//
+// Sampling profiler. While profiling is set, each timer
+// interrupt records where its CPU was: the interrupted pc,
+// and the return addresses found by following the frame
+// pointer chain, in user or kernel space. The kernel and user
+// programs are compiled with -fno-omit-frame-pointer, so on
+// RISC-V each frame keeps its return address at fp-8 and the
+// caller's frame pointer at fp-16.
+//
+// Samples go into a ring per CPU with a single producer (the
+// CPU's timer interrupt) and a single consumer (profile()
+// under proflock), so neither side needs a spinlock. A full
+// ring drops new samples.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "rusage.h"
+#include "proc.h"
+#include "defs.h"
+#include "prof.h"
+
+#define NPROF 1024   // samples per CPU ring; a power of two
+
+int profiling;
+
+static struct profring {
+  uint64 head;       // samples recorded; written by the owning CPU
+  uint64 tail;       // samples consumed; written by profile()
+  uint64 dropped;    // samples lost to a full ring
+  struct profsample s[NPROF];
+} rings[NCPU];
+
+static struct sleeplock proflock;
+
+void
+profinit(void)
+{
+  initsleeplock(&proflock, "prof");
+}
+
+// Follow the user frame pointer chain from fp, reading
+// only pages that are already mapped, since this runs in
+// the timer interrupt.
+static int
+userstack(struct proc *p, uint64 fp, uint64 *pcs, int n)
+{
+  uint64 pa, lo;
+  int i;
+
+  lo = PGROUNDDOWN(fp - 16);
+  for(i = 0; i < n; i++){
+    if(fp < 16 || fp % 8 != 0 || PGROUNDDOWN(fp - 16) != lo || fp > p->sz)
+      break;
+    if((pa = walkaddr(p->pagetable, fp - 16)) == 0)
+      break;
+    pa += (fp - 16) - lo;
+    pcs[i] = ((uint64 *)pa)[1];
+    if(((uint64 *)pa)[0] <= fp)
+      break;
+    fp = ((uint64 *)pa)[0];
+  }
+  return i;
+}
+
+// Follow the kernel frame pointer chain from fp, which must
+// stay on the current kernel stack page.
+static int
+kernelstack(uint64 fp, uint64 *pcs, int n)
+{
+  uint64 lo;
+  int i;
+
+  lo = PGROUNDDOWN(r_fp());
+  for(i = 0; i < n; i++){
+    if(fp % 8 != 0 || fp - 16 < lo || fp > lo + PGSIZE)
+      break;
+    pcs[i] = *(uint64 *)(fp - 8);
+    if(*(uint64 *)(fp - 16) <= fp)
+      break;
+    fp = *(uint64 *)(fp - 16);
+  }
+  return i;
+}
+
+// Record a sample for this CPU's timer interrupt, which
+// interrupted pc with frame pointer fp. Called with
+// interrupts off, by usertrap() and kerneltrap().
+void
+profsample(uint64 pc, uint64 fp, int user)
+{
+  struct profring *r = &rings[cpuid()];
+  struct proc *p = myproc();
+  struct profsample *s;
+
+  if(r->head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == NPROF){
+    r->dropped++;
+    return;
+  }
+  s = &r->s[r->head & (NPROF-1)];
+  s->pid = p ? p->pid : 0;
+  s->cpu = cpuid();
+  s->user = user;
+  s->pc[0] = pc;
+  if(user)
+    s->depth = 1 + userstack(p, fp, s->pc + 1, NPROFDEPTH - 1);
+  else
+    s->depth = 1 + kernelstack(fp, s->pc + 1, NPROFDEPTH - 1);
+  __atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+}
+
+// profile(int cmd, struct profsample *buf, int n): with
+// PROF_START, throw away old samples and start sampling;
+// with PROF_STOP, stop, and return how many samples were
+// dropped because nobody read them in time; with PROF_READ,
+// move up to n samples to buf and return how many.
+uint64
+sys_profile(void)
+{
+  struct profring *r;
+  uint64 buf, dropped;
+  int cmd, n, got, c;
+
+  if(argint(0, &cmd) < 0 || argaddr(1, &buf) < 0 || argint(2, &n) < 0)
+    return -1;
+
+  acquiresleep(&proflock);
+  got = 0;
+  switch(cmd){
+  case PROF_START:
+    for(c = 0; c < NCPU; c++){
+      r = &rings[c];
+      __atomic_store_n(&r->tail, __atomic_load_n(&r->head, __ATOMIC_ACQUIRE),
+                       __ATOMIC_RELEASE);
+      r->dropped = 0;
+    }
+    __atomic_store_n(&profiling, 1, __ATOMIC_RELEASE);
+    break;
+  case PROF_STOP:
+    __atomic_store_n(&profiling, 0, __ATOMIC_RELEASE);
+    dropped = 0;
+    for(c = 0; c < NCPU; c++)
+      dropped += rings[c].dropped;
+    got = dropped;
+    break;
+  case PROF_READ:
+    for(c = 0; c < NCPU && got < n; c++){
+      r = &rings[c];
+      while(got < n && r->tail != __atomic_load_n(&r->head, __ATOMIC_ACQUIRE)){
+        if(copyout(myproc()->pagetable, buf + got*sizeof(struct profsample),
+                   (char *)&r->s[r->tail & (NPROF-1)], sizeof(struct profsample)) < 0){
+          got = -1;
+          goto out;
+        }
+        __atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_RELEASE);
+        got++;
+      }
+    }
+    break;
+  default:
+    got = -1;
+  }
+out:
+  releasesleep(&proflock);
+  return got;
+}
@@ -0,0 +1,15 @@
+// Sampling profiler, see profile() in prof.c.
+
+#define PROF_STOP   0   // stop sampling; returns samples dropped
+#define PROF_START  1   // discard old samples and start sampling
+#define PROF_READ   2   // move samples to the caller
+
+#define NPROFDEPTH  8   // pcs kept per sample
+
+struct profsample {
+  int pid;        // process running, or 0
+  ushort cpu;
+  ushort user;    // interrupted in user space?
+  int depth;      // valid entries in pc[]
+  uint64 pc[NPROFDEPTH];  // interrupted pc, then return addresses
+};
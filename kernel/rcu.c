@@ -0,0 +1,164 @@
+//
+// Read-copy-update: lets readers walk a shared structure
+// without taking any lock, as long as writers, which still
+// lock against each other, don't free anything a reader
+// might be looking at until every CPU is done reading.
+//
+// A read-side critical section is bracketed by
+// rcu_read_lock() and rcu_read_unlock(), which just turn
+// interrupts off. A reader can't sleep or be switched away
+// from, so a CPU that passes through the scheduler or takes
+// a timer interrupt has finished any read it was doing: it is
+// in a quiescent state, and records the current epoch in
+// c->rcuepoch. To free a page that readers may still see, a
+// writer unlinks it and calls kfree_rcu(), which starts a new
+// epoch; the page is really freed once every CPU has recorded
+// that epoch or a later one.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "rusage.h"
+#include "proc.h"
+#include "defs.h"
+
+// pages that can wait for a grace period at once.
+#define NRCUFREE 64
+
+struct {
+  struct spinlock lock;
+  uint64 epoch;               // current epoch; only grows
+  int n;                      // pages in pending[]
+  void *pending[NRCUFREE];    // pages to free...
+  uint64 when[NRCUFREE];      // ...once all CPUs reach this epoch
+} rcu;
+
+void
+rcuinit(void)
+{
+  initlock(&rcu.lock, "rcu");
+  rcu.epoch = 1;
+}
+
+// Called by each CPU before it starts scheduling. Grace
+// periods wait only for CPUs that are online.
+void
+rcu_online(void)
+{
+  struct cpu *c = mycpu();
+
+  c->rcuepoch = __atomic_load_n(&rcu.epoch, __ATOMIC_ACQUIRE);
+  __atomic_store_n(&c->rcuonline, 1, __ATOMIC_RELEASE);
+}
+
+void
+rcu_read_lock(void)
+{
+  push_off();
+}
+
+void
+rcu_read_unlock(void)
+{
+  pop_off();
+}
+
+// The oldest epoch that every online CPU has reached.
+static uint64
+rcu_minepoch(void)
+{
+  struct cpu *c;
+  uint64 e, min;
+
+  min = __atomic_load_n(&rcu.epoch, __ATOMIC_ACQUIRE);
+  for(c = cpus; c < &cpus[NCPU]; c++){
+    if(!__atomic_load_n(&c->rcuonline, __ATOMIC_ACQUIRE))
+      continue;
+    e = __atomic_load_n(&c->rcuepoch, __ATOMIC_ACQUIRE);
+    if(e < min)
+      min = e;
+  }
+  return min;
+}
+
+// Free the pending pages whose grace period is over.
+// Returns the number freed.
+static int
+rcu_poll(void)
+{
+  uint64 min;
+  int i, j, freed;
+
+  acquire(&rcu.lock);
+  min = rcu_minepoch();
+  freed = 0;
+  for(i = j = 0; i < rcu.n; i++){
+    if(rcu.when[i] <= min){
+      kfree(rcu.pending[i]);
+      freed++;
+    } else {
+      rcu.pending[j] = rcu.pending[i];
+      rcu.when[j] = rcu.when[i];
+      j++;
+    }
+  }
+  rcu.n = j;
+  release(&rcu.lock);
+  return freed;
+}
+
+// This CPU is not in a read-side critical section.
+// Called from the scheduler loop and on timer interrupts.
+void
+rcu_quiescent(void)
+{
+  struct cpu *c = mycpu();
+
+  __atomic_store_n(&c->rcuepoch, __atomic_load_n(&rcu.epoch, __ATOMIC_ACQUIRE),
+                   __ATOMIC_RELEASE);
+  if(__atomic_load_n(&rcu.n, __ATOMIC_RELAXED) > 0)
+    rcu_poll();
+}
+
+// Drop a reference to page pa (with kfree()) once no reader
+// can still be using it. Returns -1, doing nothing, if too
+// many pages are already waiting.
+int
+kfree_rcu(void *pa)
+{
+  acquire(&rcu.lock);
+  if(rcu.n == NRCUFREE){
+    release(&rcu.lock);
+    return -1;
+  }
+  rcu.pending[rcu.n] = pa;
+  rcu.when[rcu.n] = __atomic_add_fetch(&rcu.epoch, 1, __ATOMIC_ACQ_REL);
+  rcu.n++;
+  release(&rcu.lock);
+  return 0;
+}
+
+// Wait until every pending page can be freed, and free them.
+// The caller must not be a reader or hold any spinlock, since
+// other CPUs may be spinning on it with interrupts off.
+// Returns the number of pages freed.
+int
+synchronize_rcu(void)
+{
+  struct cpu *c;
+  uint64 e;
+
+  if(holdingany())
+    panic("synchronize_rcu");
+  e = __atomic_load_n(&rcu.epoch, __ATOMIC_ACQUIRE);
+  push_off();
+  c = mycpu();
+  __atomic_store_n(&c->rcuepoch, e, __ATOMIC_RELEASE);
+  pop_off();
+  while(rcu_minepoch() < e)
+    ;
+  return rcu_poll();
+}
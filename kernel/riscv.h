@@ -186,6 +186,12 @@ w_mtvec(uint64 x)
 
 #define MAKE_SATP(pagetable) (SATP_SV39 | (((uint64)pagetable) >> 12))
 
+// the address-space identifier field of satp, which tags
+// TLB entries so that switching page tables needn't flush
+// them. the hardware may implement fewer than 16 bits.
+#define SATP_ASID(asid) (((uint64)(asid)) << 44)
+#define SATP_ASIDMAX 0xffff
+
 // supervisor address translation and protection;
 // holds the address of the page table.
 static inline void 
@@ -311,6 +317,15 @@ r_ra()
   return x;
 }
 
+// frame pointer of the current function.
+static inline uint64
+r_fp()
+{
+  uint64 x;
+  asm volatile("mv %0, s0" : "=r" (x) );
+  return x;
+}
+
 // flush the TLB.
 static inline void
 sfence_vma()
@@ -319,6 +334,20 @@ sfence_vma()
   asm volatile("sfence.vma zero, zero");
 }
 
+// flush the TLB entries for one address space.
+static inline void
+sfence_vma_asid(uint64 asid)
+{
+  asm volatile("sfence.vma zero, %0" : : "r" (asid));
+}
+
+// flush the TLB entries for one page of one address space.
+static inline void
+sfence_vma_page(uint64 va, uint64 asid)
+{
+  asm volatile("sfence.vma %0, %1" : : "r" (va), "r" (asid));
+}
+
 
 #define PGSIZE 4096 // bytes per page
 #define PGSHIFT 12  // bits of offset within a page
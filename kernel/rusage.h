@@ -0,0 +1,30 @@
+// Per-process resource usage, as returned by getrusage()
+// and getprocs(). Times are in ticks of the CLINT timer
+// (10 MHz on qemu).
+
+#define RUSAGE_SELF      0
+#define RUSAGE_CHILDREN  1  // waited-for children and their children
+
+#define RU_PER_TICK 1000000  // CLINT ticks per uptime() tick; see timerinit()
+
+struct rusage {
+  uint64 ru_utime;     // time in user mode
+  uint64 ru_stime;     // time in the kernel
+  uint64 ru_nvcsw;     // switches away because the process slept
+  uint64 ru_nivcsw;    // switches away because the timer preempted it
+  uint64 ru_minflt;    // page faults served without I/O
+  uint64 ru_majflt;    // page faults that read from disk
+  uint64 ru_cowcopy;   // pages copied by copy-on-write faults
+  uint64 ru_inblock;   // disk blocks read
+  uint64 ru_oublock;   // disk blocks written
+};
+
+// One process, as returned by getprocs().
+struct procinfo {
+  int pid;
+  int ppid;
+  char state[8];
+  char name[16];
+  uint64 sz;           // bytes of user memory
+  struct rusage ru;    // of the process itself, including joined threads
+};
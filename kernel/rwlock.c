@@ -0,0 +1,99 @@
+// Reader-writer spin locks, for tables that are looked up
+// far more often than they change.
+//
+// Like spinlocks, these disable interrupts while held.
+// Writers take precedence: once one is waiting, new readers
+// wait too, so a steady stream of readers can't starve it.
+// That also means a CPU must not take a read lock it
+// already holds.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "rwlock.h"
+#include "riscv.h"
+#include "rusage.h"
+#include "proc.h"
+#include "defs.h"
+
+void
+initrwlock(struct rwlock *lk, char *name)
+{
+  lk->name = name;
+  lk->readers = 0;
+  lk->writers = 0;
+  lk->cpu = 0;
+}
+
+// Acquire the lock for reading: wait until no writer
+// holds it or is waiting for it.
+void
+acquireread(struct rwlock *lk)
+{
+  int r;
+
+  push_off(); // disable interrupts to avoid deadlock.
+  if(holdingwrite(lk))
+    panic("acquireread");
+
+  for(;;){
+    while(__atomic_load_n(&lk->writers, __ATOMIC_RELAXED) != 0)
+      ;
+    r = __atomic_load_n(&lk->readers, __ATOMIC_RELAXED);
+    if(r >= 0 && __sync_bool_compare_and_swap(&lk->readers, r, r+1))
+      break;
+  }
+
+  // keep the critical section's loads after the
+  // lock is acquired. On RISC-V, this emits a fence.
+  __sync_synchronize();
+}
+
+void
+releaseread(struct rwlock *lk)
+{
+  // keep the critical section's loads before the
+  // lock is released.
+  __sync_synchronize();
+  if(__sync_fetch_and_sub(&lk->readers, 1) <= 0)
+    panic("releaseread");
+  pop_off();
+}
+
+// Acquire the lock for writing: announce the intent, so that
+// new readers wait, then wait for current readers to leave.
+void
+acquirewrite(struct rwlock *lk)
+{
+  push_off(); // disable interrupts to avoid deadlock.
+  if(holdingwrite(lk))
+    panic("acquirewrite");
+
+  __sync_fetch_and_add(&lk->writers, 1);
+  while(!__sync_bool_compare_and_swap(&lk->readers, 0, -1))
+    ;
+  __sync_fetch_and_sub(&lk->writers, 1);
+
+  __sync_synchronize();
+  lk->cpu = mycpu();
+}
+
+void
+releasewrite(struct rwlock *lk)
+{
+  if(!holdingwrite(lk))
+    panic("releasewrite");
+  lk->cpu = 0;
+  __sync_synchronize();
+  __atomic_store_n(&lk->readers, 0, __ATOMIC_RELEASE);
+  pop_off();
+}
+
+// Check whether this cpu holds the lock for writing.
+// Must be called with interrupts off.
+int
+holdingwrite(struct rwlock *lk)
+{
+  return lk->readers == -1 && lk->cpu == mycpu();
+}
@@ -0,0 +1,10 @@
+// Reader-writer spin lock.
+// Any number of readers, or one writer, may hold it.
+struct rwlock {
+  int readers;       // Readers holding the lock, or -1 if a writer is.
+  uint writers;      // Writers waiting; new readers hold off meanwhile.
+
+  // For debugging:
+  char *name;        // Name of lock.
+  struct cpu *cpu;   // The cpu holding the lock for writing.
+};
@@ -6,37 +6,76 @@
 #include "param.h"
 #include "memlayout.h"
 #include "spinlock.h"
+#include "rusage.h"
 #include "proc.h"
 #include "sleeplock.h"
 
+// How many times acquiresleep() goes around its loop waiting
+// for a running holder before it gives up and sleeps.
+#define SLSPIN 10000
+
 void
 initsleeplock(struct sleeplock *lk, char *name)
 {
   initlock(&lk->lk, "sleep lock");
   lk->name = name;
   lk->locked = 0;
+  lk->nwaiters = 0;
+  lk->owner = 0;
   lk->pid = 0;
 }
 
+// Is the holder of lk running on some CPU? It is then likely
+// to release lk soon, and cheaper to wait for than to sleep.
+// Reads lk->owner and its state without locks, which is fine
+// for a guess: proc structures are never freed.
+static int
+ownerrunning(struct sleeplock *lk)
+{
+  struct proc *p = __atomic_load_n(&lk->owner, __ATOMIC_RELAXED);
+
+  return p != 0 && __atomic_load_n(&p->state, __ATOMIC_RELAXED) == RUNNING;
+}
+
+// Adaptive: while the holder is running, spin for a while
+// (without lk->lk), and sleep only if it isn't released soon.
 void
 acquiresleep(struct sleeplock *lk)
 {
+  int spins = 0;
+
   acquire(&lk->lk);
   while (lk->locked) {
+    if(spins < SLSPIN && ownerrunning(lk)){
+      release(&lk->lk);
+      while(spins < SLSPIN && __atomic_load_n(&lk->locked, __ATOMIC_RELAXED) &&
+            ownerrunning(lk))
+        spins++;
+      acquire(&lk->lk);
+      continue;
+    }
+    lk->nwaiters++;
     sleep(lk, &lk->lk);
+    lk->nwaiters--;
   }
   lk->locked = 1;
+  lk->owner = myproc();
   lk->pid = myproc()->pid;
   release(&lk->lk);
 }
 
+// Wake only one waiter: the rest would just go back to sleep.
+// Anyone who finds lk held again increments nwaiters before
+// sleeping, so a wakeup is never lost.
 void
 releasesleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
   lk->locked = 0;
+  lk->owner = 0;
   lk->pid = 0;
-  wakeup(lk);
+  if(lk->nwaiters > 0)
+    wakeupn(lk, 1);
   release(&lk->lk);
 }
 
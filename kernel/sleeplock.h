@@ -2,9 +2,10 @@
 struct sleeplock {
   uint locked;       // Is the lock held?
   struct spinlock lk; // spinlock protecting this sleep lock
+  int nwaiters;      // Processes asleep in acquiresleep()
+  struct proc *owner; // Process holding lock, for spinning
   
   // For debugging:
   char *name;        // Name of lock.
   int pid;           // Process holding lock
 };
-
@@ -0,0 +1,10 @@
+// file actions for spawn(), applied in order in the child
+// before it starts. a list ends at an entry whose op is 0.
+#define SPAWN_CLOSE  1   // close(fd)
+#define SPAWN_DUP2   2   // make newfd refer to fd's file, like dup2()
+
+struct spawn_action {
+  int op;
+  int fd;
+  int newfd;
+};
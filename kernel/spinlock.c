@@ -4,7 +4,10 @@
 #include "param.h"
 #include "memlayout.h"
 #include "spinlock.h"
+#include "lockstat.h"
+#include "stats.h"
 #include "riscv.h"
+#include "rusage.h"
 #include "proc.h"
 #include "defs.h"
 
@@ -17,36 +20,110 @@ static struct spinlock *locks[NLOCK];
 void
 initlock(struct spinlock *lk, char *name)
 {
+  memset(lk, 0, sizeof(*lk));
   lk->name = name;
-  lk->locked = 0;
-  lk->cpu = 0;
-  lk->nts = 0;
-  lk->n = 0;
   if(nlock >= NLOCK)
     panic("initlock");
   locks[nlock] = lk;
   nlock++;
 }
 
+// Like initlock(), but for a heavily contended lock,
+// which gets an MCS queue instead of tickets.
+void
+initmcslock(struct spinlock *lk, char *name)
+{
+  initlock(lk, name);
+  lk->mcs = 1;
+}
+
+// The CLINT's real-time counter, for contention statistics.
+// Mapped at the same address with and without paging.
+static inline uint64
+locktime(void)
+{
+  return *(volatile uint64 *)CLINT_MTIME;
+}
+
+// Take one of this CPU's MCS queue nodes.
+// Interrupts must be off.
+static struct mcsnode *
+mcsalloc(void)
+{
+  struct cpu *c = mycpu();
+  int i;
+
+  for(i = 0; i < NMCSNODE; i++){
+    if(c->mcs[i].busy == 0){
+      c->mcs[i].busy = 1;
+      return &c->mcs[i];
+    }
+  }
+  panic("mcsalloc");
+}
+
+// Update lk's statistics once this CPU holds it.
+static void
+lockstat_acquired(struct spinlock *lk, uint64 pc, uint64 t0, uint spins)
+{
+  uint64 t;
+  int i;
+
+  t = locktime();
+  lk->n++;
+  lk->nts += spins;
+  lk->waittime += t - t0;
+  lk->tacquired = t;
+  if(spins > 0){
+    statadd(STAT_LOCK_WAIT, 1);
+    statadd(STAT_LOCK_SPIN, spins);
+  }
+  for(i = 0; i < NLOCKPC; i++){
+    if(lk->pcs[i] == 0)
+      lk->pcs[i] = pc;
+    if(lk->pcs[i] == pc){
+      lk->npcs[i]++;
+      break;
+    }
+  }
+}
+
 // Acquire the lock.
 // Loops (spins) until the lock is acquired.
 void
 acquire(struct spinlock *lk)
 {
+  uint64 pc = (uint64)__builtin_return_address(0);
+  struct mcsnode *me, *pred;
+  uint ticket, spins;
+  uint64 t0;
+
   push_off(); // disable interrupts to avoid deadlock.
   if(holding(lk))
     panic("acquire");
 
-  __sync_fetch_and_add(&(lk->n), 1);
-    
-  // On RISC-V, sync_lock_test_and_set turns into an atomic swap:
-  //   a5 = 1
-  //   s1 = &lk->locked
-  //   amoswap.w.aq a5, a5, (s1)
-  while(__sync_lock_test_and_set(&lk->locked, 1) != 0) {
-     __sync_fetch_and_add(&lk->nts, 1);
+  t0 = locktime();
+  spins = 0;
+  if(lk->mcs){
+    // join the end of the queue (amoswap.d), and if anyone
+    // was ahead, wait for them to hand the lock over.
+    me = mcsalloc();
+    me->next = 0;
+    me->wait = 1;
+    pred = __atomic_exchange_n(&lk->tail, me, __ATOMIC_ACQ_REL);
+    if(pred){
+      __atomic_store_n(&pred->next, me, __ATOMIC_RELEASE);
+      while(__atomic_load_n(&me->wait, __ATOMIC_ACQUIRE))
+        spins++;
+    }
+    lk->node = me;
+  } else {
+    // take a ticket (amoadd.w) and wait for it to come up.
+    ticket = __sync_fetch_and_add(&lk->next, 1);
+    while(__atomic_load_n(&lk->owner, __ATOMIC_ACQUIRE) != ticket)
+      spins++;
   }
-  
+
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
   // references happen strictly after the lock is acquired.
@@ -54,16 +131,22 @@ acquire(struct spinlock *lk)
   __sync_synchronize();
 
   // Record info about lock acquisition for holding() and debugging.
+  lk->locked = 1;
   lk->cpu = mycpu();
+  lockstat_acquired(lk, pc, t0, spins);
 }
 
 // Release the lock.
 void
 release(struct spinlock *lk)
 {
+  struct mcsnode *me, *next, *tail;
+
   if(!holding(lk))
     panic("release");
 
+  lk->holdtime += locktime() - lk->tacquired;
+  lk->locked = 0;
   lk->cpu = 0;
 
   // Tell the C compiler and the CPU to not move loads or stores
@@ -74,14 +157,30 @@ release(struct spinlock *lk)
   // On RISC-V, this emits a fence instruction.
   __sync_synchronize();
 
-  // Release the lock, equivalent to lk->locked = 0.
-  // This code doesn't use a C assignment, since the C standard
-  // implies that an assignment might be implemented with
-  // multiple store instructions.
-  // On RISC-V, sync_lock_release turns into an atomic swap:
-  //   s1 = &lk->locked
-  //   amoswap.w zero, zero, (s1)
-  __sync_lock_release(&lk->locked);
+  if(lk->mcs){
+    me = lk->node;
+    next = __atomic_load_n(&me->next, __ATOMIC_ACQUIRE);
+    if(next == 0){
+      // no one is waiting, unless someone has swapped
+      // themselves into tail but not yet linked in.
+      tail = me;
+      if(__atomic_compare_exchange_n(&lk->tail, &tail, 0, 0,
+                                     __ATOMIC_RELEASE, __ATOMIC_RELAXED)){
+        me->busy = 0;
+        pop_off();
+        return;
+      }
+      while((next = __atomic_load_n(&me->next, __ATOMIC_ACQUIRE)) == 0)
+        ;
+    }
+    // hand the lock straight to the next waiter.
+    __atomic_store_n(&next->wait, 0, __ATOMIC_RELEASE);
+    me->busy = 0;
+  } else {
+    // only the holder writes owner, so a plain
+    // increment and a store are enough.
+    __atomic_store_n(&lk->owner, lk->owner + 1, __ATOMIC_RELEASE);
+  }
 
   pop_off();
 }
@@ -96,6 +195,19 @@ holding(struct spinlock *lk)
   return r;
 }
 
+// Check whether this cpu is holding any spinlock,
+// in which case it must not sleep.
+int
+holdingany(void)
+{
+  int n;
+
+  push_off();
+  n = mycpu()->noff;
+  pop_off();
+  return n > 1;
+}
+
 // push_off/pop_off are like intr_off()/intr_on() except that they are matched:
 // it takes two pop_off()s to undo two push_off()s.  Also, if interrupts
 // are initially off, then push_off, pop_off leaves them off.
@@ -146,6 +258,10 @@ sys_ntas(void)
         break;
       locks[i]->nts = 0;
       locks[i]->n = 0;
+      locks[i]->waittime = 0;
+      locks[i]->holdtime = 0;
+      memset(locks[i]->pcs, 0, sizeof(locks[i]->pcs));
+      memset(locks[i]->npcs, 0, sizeof(locks[i]->npcs));
     }
     return 0;
   }
@@ -178,3 +294,42 @@ sys_ntas(void)
   }
   return tot;
 }
+
+// lockstat(struct lockstat *st, int n): copy the statistics of
+// up to n locks that have been acquired since the last ntas(0)
+// to st. Returns how many such locks there are, which may be
+// more than n.
+uint64
+sys_lockstat(void)
+{
+  struct lockstat ls;
+  struct spinlock *lk;
+  uint64 addr;
+  int n, i, j, tot;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &n) < 0)
+    return -1;
+  tot = 0;
+  for(i = 0; i < nlock; i++){
+    lk = locks[i];
+    if(lk->n == 0)
+      continue;
+    if(tot < n){
+      memset(&ls, 0, sizeof(ls));
+      safestrcpy(ls.name, lk->name, sizeof(ls.name));
+      ls.n = lk->n;
+      ls.nspin = lk->nts;
+      ls.waittime = lk->waittime;
+      ls.holdtime = lk->holdtime;
+      for(j = 0; j < NLOCKPC; j++){
+        ls.pcs[j] = lk->pcs[j];
+        ls.npcs[j] = lk->npcs[j];
+      }
+      if(copyout(myproc()->pagetable, addr + tot*sizeof(ls),
+                 (char *)&ls, sizeof(ls)) < 0)
+        return -1;
+    }
+    tot++;
+  }
+  return tot;
+}
@@ -1,11 +1,36 @@
 // Mutual exclusion lock.
+//
+// Most locks are ticket locks: each acquirer takes the next
+// ticket and spins until owner reaches it, so waiters get the
+// lock in the order they arrived. Locks set up with
+// initmcslock() are MCS queue locks instead: each waiter spins
+// on a node of its own CPU's, which the previous holder clears,
+// so waiters don't all pound the lock's cache line.
+struct mcsnode {
+  struct mcsnode *next;  // Next waiter in the queue.
+  uint wait;             // Cleared when this waiter gets the lock.
+  uint busy;             // Node is in use by this CPU.
+};
+
 struct spinlock {
   uint locked;       // Is the lock held?
+  uint next;         // Ticket locks: next ticket to hand out.
+  uint owner;        // Ticket locks: ticket now holding the lock.
+  int mcs;           // An MCS lock rather than a ticket lock?
+  struct mcsnode *tail;  // MCS locks: last waiter, or 0 if free.
+  struct mcsnode *node;  // MCS locks: the holder's node.
 
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
-  uint n;
-  uint nts;
-};
+  uint n;            // Number of acquire()s.
+  uint nts;          // Number of times around the spin loop.
 
+  // Contention statistics, in ticks of the CLINT timer,
+  // updated by the holder.
+  uint64 waittime;   // Total time spent waiting for the lock.
+  uint64 holdtime;   // Total time the lock was held.
+  uint64 tacquired;  // When the current holder got it.
+  uint64 pcs[NLOCKPC];    // Callers of acquire().
+  uint64 npcs[NLOCKPC];   // How often each of them got the lock.
+};
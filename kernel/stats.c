@@ -0,0 +1,126 @@
+//
+// Kernel performance counters. Each CPU counts into its
+// own struct kstats, so counting never contends for a
+// shared cache line; the stats device adds them up when
+// it is read.
+//
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "riscv.h"
+#include "defs.h"
+#include "stats.h"
+
+static struct kstats cpustats[NCPU];
+
+static char *statnames[NSTAT] = {
+[STAT_FAULT_ZERO]  "fault.zero",
+[STAT_FAULT_EXEC]  "fault.exec",
+[STAT_FAULT_COW]   "fault.cow",
+[STAT_COW_COPY]    "cow.copy",
+[STAT_BCACHE_HIT]  "bcache.hit",
+[STAT_BCACHE_MISS] "bcache.miss",
+[STAT_LOG_COMMIT]  "log.commit",
+[STAT_DISK_REQ]    "disk.req",
+[STAT_DISK_BYTES]  "disk.bytes",
+[STAT_CSWITCH]     "cswitch",
+[STAT_LOCK_WAIT]   "lock.wait",
+[STAT_LOCK_SPIN]   "lock.spin",
+};
+
+// Add n to counter i of this CPU's. The add is atomic in case
+// the process moves to another CPU halfway through, so this
+// works with interrupts on or off.
+void
+statadd(int i, uint64 n)
+{
+  __sync_fetch_and_add(&cpustats[r_tp()].stat[i], n);
+}
+
+void
+statsyscall(int num)
+{
+  if(num >= 0 && num < NSYSCALLSTAT)
+    __sync_fetch_and_add(&cpustats[r_tp()].syscall[num], 1);
+}
+
+// Sum the counters of all CPUs into ks.
+static void
+statsum(struct kstats *ks)
+{
+  int c, i;
+
+  memset(ks, 0, sizeof(*ks));
+  for(c = 0; c < NCPU; c++){
+    for(i = 0; i < NSTAT; i++)
+      ks->stat[i] += cpustats[c].stat[i];
+    for(i = 0; i < NSYSCALLSTAT; i++)
+      ks->syscall[i] += cpustats[c].syscall[i];
+  }
+}
+
+// Format ks as text into buf, one "name value" per line,
+// leaving out system calls that haven't been made.
+// Returns the length.
+static int
+statformat(struct kstats *ks, char *buf, int sz)
+{
+  int i, n;
+  char *name;
+
+  n = 0;
+  for(i = 0; i < NSTAT && n < sz; i++)
+    n += snprintf(buf + n, sz - n, "%s %l\n", statnames[i], ks->stat[i]);
+  for(i = 0; i < NSYSCALLSTAT && n < sz; i++){
+    if(ks->syscall[i] == 0 || (name = syscallname(i)) == 0)
+      continue;
+    n += snprintf(buf + n, sz - n, "syscall.%s %l\n", name, ks->syscall[i]);
+  }
+  return n < sz ? n : sz - 1;
+}
+
+// Read from the stats device: text from minor 0, a struct
+// kstats from minor 1. Like a file, reads continue at f->off,
+// but each read takes a fresh snapshot of the counters.
+static int
+statsread(struct file *f, int user_dst, uint64 dst, int n)
+{
+  struct kstats ks;
+  char *buf, *data;
+  int len;
+
+  statsum(&ks);
+  buf = 0;
+  if(f->minor == 1){
+    data = (char *)&ks;
+    len = sizeof(ks);
+  } else {
+    if((buf = kalloc()) == 0)
+      return -1;
+    data = buf;
+    len = statformat(&ks, buf, PGSIZE);
+  }
+
+  if(f->off >= len)
+    n = 0;
+  else if(n > len - f->off)
+    n = len - f->off;
+  if(either_copyout(user_dst, dst, data + f->off, n) < 0)
+    n = -1;
+  else
+    f->off += n;
+
+  if(buf)
+    kfree(buf);
+  return n;
+}
+
+void
+statsinit(void)
+{
+  devsw[STATS].read = statsread;
+}
@@ -0,0 +1,24 @@
+// Kernel statistics, summed over all CPUs.
+// Reading minor 1 of the stats device gives a struct kstats;
+// minor 0 gives the same numbers as text.
+
+#define NSYSCALLSTAT 64  // system call numbers counted
+
+#define STAT_FAULT_ZERO   0   // page faults on lazily allocated memory
+#define STAT_FAULT_EXEC   1   // page faults on program text and data
+#define STAT_FAULT_COW    2   // copy-on-write faults
+#define STAT_COW_COPY     3   // pages copied by copy-on-write faults
+#define STAT_BCACHE_HIT   4   // bget()s that found the block cached
+#define STAT_BCACHE_MISS  5   // bget()s that recycled a buffer
+#define STAT_LOG_COMMIT   6   // log transactions committed
+#define STAT_DISK_REQ     7   // disk requests
+#define STAT_DISK_BYTES   8   // bytes read and written by them
+#define STAT_CSWITCH      9   // switches from the scheduler to a process
+#define STAT_LOCK_WAIT    10  // acquire()s that had to wait
+#define STAT_LOCK_SPIN    11  // times around their spin loops
+#define NSTAT             12
+
+struct kstats {
+  uint64 stat[NSTAT];
+  uint64 syscall[NSYSCALLSTAT];  // calls of each system call
+};
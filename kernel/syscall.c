@@ -3,8 +3,11 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "rusage.h"
 #include "proc.h"
 #include "syscall.h"
+#include "trace.h"
+#include "klog.h"
 #include "defs.h"
 
 // Fetch the uint64 at addr from the current process.
@@ -109,6 +112,34 @@ extern uint64 sys_ntas(void);
 extern uint64 sys_sigalarm(void);
 extern uint64 sys_sigreturn(void);
 extern uint64 sys_symlink(void);
+extern uint64 sys_clone(void);
+extern uint64 sys_join(void);
+extern uint64 sys_futex(void);
+extern uint64 sys_spawn(void);
+extern uint64 sys_vfork(void);
+extern uint64 sys_lockstat(void);
+extern uint64 sys_trace(void);
+extern uint64 sys_traceread(void);
+extern uint64 sys_profile(void);
+extern uint64 sys_getrusage(void);
+extern uint64 sys_getprocs(void);
+extern uint64 sys_ringsetup(void);
+extern uint64 sys_ringenter(void);
+extern uint64 sys_poll(void);
+extern uint64 sys_epollcreate(void);
+extern uint64 sys_epollctl(void);
+extern uint64 sys_epollwait(void);
+extern uint64 sys_fcntl(void);
+extern uint64 sys_pread(void);
+extern uint64 sys_pwrite(void);
+extern uint64 sys_readv(void);
+extern uint64 sys_writev(void);
+extern uint64 sys_fsync(void);
+extern uint64 sys_fdatasync(void);
+extern uint64 sys_lseek(void);
+extern uint64 sys_ftruncate(void);
+extern uint64 sys_fallocate(void);
+extern uint64 sys_dmesg(void);
 
 static uint64 (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -137,8 +168,158 @@ static uint64 (*syscalls[])(void) = {
 [SYS_sigalarm]   sys_sigalarm,
 [SYS_sigreturn]  sys_sigreturn,
 [SYS_symlink] sys_symlink,
+[SYS_clone]   sys_clone,
+[SYS_join]    sys_join,
+[SYS_futex]   sys_futex,
+[SYS_spawn]   sys_spawn,
+[SYS_vfork]   sys_vfork,
+[SYS_lockstat] sys_lockstat,
+[SYS_trace]   sys_trace,
+[SYS_traceread] sys_traceread,
+[SYS_profile] sys_profile,
+[SYS_getrusage] sys_getrusage,
+[SYS_getprocs] sys_getprocs,
+[SYS_ringsetup] sys_ringsetup,
+[SYS_ringenter] sys_ringenter,
+[SYS_poll]    sys_poll,
+[SYS_epollcreate] sys_epollcreate,
+[SYS_epollctl] sys_epollctl,
+[SYS_epollwait] sys_epollwait,
+[SYS_fcntl]   sys_fcntl,
+[SYS_pread]   sys_pread,
+[SYS_pwrite]  sys_pwrite,
+[SYS_readv]   sys_readv,
+[SYS_writev]  sys_writev,
+[SYS_fsync]   sys_fsync,
+[SYS_fdatasync] sys_fdatasync,
+[SYS_lseek]   sys_lseek,
+[SYS_ftruncate] sys_ftruncate,
+[SYS_fallocate] sys_fallocate,
+[SYS_dmesg]   sys_dmesg,
 };
 
+static char *syscallnames[] = {
+[SYS_fork]    "fork",
+[SYS_exit]    "exit",
+[SYS_wait]    "wait",
+[SYS_pipe]    "pipe",
+[SYS_read]    "read",
+[SYS_kill]    "kill",
+[SYS_exec]    "exec",
+[SYS_fstat]   "fstat",
+[SYS_chdir]   "chdir",
+[SYS_dup]     "dup",
+[SYS_getpid]  "getpid",
+[SYS_sbrk]    "sbrk",
+[SYS_sleep]   "sleep",
+[SYS_uptime]  "uptime",
+[SYS_open]    "open",
+[SYS_write]   "write",
+[SYS_mknod]   "mknod",
+[SYS_unlink]  "unlink",
+[SYS_link]    "link",
+[SYS_mkdir]   "mkdir",
+[SYS_close]   "close",
+[SYS_ntas]    "ntas",
+[SYS_sigalarm]   "sigalarm",
+[SYS_sigreturn]  "sigreturn",
+[SYS_symlink] "symlink",
+[SYS_clone]   "clone",
+[SYS_join]    "join",
+[SYS_futex]   "futex",
+[SYS_spawn]   "spawn",
+[SYS_vfork]   "vfork",
+[SYS_lockstat] "lockstat",
+[SYS_trace]   "trace",
+[SYS_traceread] "traceread",
+[SYS_profile] "profile",
+[SYS_getrusage] "getrusage",
+[SYS_getprocs] "getprocs",
+[SYS_ringsetup] "ringsetup",
+[SYS_ringenter] "ringenter",
+[SYS_poll]    "poll",
+[SYS_epollcreate] "epollcreate",
+[SYS_epollctl] "epollctl",
+[SYS_epollwait] "epollwait",
+[SYS_fcntl]   "fcntl",
+[SYS_pread]   "pread",
+[SYS_pwrite]  "pwrite",
+[SYS_readv]   "readv",
+[SYS_writev]  "writev",
+[SYS_fsync]   "fsync",
+[SYS_fdatasync] "fdatasync",
+[SYS_lseek]   "lseek",
+[SYS_ftruncate] "ftruncate",
+[SYS_fallocate] "fallocate",
+[SYS_dmesg]   "dmesg",
+};
+
+// System calls that can be submitted through the ring in
+// sysring.c: ones that leave the caller's user registers
+// alone and don't care how they were entered.
+static char batchable[] = {
+[SYS_pipe]    1,
+[SYS_read]    1,
+[SYS_kill]    1,
+[SYS_fstat]   1,
+[SYS_chdir]   1,
+[SYS_dup]     1,
+[SYS_getpid]  1,
+[SYS_uptime]  1,
+[SYS_open]    1,
+[SYS_write]   1,
+[SYS_mknod]   1,
+[SYS_unlink]  1,
+[SYS_link]    1,
+[SYS_mkdir]   1,
+[SYS_close]   1,
+[SYS_symlink] 1,
+[SYS_epollcreate] 1,
+[SYS_epollctl] 1,
+[SYS_fcntl]   1,
+[SYS_pread]   1,
+[SYS_pwrite]  1,
+[SYS_readv]   1,
+[SYS_writev]  1,
+[SYS_fsync]   1,
+[SYS_fdatasync] 1,
+[SYS_lseek]   1,
+[SYS_ftruncate] 1,
+[SYS_fallocate] 1,
+};
+
+// The name of system call num, or 0 if there is none.
+char*
+syscallname(int num)
+{
+  if(num > 0 && num < NELEM(syscallnames))
+    return syscallnames[num];
+  return 0;
+}
+
+// Run system call num with arguments args on behalf of a
+// batch submitted by the current process, as though it had
+// trapped with them in its registers. Returns the call's
+// result, or -1 if num can't be batched.
+uint64
+syscallbatch(int num, uint64 *args)
+{
+  struct proc *p = myproc();
+  uint64 saved[6], ret;
+
+  if(num <= 0 || num >= NELEM(batchable) || !batchable[num])
+    return -1;
+  // a0 through a5 are adjacent in the trapframe.
+  memmove(saved, &p->tf->a0, sizeof(saved));
+  memmove(&p->tf->a0, args, sizeof(saved));
+  statsyscall(num);
+  TRACE(TR_SYSCALL, num);
+  ret = syscalls[num]();
+  TRACE(TR_SYSCALL_END, num);
+  memmove(&p->tf->a0, saved, sizeof(saved));
+  return ret;
+}
+
 void
 syscall(void)
 {
@@ -146,11 +327,14 @@ syscall(void)
   struct proc *p = myproc();
 
   num = p->tf->a7;
+  statsyscall(num);
+  TRACE(TR_SYSCALL, num);
   if(num > 0 && num < NELEM(syscalls) && syscalls[num]) {
     p->tf->a0 = syscalls[num]();
+    TRACE(TR_SYSCALL_END, num);
   } else {
-    printf("%d %s: unknown sys call %d\n",
-            p->pid, p->name, num);
+    klog_ratelimited(KL_WARN, "%d %s: unknown sys call %d\n",
+                     p->pid, p->name, num);
     p->tf->a0 = -1;
   }
 }
@@ -29,3 +29,31 @@
 #define SYS_sigalarm 26
 #define SYS_sigreturn 27
 #define SYS_symlink 28
+#define SYS_clone  29
+#define SYS_join   30
+#define SYS_futex  31
+#define SYS_spawn  32
+#define SYS_vfork  33
+#define SYS_lockstat 34
+#define SYS_trace  35
+#define SYS_traceread 36
+#define SYS_profile 37
+#define SYS_getrusage 38
+#define SYS_getprocs 39
+#define SYS_ringsetup 40
+#define SYS_ringenter 41
+#define SYS_poll   42
+#define SYS_epollcreate 43
+#define SYS_epollctl 44
+#define SYS_epollwait 45
+#define SYS_fcntl  46
+#define SYS_pread  47
+#define SYS_pwrite 48
+#define SYS_readv  49
+#define SYS_writev 50
+#define SYS_fsync  51
+#define SYS_fdatasync 52
+#define SYS_lseek  53
+#define SYS_ftruncate 54
+#define SYS_fallocate 55
+#define SYS_dmesg  56
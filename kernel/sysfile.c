@@ -10,12 +10,16 @@
 #include "param.h"
 #include "stat.h"
 #include "spinlock.h"
+#include "rusage.h"
 #include "proc.h"
 #include "fs.h"
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
 #include "buf.h"
+#include "spawn.h"
+#include "uio.h"
+#include "klog.h"
 
 #define MAX_RECURSIVE_DEPTH 10
 
@@ -78,6 +82,8 @@ sys_read(void)
 
   if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argaddr(1, &p) < 0)
     return -1;
+  // pipe and console reads copy out with spinlocks held.
+  execprefault(myproc(), p, n);
   return fileread(f, p, n);
 }
 
@@ -90,10 +96,96 @@ sys_write(void)
 
   if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argaddr(1, &p) < 0)
     return -1;
+  execprefault(myproc(), p, n);
 
   return filewrite(f, p, n);
 }
 
+uint64
+sys_pread(void)
+{
+  struct file *f;
+  struct iovec iov;
+  int n, off;
+  uint64 p;
+
+  if(argfd(0, 0, &f) < 0 || argaddr(1, &p) < 0 || argint(2, &n) < 0 ||
+     argint(3, &off) < 0 || n < 0 || off < 0)
+    return -1;
+  execprefault(myproc(), p, n);
+  iov.iov_base = (void *)p;
+  iov.iov_len = n;
+  return filereadv(f, &iov, 1, off);
+}
+
+uint64
+sys_pwrite(void)
+{
+  struct file *f;
+  struct iovec iov;
+  int n, off;
+  uint64 p;
+
+  if(argfd(0, 0, &f) < 0 || argaddr(1, &p) < 0 || argint(2, &n) < 0 ||
+     argint(3, &off) < 0 || n < 0 || off < 0)
+    return -1;
+  execprefault(myproc(), p, n);
+  iov.iov_base = (void *)p;
+  iov.iov_len = n;
+  return filewritev(f, &iov, 1, off);
+}
+
+// Fetch the array of cnt iovecs at user address addr,
+// which may hold at most 2^31-1 bytes in all.
+static int
+fetchiov(uint64 addr, int cnt, struct iovec *iov)
+{
+  struct proc *p = myproc();
+  uint64 n;
+  int i;
+
+  if(cnt < 0 || cnt > IOV_MAX)
+    return -1;
+  if(copyin(p->pagetable, (char *)iov, addr, cnt * sizeof(struct iovec)) < 0)
+    return -1;
+  n = 0;
+  for(i = 0; i < cnt; i++){
+    if(iov[i].iov_len >= 0x80000000 || (n += iov[i].iov_len) >= 0x80000000)
+      return -1;
+    // pipe and console reads copy out with spinlocks held.
+    execprefault(p, (uint64)iov[i].iov_base, iov[i].iov_len);
+  }
+  return 0;
+}
+
+uint64
+sys_readv(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int cnt;
+  uint64 p;
+
+  if(argfd(0, 0, &f) < 0 || argaddr(1, &p) < 0 || argint(2, &cnt) < 0 ||
+     fetchiov(p, cnt, iov) < 0)
+    return -1;
+  return filereadv(f, iov, cnt, -1);
+}
+
+uint64
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int cnt;
+  uint64 p;
+
+  if(argfd(0, 0, &f) < 0 || argaddr(1, &p) < 0 || argint(2, &cnt) < 0 ||
+     fetchiov(p, cnt, iov) < 0)
+    return -1;
+  return filewritev(f, iov, cnt, -1);
+}
+
 uint64
 sys_close(void)
 {
@@ -107,6 +199,75 @@ sys_close(void)
   return 0;
 }
 
+uint64
+sys_lseek(void)
+{
+  struct file *f;
+  int off, whence;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &off) < 0 || argint(2, &whence) < 0)
+    return -1;
+  return fileseek(f, off, whence);
+}
+
+uint64
+sys_ftruncate(void)
+{
+  struct file *f;
+  int size;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &size) < 0)
+    return -1;
+  return filetruncate(f, size);
+}
+
+uint64
+sys_fallocate(void)
+{
+  struct file *f;
+  int off, len;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &off) < 0 || argint(2, &len) < 0)
+    return -1;
+  return fileprealloc(f, off, len);
+}
+
+// Write fd's dirty cached data back to disk, and wait until
+// it and whatever else has been logged is on disk.
+static int
+filesync(struct file *f)
+{
+  if(f->type != FD_INODE)
+    return -1;
+  if(f->ip->type == T_FILE)
+    pagecache_flush(f->ip, 1);
+  log_sync(f->ip->dev);
+  return 0;
+}
+
+uint64
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  return filesync(f);
+}
+
+// The size and block addresses are the only metadata that
+// reach the disk with file data, and fdatasync() needs both,
+// so it does what fsync() does.
+uint64
+sys_fdatasync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  return filesync(f);
+}
+
 uint64
 sys_fstat(void)
 {
@@ -295,7 +456,7 @@ int read_path_from_inode(struct inode* ip, char* path, int length)
     uint num_read = 128;
     while(1){
       readi(ip, 0, (uint64)path, off, num_read);
-      printf("\033[34m[read_path_from_inode]\033[0m path: %s, path len:%d\n", path, strlen(path));
+      klog(KL_DEBUG, "\033[34m[read_path_from_inode]\033[0m path: %s, path len:%d\n", path, strlen(path));
 
       for(int i = 0; i < num_read; ++i){
         if(!path[i]){
@@ -406,6 +567,7 @@ sys_open(void)
   f->off = 0;
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
+  f->nonblock = (omode & O_NONBLOCK) != 0;
 
   iunlock(ip);
   end_op(ROOTDEV);
@@ -474,23 +636,22 @@ sys_chdir(void)
   return 0;
 }
 
-uint64
-sys_exec(void)
+// Copy the user argv array at uargv into argv[MAXARG],
+// one kalloc()ed page per string. Returns 0 on success;
+// either way, the caller frees argv with freeargv().
+static int
+fetchargv(uint64 uargv, char **argv)
 {
-  char path[MAXPATH], *argv[MAXARG];
   int i;
-  uint64 uargv, uarg;
+  uint64 uarg;
 
-  if(argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0){
-    return -1;
-  }
-  memset(argv, 0, sizeof(argv));
+  memset(argv, 0, MAXARG*sizeof(argv[0]));
   for(i=0;; i++){
-    if(i >= NELEM(argv)){
-      goto bad;
+    if(i >= MAXARG){
+      return -1;
     }
     if(fetchaddr(uargv+sizeof(uint64)*i, (uint64*)&uarg) < 0){
-      goto bad;
+      return -1;
     }
     if(uarg == 0){
       argv[i] = 0;
@@ -500,21 +661,77 @@ sys_exec(void)
     if(argv[i] == 0)
       panic("sys_exec kalloc");
     if(fetchstr(uarg, argv[i], PGSIZE) < 0){
-      goto bad;
+      return -1;
     }
   }
+  return 0;
+}
 
-  int ret = exec(path, argv);
+static void
+freeargv(char **argv)
+{
+  int i;
 
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
+  for(i = 0; i < MAXARG && argv[i] != 0; i++)
     kfree(argv[i]);
+}
+
+uint64
+sys_exec(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  uint64 uargv;
+  int ret;
+
+  if(argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0){
+    return -1;
+  }
+  if(fetchargv(uargv, argv) < 0){
+    freeargv(argv);
+    return -1;
+  }
 
+  ret = exec(path, argv);
+
+  freeargv(argv);
   return ret;
+}
 
- bad:
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-    kfree(argv[i]);
-  return -1;
+uint64
+sys_spawn(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  struct spawn_action acts[NOFILE];
+  uint64 uargv, uacts;
+  int nact, ret;
+
+  if(argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0 ||
+     argaddr(2, &uacts) < 0){
+    return -1;
+  }
+
+  // the action list ends at an op of 0; a null list is empty.
+  nact = 0;
+  while(uacts != 0){
+    if(nact >= NELEM(acts))
+      return -1;
+    if(copyin(myproc()->pagetable, (char*)&acts[nact],
+              uacts + nact*sizeof(acts[0]), sizeof(acts[0])) < 0)
+      return -1;
+    if(acts[nact].op == 0)
+      break;
+    nact++;
+  }
+
+  if(fetchargv(uargv, argv) < 0){
+    freeargv(argv);
+    return -1;
+  }
+
+  ret = spawn(path, argv, acts, nact);
+
+  freeargv(argv);
+  return ret;
 }
 
 uint64
@@ -571,4 +788,73 @@ sys_symlink(void)
   iunlockput(inode_link);
   end_op(ROOTDEV);
   return 0;
-}
\ No newline at end of file
+}
+
+uint64
+sys_poll(void)
+{
+  uint64 fds; // user pointer to array of struct pollfd
+  int nfds, timeout;
+
+  if(argaddr(0, &fds) < 0 || argint(1, &nfds) < 0 || argint(2, &timeout) < 0)
+    return -1;
+  return poll(fds, nfds, timeout);
+}
+
+uint64
+sys_epollcreate(void)
+{
+  struct file *f;
+  int fd;
+
+  if(epollalloc(&f) < 0)
+    return -1;
+  if((fd = fdalloc(f)) < 0){
+    fileclose(f);
+    return -1;
+  }
+  return fd;
+}
+
+uint64
+sys_epollctl(void)
+{
+  struct file *f;
+  int op, fd;
+  uint64 ev; // user pointer to struct epoll_event
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &op) < 0 || argint(2, &fd) < 0 ||
+     argaddr(3, &ev) < 0)
+    return -1;
+  return epollctl(f, op, fd, ev);
+}
+
+uint64
+sys_epollwait(void)
+{
+  struct file *f;
+  int max, timeout;
+  uint64 evs; // user pointer to array of struct epoll_event
+
+  if(argfd(0, 0, &f) < 0 || argaddr(1, &evs) < 0 || argint(2, &max) < 0 ||
+     argint(3, &timeout) < 0)
+    return -1;
+  return epollwait(f, evs, max, timeout);
+}
+
+uint64
+sys_fcntl(void)
+{
+  struct file *f;
+  int cmd, arg;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &cmd) < 0 || argint(2, &arg) < 0)
+    return -1;
+  if(cmd == F_GETFL)
+    return f->nonblock ? O_NONBLOCK : 0;
+  if(cmd == F_SETFL){
+    f->nonblock = (arg & O_NONBLOCK) != 0;
+    return 0;
+  }
+  return -1;
+}
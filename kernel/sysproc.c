@@ -5,7 +5,9 @@
 #include "param.h"
 #include "memlayout.h"
 #include "spinlock.h"
+#include "rusage.h"
 #include "proc.h"
+#include "futex.h"
 
 uint64
 sys_exit(void)
@@ -35,31 +37,95 @@ sys_wait(void)
   uint64 p;
   if (argaddr(0, &p) < 0)
     return -1;
+  // wait() copies out the status with p->lock held.
+  execprefault(myproc(), p, sizeof(int));
   return wait(p);
 }
 
+uint64
+sys_vfork(void)
+{
+  return vfork();
+}
+
+uint64
+sys_clone(void)
+{
+  uint64 fn, arg, stack;
+
+  if(argaddr(0, &fn) < 0 || argaddr(1, &arg) < 0 || argaddr(2, &stack) < 0)
+    return -1;
+  // the thread's stack is one page of the caller's memory.
+  if(stack + PGSIZE < stack || stack + PGSIZE > myproc()->sz)
+    return -1;
+  return clone(fn, arg, stack);
+}
+
+uint64
+sys_join(void)
+{
+  uint64 p;
+  if (argaddr(0, &p) < 0)
+    return -1;
+  execprefault(myproc(), p, sizeof(uint64));
+  return join(p);
+}
+
+uint64
+sys_getrusage(void)
+{
+  int who;
+  uint64 addr;
+
+  if(argint(0, &who) < 0 || argaddr(1, &addr) < 0)
+    return -1;
+  return getrusage(who, addr);
+}
+
+uint64
+sys_getprocs(void)
+{
+  uint64 addr;
+  int n;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &n) < 0)
+    return -1;
+  return getprocs(addr, n);
+}
+
+uint64
+sys_futex(void)
+{
+  uint64 addr;
+  int op, val;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &op) < 0 || argint(2, &val) < 0)
+    return -1;
+  switch(op){
+  case FUTEX_WAIT:
+    return futex_wait(addr, val);
+  case FUTEX_WAKE:
+    return futex_wake(addr, val);
+  }
+  return -1;
+}
+
 uint64
 sys_sbrk(void)
 {
   int addr_old;
   int n;
+  struct spinlock *lk;
   if (argint(0, &n) < 0)
     return -1;
-  addr_old = myproc()->sz;
   if (n < 0)
-  {
-    int addr_free_start = PGROUNDUP(addr_old + n);
-    int addr_freed;
-
-    // after round up if addr_free_start goes to another page, skip
-    if (addr_free_start < addr_old)
-    {
-      addr_freed = addr_old - addr_free_start;
-      uvmunmap(myproc()->pagetable, addr_free_start, addr_freed, 1);
-      free_pagetable(myproc()->pagetable, addr_free_start);
-    }
-  }
-  myproc()->sz += n;
+    return shrinkproc(myproc(), -n);
+  // threads sharing the memory may sbrk() at once.
+  lk = vmlock(myproc()->pagetable);
+  acquire(lk);
+  addr_old = myproc()->sz;
+  proc_setsz(myproc(), myproc()->sz + n);
+  release(lk);
   return addr_old;
 }
 
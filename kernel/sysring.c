@@ -0,0 +1,259 @@
+//
+// Batched system calls. ringsetup() maps a struct sysring
+// (see sysring.h) into the calling process at SYSRING, and
+// ringenter() runs every system call queued on it, so that
+// a process can make many small calls with one trap.
+//
+// The kernel reaches the ring through its physical address,
+// so running an entry costs no copyin() or copyout(). Each
+// entry runs as if it had been made by a trap: syscallbatch()
+// loads its arguments into the trapframe and calls the usual
+// sys_ function. Only calls that leave the process's user
+// registers alone can be batched (see batchable[] in
+// syscall.c).
+//
+// Asynchronous entries (SQE_ASYNC) go on a queue instead, for
+// a kernel thread that shares the process's memory, made with
+// kthread() the first time it is needed. It runs them one at
+// a time, in order, and posts each completion as it finishes,
+// so the process can compute while the disk works. Only the
+// process itself, not its clone() threads, can queue them.
+//
+// Threads made by clone() share the ring along with the rest
+// of their memory, but only one should enter it at a time.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "rusage.h"
+#include "proc.h"
+#include "defs.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "syscall.h"
+#include "uio.h"
+#include "sysring.h"
+
+// Asynchronous entries waiting for, or being run by, a
+// process's worker thread. There is always room for every
+// completion they will post, so there can be at most NCQE.
+struct aio {
+  struct spinlock lock;
+  struct proc *worker;
+  int stop;         // set by aiostop()
+  uint head;        // next entry for the worker
+  uint tail;        // next free entry
+  struct aioent {
+    struct file *f;
+    int write;
+    struct iovec iov;
+    int off;        // or -1 to use and advance the file offset
+    uint64 data;
+  } q[NCQE];
+};
+
+// serializes posting completions, which ringenter() and
+// the worker threads both do.
+struct spinlock ringlock;
+
+void
+sysringinit(void)
+{
+  initlock(&ringlock, "sysring");
+}
+
+// Post a completion to r.
+static void
+ringpost(struct sysring *r, uint64 data, uint64 ret)
+{
+  struct cqe *c;
+
+  acquire(&ringlock);
+  c = &r->cq[r->cqtail % NCQE];
+  c->data = data;
+  c->ret = ret;
+  __atomic_store_n(&r->cqtail, r->cqtail + 1, __ATOMIC_RELEASE);
+  release(&ringlock);
+}
+
+// The kernel thread that runs a process's asynchronous
+// entries, until the process exits or execs.
+static void
+aioworker(void)
+{
+  struct proc *p = myproc();
+  struct aio *a = p->karg;
+  struct aioent e;
+  uint64 pa;
+  int ret;
+
+  // still holding p->lock from scheduler.
+  release(&p->lock);
+
+  acquire(&a->lock);
+  for(;;){
+    // killthreads() kills the worker when the process exits.
+    while(a->head == a->tail && !a->stop && !p->killed)
+      sleep(a, &a->lock);
+    if(a->stop || p->killed)
+      break;
+    // aiosubmit() may reuse the slot once head moves on.
+    e = a->q[a->head % NCQE];
+    release(&a->lock);
+
+    // as sys_pread() and sys_pwrite() do.
+    execprefault(p, (uint64)e.iov.iov_base, e.iov.iov_len);
+    if(e.write)
+      ret = filewritev(e.f, &e.iov, 1, e.off);
+    else
+      ret = filereadv(e.f, &e.iov, 1, e.off);
+    fileclose(e.f);
+    if((pa = walkaddr(p->pagetable, SYSRING)) != 0){
+      ringpost((struct sysring *)pa, e.data, ret);
+      futex_wake((uint64)&((struct sysring *)SYSRING)->cqtail, NPROC);
+    }
+
+    acquire(&a->lock);
+    a->head++;
+  }
+  release(&a->lock);
+  // no one is left to see the rest, or to queue more.
+  // fileclose() may sleep, so not with a->lock held.
+  for(; a->head != a->tail; a->head++)
+    fileclose(a->q[a->head % NCQE].f);
+  kfree((char *)a);
+  exit(0);
+}
+
+// Queue entry e for p's worker thread, starting it if need be.
+// Returns 0, or -1 if e can't run asynchronously.
+static int
+aiosubmit(struct proc *p, struct sqe *e)
+{
+  struct aio *a;
+  struct file *f;
+  int fd, i, off;
+
+  fd = e->arg[0];
+  if(p->thread)
+    return -1;
+  if(e->num == SYS_read || e->num == SYS_write)
+    off = -1;
+  else if((e->num == SYS_pread || e->num == SYS_pwrite) && (int)e->arg[3] >= 0)
+    off = e->arg[3];
+  else
+    return -1;
+  if((int)e->arg[2] < 0)
+    return -1;
+  // only files' reads and writes end; pipes and devices
+  // could keep the worker waiting forever.
+  if(fd < 0 || fd >= NOFILE || (f = p->ofile[fd]) == 0 || f->type != FD_INODE)
+    return -1;
+  if((a = p->aio) == 0){
+    if((a = (struct aio *)kalloc()) == 0)
+      return -1;
+    memset(a, 0, sizeof(*a));
+    initlock(&a->lock, "aio");
+    if((a->worker = kthread(p, aioworker, a)) == 0){
+      kfree((char *)a);
+      return -1;
+    }
+    p->aio = a;
+  }
+
+  acquire(&a->lock);
+  // ringenter() leaves room for the completions, but the
+  // process can scribble on the counters it goes by.
+  if(a->tail - a->head >= NCQE){
+    release(&a->lock);
+    return -1;
+  }
+  i = a->tail % NCQE;
+  a->q[i].f = filedup(f);
+  a->q[i].write = (e->num == SYS_write || e->num == SYS_pwrite);
+  a->q[i].iov.iov_base = (void *)e->arg[1];
+  a->q[i].iov.iov_len = (int)e->arg[2];
+  a->q[i].off = off;
+  a->q[i].data = e->data;
+  a->tail++;
+  wakeup(a);
+  release(&a->lock);
+  return 0;
+}
+
+// Stop p's worker thread, if it has one, because exec() is
+// replacing the memory it works on, and wait for it. The
+// worker finishes the entry it is running, drops the rest,
+// and frees a.
+void
+aiostop(struct proc *p)
+{
+  struct aio *a = p->aio;
+  struct proc *w;
+
+  if(a == 0)
+    return;
+  p->aio = 0;
+  acquire(&a->lock);
+  w = a->worker;
+  a->stop = 1;
+  wakeup(a);
+  release(&a->lock);
+  kthreadreap(w);
+}
+
+// Map the calling process's ring if it hasn't one yet,
+// and return its user address.
+uint64
+sys_ringsetup(void)
+{
+  if(mapsysring(myproc()) < 0)
+    return -1;
+  return SYSRING;
+}
+
+// Run the system calls queued on the calling process's ring,
+// stopping early if the completion queue fills or the process
+// is killed. Asynchronous entries are only queued. Returns
+// the number of entries taken.
+uint64
+sys_ringenter(void)
+{
+  struct proc *p = myproc();
+  struct sysring *r;
+  struct sqe e;
+  uint head, tail, pending;
+  uint64 pa, ret;
+  int n;
+
+  if((pa = walkaddr(p->pagetable, SYSRING)) == 0)
+    return -1;
+  r = (struct sysring *)pa;
+
+  head = r->sqhead;
+  tail = __atomic_load_n(&r->sqtail, __ATOMIC_ACQUIRE);
+  for(n = 0; head != tail && !p->killed; n++){
+    // leave room for the completions still to come.
+    pending = p->aio ? p->aio->tail - p->aio->head : 0;
+    if(r->cqtail + pending - __atomic_load_n(&r->cqhead, __ATOMIC_ACQUIRE) >= NCQE)
+      break;
+    // copy the entry, since the process may change it
+    // while the call sleeps.
+    e = r->sq[head % NSQE];
+    head++;
+    __atomic_store_n(&r->sqhead, head, __ATOMIC_RELEASE);
+    if(e.flags & SQE_ASYNC){
+      if(aiosubmit(p, &e) == 0)
+        continue;
+      ret = -1;
+    } else {
+      ret = syscallbatch(e.num, e.arg);
+    }
+    ringpost(r, e.data, ret);
+  }
+  return n;
+}
@@ -0,0 +1,39 @@
+// A page shared by a process and the kernel, through which
+// the process submits system calls in batches; see sysring.c.
+//
+// The process fills sq[sqtail % NSQE] and advances sqtail;
+// ringenter() runs entries from sqhead up to sqtail, posting
+// each one's result at cq[cqtail % NCQE]. The process reads
+// results from cqhead up to cqtail, then advances cqhead.
+// The counters only ever grow.
+//
+// An entry with SQE_ASYNC set, a read(), write(), pread() or
+// pwrite() of a file, doesn't run in ringenter(): it is handed to a kernel
+// thread, and its completion is posted when the disk I/O is
+// done. To wait for completions, futex(FUTEX_WAIT) on cqtail.
+
+#define NSQE 32
+#define NCQE 64
+
+#define SQE_ASYNC 0x1   // complete in the background
+
+struct sqe {
+  int num;          // system call number, from syscall.h
+  int flags;        // SQE_ASYNC
+  uint64 arg[6];
+  uint64 data;      // copied to the completion, for the caller
+};
+
+struct cqe {
+  uint64 data;
+  uint64 ret;       // what the system call returned
+};
+
+struct sysring {
+  uint sqhead;      // written by the kernel
+  uint sqtail;      // written by the process
+  uint cqhead;      // written by the process
+  uint cqtail;      // written by the kernel
+  struct sqe sq[NSQE];
+  struct cqe cq[NCQE];
+};
@@ -0,0 +1,137 @@
+//
+// Kernel event tracing. Each CPU appends timestamped events
+// to a ring of its own, with interrupts off, so recording an
+// event takes no lock and touches no shared cache line.
+// traceread() drains the rings; if it doesn't keep up, the
+// oldest events are overwritten.
+//
+// Tracepoints are TRACE() calls, which test the global flag
+// tracing first, so while tracing is off each costs one
+// well-predicted branch.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "rusage.h"
+#include "proc.h"
+#include "defs.h"
+#include "trace.h"
+
+#define NTRACE 512   // events per CPU ring; a power of two
+
+int tracing;
+
+static struct tracering {
+  uint64 head;       // events ever recorded; written by the owning CPU
+  uint64 tail;       // events consumed; written by traceread()
+  struct traceevent ev[NTRACE];
+} rings[NCPU];
+
+// serializes readers, which are the only ones to move tail.
+// A sleep-lock, since copyout() may fault and sleep.
+static struct sleeplock tracelock;
+
+void
+traceinit(void)
+{
+  initsleeplock(&tracelock, "trace");
+}
+
+// Record an event in this CPU's ring. Use TRACE().
+void
+trace(int type, uint64 arg)
+{
+  struct tracering *r;
+  struct traceevent *e;
+  struct proc *p;
+
+  push_off();
+  r = &rings[cpuid()];
+  e = &r->ev[r->head & (NTRACE-1)];
+  p = mycpu()->proc;
+  e->time = *(volatile uint64 *)CLINT_MTIME;
+  e->arg = arg;
+  e->pid = p ? p->pid : 0;
+  e->type = type;
+  e->cpu = cpuid();
+  // publish the event after writing it.
+  __atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+  pop_off();
+}
+
+// Copy events out of ring r into the n slots at user address
+// dst. Returns the number copied, or -1.
+static int
+drain(struct tracering *r, uint64 dst, int n)
+{
+  struct traceevent e;
+  uint64 head;
+  int got;
+
+  got = 0;
+  while(got < n){
+    head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    if(r->tail == head)
+      break;
+    if(head - r->tail > NTRACE)
+      r->tail = head - NTRACE;   // lost to overwriting
+    e = r->ev[r->tail & (NTRACE-1)];
+    // if the owner has lapped us while we copied, e may be
+    // half overwritten; skip ahead and try again.
+    __sync_synchronize();
+    if(__atomic_load_n(&r->head, __ATOMIC_ACQUIRE) - r->tail > NTRACE)
+      continue;
+    r->tail++;
+    if(copyout(myproc()->pagetable, dst + got*sizeof(e), (char *)&e, sizeof(e)) < 0)
+      return -1;
+    got++;
+  }
+  return got;
+}
+
+// trace(int on): start or stop tracing. Starting drops any
+// events left over from before.
+uint64
+sys_trace(void)
+{
+  int on, c;
+
+  if(argint(0, &on) < 0)
+    return -1;
+  acquiresleep(&tracelock);
+  if(on){
+    for(c = 0; c < NCPU; c++)
+      rings[c].tail = __atomic_load_n(&rings[c].head, __ATOMIC_ACQUIRE);
+  }
+  __atomic_store_n(&tracing, on != 0, __ATOMIC_RELEASE);
+  releasesleep(&tracelock);
+  return 0;
+}
+
+// traceread(struct traceevent *ev, int n): move up to n
+// recorded events to ev, one CPU's after another, each CPU's
+// in the order they happened. Returns the number moved.
+uint64
+sys_traceread(void)
+{
+  uint64 dst;
+  int n, c, got, r;
+
+  if(argaddr(0, &dst) < 0 || argint(1, &n) < 0 || n < 0)
+    return -1;
+  got = 0;
+  acquiresleep(&tracelock);
+  for(c = 0; c < NCPU && got < n; c++){
+    if((r = drain(&rings[c], dst + got*sizeof(struct traceevent), n - got)) < 0){
+      got = -1;
+      break;
+    }
+    got += r;
+  }
+  releasesleep(&tracelock);
+  return got;
+}
@@ -0,0 +1,23 @@
+// Kernel trace events, as returned by traceread().
+
+#define TR_SYSCALL      1   // system call entry; arg is its number
+#define TR_SYSCALL_END  2   // system call return; arg is its number
+#define TR_TRAP         3   // trap from user space; arg is scause
+#define TR_TRAP_END     4   // return to user space
+#define TR_KTRAP        5   // trap from the kernel; arg is scause
+#define TR_KTRAP_END    6   // return from it
+#define TR_SCHED        7   // switch to the scheduler; arg is new state
+#define TR_BREAD_MISS   8   // bread() must read; arg is block number
+#define TR_DISK         9   // disk request submitted; arg is block number
+#define TR_DISK_END     10  // disk request finished; arg is block number
+#define TR_COMMIT       11  // log commit start; arg is device
+#define TR_COMMIT_END   12  // log commit end; arg is device
+#define NTRTYPE         13
+
+struct traceevent {
+  uint64 time;    // CLINT mtime ticks (10 MHz on qemu)
+  uint64 arg;
+  int pid;        // process running, or 0
+  ushort type;    // TR_*
+  ushort cpu;
+};
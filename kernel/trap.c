@@ -3,8 +3,11 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "rusage.h"
 #include "proc.h"
 #include "defs.h"
+#include "trace.h"
+#include "klog.h"
 
 struct spinlock tickslock;
 uint ticks;
@@ -15,10 +18,11 @@ extern char trampoline[], uservec[], userret[];
 void kernelvec();
 
 extern int devintr();
+static uint64 prepret(struct proc *);
 
 void trapinit(void)
 {
-  initlock(&tickslock, "time");
+  initmcslock(&tickslock, "time");
 }
 
 // set up to take exceptions and traps while in the kernel.
@@ -43,6 +47,8 @@ void usertrap(void)
   w_stvec((uint64)kernelvec);
 
   struct proc *p = myproc();
+  rucharge(p, &p->ru.ru_utime);
+  TRACE(TR_TRAP, r_scause());
   // save user program counter.
   p->tf->epc = r_sepc();
   if (r_scause() == 8)
@@ -84,12 +90,14 @@ void usertrap(void)
   }
   else if ((which_dev = devintr()) != 0)
   {
-    // ok
+    if (which_dev == 2 && profiling)
+      profsample(p->tf->epc, p->tf->s0, 1);
   }
   else
   {
-    printf("usertrap(): unexpected scause %p pid=%d\n", r_scause(), p->pid);
-    printf("            sepc=%p stval=%p\n", r_sepc(), r_stval());
+    klog_ratelimited(KL_WARN, "usertrap(): unexpected scause %p pid=%d\n"
+                     "            sepc=%p stval=%p\n",
+                     r_scause(), p->pid, r_sepc(), r_stval());
     p->killed = 1;
   }
 
@@ -105,10 +113,11 @@ void usertrap(void)
     }
     else
     {
-      memmove(p->tf_sigalarm_save, p->tf, sizeof(*(p->tf)));
       p->tick_count++;
       if (p->tick_count == p->tick_interval)
       {
+        // sigreturn() restores the registers saved here.
+        memmove(p->tf_sigalarm_save, p->tf, sizeof(*(p->tf)));
         p->tick_interval = 0;
         p->tf->epc = p->sigalarm_handler;
       }
@@ -118,16 +127,66 @@ void usertrap(void)
   usertrapret();
 }
 
+//
+// handle a system call from user space, except those that
+// need every register saved (see uservec in trampoline.S).
+// called from syscallvec in trampoline.S, which saved only
+// the registers system calls use, and which this returns to,
+// so that the C calling convention preserves the others.
+// returns the satp value for user space.
+//
+uint64 usersyscall(void)
+{
+  struct proc *p = myproc();
+  uint64 satp;
+
+  if ((r_sstatus() & SSTATUS_SPP) != 0)
+    panic("usersyscall: not from user mode");
+
+  w_stvec((uint64)kernelvec);
+  rucharge(p, &p->ru.ru_utime);
+  TRACE(TR_TRAP, r_scause());
+  p->tf->epc = r_sepc() + 4;
+
+  if (p->killed)
+    exit(-1);
+  intr_on();
+  syscall();
+  if (p->killed)
+    exit(-1);
+
+  satp = prepret(p);
+  // syscallvec finds the trapframe through sscratch.
+  w_sscratch(p->tfva);
+  return satp;
+}
+
 //
 // return to user space
 //
 void usertrapret(void)
 {
   struct proc *p = myproc();
+  uint64 satp = prepret(p);
 
+  // jump to trampoline.S at the top of memory, which
+  // switches to the user page table, restores user registers,
+  // and switches to user mode with sret.
+  uint64 fn = TRAMPOLINE + (userret - trampoline);
+  ((void (*)(uint64, uint64))fn)(p->tfva, satp);
+}
+
+//
+// set up for the next trap from user space and for sret,
+// and return the satp value for p's page table.
+//
+static uint64 prepret(struct proc *p)
+{
   // turn off interrupts, since we're switching
   // now from kerneltrap() to usertrap().
   intr_off();
+  TRACE(TR_TRAP_END, 0);
+  rucharge(p, &p->ru.ru_stime);
 
   // send syscalls, interrupts, and exceptions to trampoline.S
   w_stvec(TRAMPOLINE + (uservec - trampoline));
@@ -137,6 +196,7 @@ void usertrapret(void)
   p->tf->kernel_satp = r_satp();         // kernel page table
   p->tf->kernel_sp = p->kstack + PGSIZE; // process's kernel stack
   p->tf->kernel_trap = (uint64)usertrap;
+  p->tf->kernel_syscall = (uint64)usersyscall;
   p->tf->kernel_hartid = r_tp(); // hartid for cpuid()
 
   // set up the registers that trampoline.S's sret will use
@@ -152,13 +212,7 @@ void usertrapret(void)
   w_sepc(p->tf->epc);
 
   // tell trampoline.S the user page table to switch to.
-  uint64 satp = MAKE_SATP(p->pagetable);
-
-  // jump to trampoline.S at the top of memory, which
-  // switches to the user page table, restores user registers,
-  // and switches to user mode with sret.
-  uint64 fn = TRAMPOLINE + (userret - trampoline);
-  ((void (*)(uint64, uint64))fn)(TRAPFRAME, satp);
+  return usersatp(p);
 }
 
 // interrupts and exceptions from kernel code go here via kernelvec,
@@ -176,6 +230,7 @@ kerneltrap()
     panic("kerneltrap: not from supervisor mode");
   if (intr_get() != 0)
     panic("kerneltrap: interrupts enabled");
+  TRACE(TR_KTRAP, scause);
   if ((which_dev = devintr()) == 0)
   {
     // handle store page fault
@@ -204,6 +259,11 @@ kerneltrap()
     }
   }
 
+  // the interrupted code's frame pointer is the one
+  // kerneltrap() saved in its own frame.
+  if (which_dev == 2 && profiling)
+    profsample(sepc, *(uint64 *)(r_fp() - 16), 0);
+
   // give up the CPU if this is a timer interrupt.
   if (which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING)
     yield();
@@ -212,6 +272,7 @@ kerneltrap()
   // so restore trap registers for use by kernelvec.S's sepc instruction.
   w_sepc(sepc);
   w_sstatus(sstatus);
+  TRACE(TR_KTRAP_END, scause);
 }
 
 void clockintr()
@@ -220,6 +281,8 @@ void clockintr()
   ticks++;
   wakeup(&ticks);
   release(&tickslock);
+  polltick();
+  klogtick();
 }
 
 // check if it's an external interrupt or software interrupt,
@@ -266,6 +329,10 @@ int devintr()
       clockintr();
     }
 
+    // whatever was interrupted can't have been an RCU
+    // reader, since readers keep interrupts off.
+    rcu_quiescent();
+
     // acknowledge the software interrupt by clearing
     // the SSIP bit in sip.
     w_sip(r_sip() & ~2);
@@ -1,12 +1,18 @@
 //
 // low-level driver routines for 16550a UART.
 //
+// Output goes through a ring buffer, which uartstart() feeds
+// to the UART's transmit FIFO a FIFO-full at a time, and the
+// transmit-empty interrupt refills. Writers only copy into the
+// ring, so they don't wait for the UART unless it's full.
+//
 
 #include "types.h"
 #include "param.h"
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "rusage.h"
 #include "proc.h"
 #include "defs.h"
 
@@ -27,9 +33,27 @@
 #define LCR 3 // line control register
 #define LSR 5 // line status register
 
+#define IER_RX_ENABLE (1<<0)
+#define IER_TX_ENABLE (1<<1)
+#define LSR_RX_READY  (1<<0)  // input is waiting to be read from RHR
+#define LSR_TX_IDLE   (1<<5)  // THR and the transmit FIFO are empty
+
+#define UART_FIFO 16          // bytes the transmit FIFO holds
+
 #define ReadReg(reg) (*(Reg(reg)))
 #define WriteReg(reg, v) (*(Reg(reg)) = (v))
 
+// the transmit ring.
+#define UART_TX_BUF 1024
+static struct spinlock uart_tx_lock;
+static char uart_tx_buf[UART_TX_BUF];
+static uint64 uart_tx_w; // write next to uart_tx_buf[uart_tx_w % UART_TX_BUF]
+static uint64 uart_tx_r; // read next from uart_tx_buf[uart_tx_r % UART_TX_BUF]
+
+static int uartsync;     // set by panic(): don't use the ring
+
+static void uartstart(void);
+
 void
 uartinit(void)
 {
@@ -52,26 +76,120 @@ uartinit(void)
   // reset and enable FIFOs.
   WriteReg(FCR, 0x07);
 
-  // enable receive interrupts.
-  WriteReg(IER, 0x01);
+  // enable transmit and receive interrupts.
+  WriteReg(IER, IER_TX_ENABLE | IER_RX_ENABLE);
+
+  initlock(&uart_tx_lock, "uart");
 }
 
-// write one output character to the UART.
-void
-uartputc(int c)
+// write c to the UART, waiting for it to have room.
+static void
+uartputc_sync(int c)
 {
-  // wait for Transmit Holding Empty to be set in LSR.
-  while((ReadReg(LSR) & (1 << 5)) == 0)
+  while((ReadReg(LSR) & LSR_TX_IDLE) == 0)
     ;
   WriteReg(THR, c);
 }
 
+// add a character to the output ring, for kernel printf()
+// and echoing input. never sleeps: if the ring is full, which
+// only happens if it is being filled faster than the UART can
+// send, feed the UART directly until there is room.
+void
+uartputc(int c)
+{
+  if(uartsync){
+    uartputc_sync(c);
+    return;
+  }
+  acquire(&uart_tx_lock);
+  while(uart_tx_w == uart_tx_r + UART_TX_BUF){
+    while((ReadReg(LSR) & LSR_TX_IDLE) == 0)
+      ;
+    uartstart();
+  }
+  uart_tx_buf[uart_tx_w++ % UART_TX_BUF] = c;
+  uartstart();
+  release(&uart_tx_lock);
+}
+
+// add the n characters at buf to the output ring, sleeping
+// while it's full, unless nonblock. returns how many were
+// added, which is fewer than n only if nonblock, or if the
+// process is killed.
+int
+uartwrite(char *buf, int n, int nonblock)
+{
+  int i;
+
+  if(uartsync){
+    for(i = 0; i < n; i++)
+      uartputc_sync(buf[i]);
+    return n;
+  }
+  acquire(&uart_tx_lock);
+  for(i = 0; i < n; i++){
+    while(uart_tx_w == uart_tx_r + UART_TX_BUF){
+      if(nonblock || myproc()->killed)
+        goto out;
+      // uartintr() wakes us as the ring drains.
+      sleep(&uart_tx_r, &uart_tx_lock);
+    }
+    uart_tx_buf[uart_tx_w++ % UART_TX_BUF] = buf[i];
+  }
+out:
+  uartstart();
+  release(&uart_tx_lock);
+  return i;
+}
+
+// is there room in the output ring?
+int
+uartwritable(void)
+{
+  return uart_tx_w != uart_tx_r + UART_TX_BUF;
+}
+
+// move characters from the output ring to the UART, as many
+// as its transmit FIFO has room for, if it is idle; the
+// transmit-empty interrupt calls again when they're sent.
+// caller must hold uart_tx_lock.
+static void
+uartstart(void)
+{
+  int n;
+
+  if(uart_tx_w == uart_tx_r){
+    // nothing to send. reading ISR acknowledges the
+    // transmit-empty interrupt.
+    ReadReg(ISR);
+    return;
+  }
+  if((ReadReg(LSR) & LSR_TX_IDLE) == 0){
+    // the UART is busy, and will interrupt when it's done.
+    return;
+  }
+  for(n = 0; n < UART_FIFO && uart_tx_r != uart_tx_w; n++)
+    WriteReg(THR, uart_tx_buf[uart_tx_r++ % UART_TX_BUF]);
+}
+
+// called by panic(): send what's in the ring and from now on
+// write straight to the UART, without uart_tx_lock, which the
+// panicking CPU may be holding.
+void
+uartpanic(void)
+{
+  uartsync = 1;
+  while(uart_tx_r != uart_tx_w)
+    uartputc_sync(uart_tx_buf[uart_tx_r++ % UART_TX_BUF]);
+}
+
 // read one input character from the UART.
 // return -1 if none is waiting.
 int
 uartgetc(void)
 {
-  if(ReadReg(LSR) & 0x01){
+  if(ReadReg(LSR) & LSR_RX_READY){
     // input data is ready.
     return ReadReg(RHR);
   } else {
@@ -79,14 +197,29 @@ uartgetc(void)
   }
 }
 
-// trap.c calls here when the uart interrupts.
+// trap.c calls here when the uart interrupts, because
+// input has arrived, or it is ready for more output, or both.
 void
 uartintr(void)
 {
+  int full;
+
   while(1){
     int c = uartgetc();
     if(c == -1)
       break;
     consoleintr(c);
   }
+
+  // the wakeup is here rather than in uartstart() because
+  // printf() may be called holding a process's lock.
+  acquire(&uart_tx_lock);
+  full = uart_tx_w == uart_tx_r + UART_TX_BUF;
+  uartstart();
+  if(uart_tx_w - uart_tx_r < UART_TX_BUF - UART_FIFO)
+    wakeup(&uart_tx_r);
+  release(&uart_tx_lock);
+  // pollers of the console may be waiting for room.
+  if(full)
+    pollwakeup();
 }
@@ -0,0 +1,7 @@
+// A buffer for readv() and writev().
+struct iovec {
+  void *iov_base;
+  uint64 iov_len;
+};
+
+#define IOV_MAX 16  // most buffers in one readv() or writev()
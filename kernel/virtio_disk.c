@@ -16,6 +16,8 @@
 #include "fs.h"
 #include "buf.h"
 #include "virtio.h"
+#include "stats.h"
+#include "trace.h"
 
 // the address of virtio mmio register r.
 #define R(n, r) ((volatile uint32 *)(VIRTION(n) + (r)))
@@ -182,6 +184,10 @@ virtio_disk_rw(int n, struct buf *b, int write)
 {
   uint64 sector = b->blockno * (BSIZE / 512);
 
+  statadd(STAT_DISK_REQ, 1);
+  statadd(STAT_DISK_BYTES, BSIZE);
+  TRACE(TR_DISK, b->blockno);
+
   acquire(&disk[n].vdisk_lock);
 
   // the spec says that legacy block operations use three
@@ -258,6 +264,7 @@ virtio_disk_rw(int n, struct buf *b, int write)
   free_chain(n, idx[0]);
 
   release(&disk[n].vdisk_lock);
+  TRACE(TR_DISK_END, b->blockno);
 }
 
 void
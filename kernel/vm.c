@@ -6,13 +6,20 @@
 #include "defs.h"
 #include "fs.h"
 #include "spinlock.h"
+#include "rusage.h"
 #include "proc.h"
+#include "stats.h"
+#include "klog.h"
 
 /*
  * the kernel's page table.
  */
 pagetable_t kernel_pagetable;
 
+// the largest ASID the hardware supports, or 0 if it
+// has none; see usersatp().
+uint maxasid;
+
 extern char etext[]; // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
@@ -59,6 +66,10 @@ void kvminit()
 // and enable paging.
 void kvminithart()
 {
+    // find out how many ASID bits are implemented, by writing
+    // all ones and seeing which stick. the kernel uses ASID 0.
+    w_satp(MAKE_SATP(kernel_pagetable) | SATP_ASID(SATP_ASIDMAX));
+    maxasid = (r_satp() >> 44) & SATP_ASIDMAX;
     w_satp(MAKE_SATP(kernel_pagetable));
     sfence_vma();
 }
@@ -184,11 +195,9 @@ kvmpa(uint64 va)
     return pa + off;
 }
 
-// Create PTEs for virtual addresses starting at va that refer to
-// physical addresses starting at pa. va and size might not
-// be page-aligned. Returns 0 on success, -1 if walk() couldn't
-// allocate a needed page-table page.
-int mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
+// mappages() without the TLB flush, for callers that flush a
+// whole range at the end, or whose page table no one runs yet.
+static int mapnoflush(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 {
     uint64 a, last;
     pte_t *pte;
@@ -220,6 +229,18 @@ int mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
     return 0;
 }
 
+// Create PTEs for virtual addresses starting at va that refer to
+// physical addresses starting at pa. va and size might not
+// be page-aligned. Returns 0 on success, -1 if walk() couldn't
+// allocate a needed page-table page.
+int mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
+{
+    if (mapnoflush(pagetable, va, size, pa, perm) != 0)
+        return -1;
+    tlbinval(pagetable, va, size);
+    return 0;
+}
+
 // Remove mappings from a page table. The mappings in
 // the given range must exist. Optionally free the
 // physical memory.
@@ -263,6 +284,36 @@ void uvmunmap(pagetable_t pagetable, uint64 va, uint64 size, int do_free)
         a += PGSIZE;
         pa += PGSIZE;
     }
+    tlbinval(pagetable, va, size);
+}
+
+// Like uvmunmap(pagetable, va, size, 1), for a page table that
+// threads on other CPUs may be using, which could still reach
+// a page through their TLBs: the pages are freed with
+// kfree_rcu(), each once its mapping is gone. Unmaps from the
+// top down, and stops if too many pages are already waiting.
+// Returns the end of what is still mapped, which is va when
+// it's all gone. va and size must be page-aligned.
+uint64 uvmunmaprcu(pagetable_t pagetable, uint64 va, uint64 size)
+{
+    uint64 a;
+    pte_t *pte, old;
+
+    for (a = va + size; a > va; a -= PGSIZE)
+    {
+        if ((pte = walk(pagetable, a - PGSIZE, 0)) == 0 || (*pte & PTE_V) == 0)
+            continue;
+        old = *pte;
+        *pte = 0;
+        tlbinval(pagetable, a - PGSIZE, PGSIZE);
+        if (kfree_rcu((void *)PTE2PA(old)) < 0)
+        {
+            // the page was never freed; put it back.
+            *pte = old;
+            break;
+        }
+    }
+    return a;
 }
 
 // create an empty user page table.
@@ -314,13 +365,15 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
             return 0;
         }
         memset(mem, 0, PGSIZE);
-        if (mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_W | PTE_X | PTE_R | PTE_U) != 0)
+        if (mapnoflush(pagetable, a, PGSIZE, (uint64)mem, PTE_W | PTE_X | PTE_R | PTE_U) != 0)
         {
             kfree(mem);
             uvmdealloc(pagetable, a, oldsz);
             return 0;
         }
     }
+    if (newsz > oldsz)
+        tlbinval(pagetable, oldsz, newsz - oldsz);
     return newsz;
 }
 
@@ -416,6 +469,8 @@ void free_pagetable(pagetable_t pagetable, uint64 va)
         }
     }
 
+    // page-table pages themselves may be cached.
+    tlbinval(pagetable, 0, 0);
     return;
 }
 
@@ -448,7 +503,8 @@ freewalk(pagetable_t pagetable)
 // then free page-table pages.
 void uvmfree(pagetable_t pagetable, uint64 sz)
 {
-    uvmunmap(pagetable, 0, sz, 1);
+    if (sz > 0)
+        uvmunmap(pagetable, 0, sz, 1);
     freewalk(pagetable);
 }
 
@@ -463,7 +519,6 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
 {
   pte_t *pte;
   uint64 pa, i;
-  uint8 count_old;
   uint perm;
   uint64 pte_w_clear;
 
@@ -480,17 +535,24 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
     pa = PTE2PA(*pte);
     pte_w_clear = ~0 - PTE_W;
     perm = PTE_FLAGS(*pte);
-    perm |= PTE_COW;         // set COW bit
-    perm &= pte_w_clear;     // clear the PTE_W
-    *pte = ((*pte >> 8) << 8) | perm; // change the parent process's permission bits
+    // read-only pages (e.g. shared program text) stay read-only.
+    if (perm & (PTE_W | PTE_COW))
+    {
+        perm |= PTE_COW;         // set COW bit
+        perm &= pte_w_clear;     // clear the PTE_W
+        *pte = ((*pte >> 8) << 8) | perm; // change the parent process's permission bits
+    }
 
-    count_old = get_ref_count((uint8 *)pa);
-    set_ref_count((uint8 *)pa, count_old +1); // increment the ref count for each page
-    if(mappages(new, i, PGSIZE, (uint64)pa, perm) != 0)
+    add_ref_count((uint8 *)pa, 1); // increment the ref count for each page
+    // no one runs on new yet.
+    if(mapnoflush(new, i, PGSIZE, (uint64)pa, perm) != 0)
     {
+      tlbinval(old, 0, 0);
       return -1;
     }
     }
+    // the parent's writable pages just became read-only.
+    tlbinval(old, 0, 0);
     return 0;
 }
 
@@ -504,6 +566,7 @@ void uvmclear(pagetable_t pagetable, uint64 va)
     if (pte == 0)
         panic("uvmclear");
     *pte &= ~PTE_U;
+    tlbinval(pagetable, va, PGSIZE);
 }
 
 // Map the PTE to newly allocated physical pages, set the PTE_W and clear PTE_COW
@@ -522,6 +585,7 @@ int map_cow_page(pagetable_t page_table, uint64 va, uint64 pa)
   perm = PTE_FLAGS(*pte) | PTE_W;     // set the PTE_W for newly allocated page
   perm = perm & pte_cow_clear;             // remove COW bit for newly allocated page
   *pte = PA2PTE(pa) | perm | PTE_V;
+  tlbinval(page_table, va, PGSIZE);
   return 0;
 }
 
@@ -537,6 +601,8 @@ int handle_cow_page(struct proc* p, uint64 va_faulted, pte_t *pte)
 {
     uint8 ref_count;
     uint64 pa = PTE2PA(*pte);
+    statadd(STAT_FAULT_COW, 1);
+    p->ru.ru_minflt++;
     ref_count = get_ref_count((uint8 *)pa);
     // only one process is using this page, clear COW bit and restore W bit
     if(ref_count == 1)
@@ -546,23 +612,28 @@ int handle_cow_page(struct proc* p, uint64 va_faulted, pte_t *pte)
       perm |= PTE_W;          // restore the PTE_W
       perm &= pte_cow_clear;  // clear the PTE_COW
       *pte = PA2PTE(pa) | perm | PTE_V;
+      tlbinval(p->pagetable, va_faulted, PGSIZE);
     }
     else
     {
       char *mem;
       if ((mem = kalloc()) == 0)
       {
-        printf("handle_cow_page(): failed to allocate more physical memory for copy-on-write page!\n");
+        klog_ratelimited(KL_ERR, "handle_cow_page(): failed to allocate more physical memory for copy-on-write page!\n");
         return -1;
       }
-      set_ref_count((uint8 *)pa, ref_count - 1);
       memmove(mem, (char *)pa, PGSIZE);
+      statadd(STAT_COW_COPY, 1);
+      p->ru.ru_cowcopy++;
       if (map_cow_page(p->pagetable, va_faulted, (uint64)mem) != 0)
       {
           kfree(mem);
-          printf("handle_cow_page(): failed to map pages for copy-on-write page!\n");
+          klog_ratelimited(KL_ERR, "handle_cow_page(): failed to map pages for copy-on-write page!\n");
           return -1;
       }
+      // drop our reference only after copying, and with kfree(),
+      // in case the other sharers dropped theirs meanwhile.
+      kfree((void *)pa);
     }
     return 0;
 }
@@ -575,36 +646,40 @@ int copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
     uint64 n, va0, pa0;
     while (len > 0)
     {
-        if (dstva > TRAPFRAME)
+        // the trapframes of clone() threads live below TRAPFRAME.
+        if (dstva >= THREADFRAME(NPROC - 1))
         {
             return -1;
         }
         va0 = PGROUNDDOWN(dstva);
         pte_t *pte;
-        if ((pte = walk(pagetable, dstva, 0)) != 0)
+        // fault in a lazy page first: pages of the program
+        // image may arrive copy-on-write.
+        if (walkaddr(pagetable, va0) == 0)
         {
-            if ((*pte & PTE_COW) && (*pte & PTE_V))
+            if(handle_lazy_allocation(myproc(), va0) != 0)
             {
-                if(handle_cow_page(myproc(), va0, pte) != 0)
-                {
-                    return -1;
-                }
+                return -1;
             }
-
         }
-        pa0 = walkaddr(pagetable, va0);
-        if (pa0 == -1)
+        pte = walk(pagetable, va0, 0);
+        if ((*pte & PTE_U) == 0)
         {
-            return - 1;
+            return -1;
         }
-        if (pa0 == 0)
+        if (*pte & PTE_COW)
         {
-            if(handle_lazy_allocation(myproc(), va0) != 0)
+            if(handle_cow_page(myproc(), va0, pte) != 0)
             {
                 return -1;
             }
-            pa0 = walkaddr(pagetable, va0);
         }
+        else if ((*pte & PTE_W) == 0)
+        {
+            // e.g. shared program text.
+            return -1;
+        }
+        pa0 = walkaddr(pagetable, va0);
         n = PGSIZE - (dstva - va0);
         if (n > len)
             n = len;
@@ -634,7 +709,10 @@ int copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
         pa0 = walkaddr(pagetable, va0);
         if (pa0 == 0)
         {
-            handle_lazy_allocation(myproc(), va0);
+            if (handle_lazy_allocation(myproc(), va0) != 0)
+            {
+                return -1;
+            }
             pa0 = walkaddr(pagetable, va0);
         }
         n = PGSIZE - (srcva - va0);
@@ -663,7 +741,11 @@ int copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
         va0 = PGROUNDDOWN(srcva);
         pa0 = walkaddr(pagetable, va0);
         if (pa0 == 0)
-            return -1;
+        {
+            if (srcva >= myproc()->sz || handle_lazy_allocation(myproc(), va0) != 0)
+                return -1;
+            pa0 = walkaddr(pagetable, va0);
+        }
         n = PGSIZE - (srcva - va0);
         if (n > max)
             n = max;
@@ -737,27 +819,73 @@ int handle_store_fault(struct proc* p, uint64 va_faulted)
  */
 int handle_lazy_allocation(struct proc *p, uint64 va_faulted)
 {
-    uint64 va_page;
+    uint64 va_page, inblock;
     char *mem;
+    int r;
     if (va_faulted > p->sz)
     {
-        printf("Invalid memory access, try to access memory: %p higher than proc->sz:%p\n", va_faulted, p->sz);
+        klog_ratelimited(KL_WARN, "Invalid memory access, try to access memory: %p higher than proc->sz:%p\n", va_faulted, p->sz);
         return -1;
     }
 
     va_page = PGROUNDDOWN(va_faulted);
+    // a fault on a mapped page is a protection fault.
+    if (walkaddr(p->pagetable, va_page) != 0)
+    {
+        return -1;
+    }
+    // pages of the program image come from its file,
+    // if they aren't in the page cache already.
+    inblock = p->ru.ru_inblock;
+    if ((r = execfault(p, va_page)) <= 0)
+    {
+        if (r == 0)
+        {
+            statadd(STAT_FAULT_EXEC, 1);
+            if (p->ru.ru_inblock != inblock)
+                p->ru.ru_majflt++;
+            else
+                p->ru.ru_minflt++;
+        }
+        return r;
+    }
     mem = kalloc();
     if (mem == 0)
     {
-        printf("Running out of physical memory!\n");
+        klog_ratelimited(KL_ERR, "Running out of physical memory!\n");
         return -1;
     }
     memset(mem, 0, PGSIZE);
     if (mappages(p->pagetable, va_page, PGSIZE, (uint64)mem, PTE_W | PTE_X | PTE_R | PTE_U) != 0)
     {
         kfree(mem);
-        printf("mapages failed!\n");
+        klog_ratelimited(KL_ERR, "mapages failed!\n");
         return -1;
     }
+    statadd(STAT_FAULT_ZERO, 1);
+    p->ru.ru_minflt++;
     return 0;
-}
\ No newline at end of file
+}
+
+// Return the physical address that backs user virtual
+// address va in p, allocating a lazily-allocated page if
+// need be. Return 0 if va isn't in p's user memory or its
+// system call ring.
+uint64
+useraddr(struct proc *p, uint64 va)
+{
+    pte_t *pte;
+
+    if (va >= p->sz && PGROUNDDOWN(va) != SYSRING)
+        return 0;
+    pte = walk(p->pagetable, va, 0);
+    if (pte == 0 || (*pte & PTE_V) == 0)
+    {
+        if (handle_lazy_allocation(p, va) != 0)
+            return 0;
+        pte = walk(p->pagetable, va, 0);
+    }
+    if ((*pte & PTE_U) == 0)
+        return 0;
+    return PTE2PA(*pte) + (va - PGROUNDDOWN(va));
+}
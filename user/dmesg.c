@@ -0,0 +1,80 @@
+//
+// print the kernel log, oldest message first, each line
+// prefixed with when it was logged, in seconds since boot.
+//
+// usage: dmesg [-l level]
+//   -l  print only messages at level or more urgent:
+//       0 errors, 1 warnings, 2 info (printf), 3 debug (default)
+//
+
+#include "kernel/types.h"
+#include "kernel/klog.h"
+#include "user/user.h"
+
+#define NMSG 64   // messages read at a time
+
+struct klogmsg msgs[NMSG];
+
+char *levelname[NKLEVEL] = {
+[KL_ERR]   "err: ",
+[KL_WARN]  "warn: ",
+[KL_INFO]  "",
+[KL_DEBUG] "debug: ",
+};
+
+// print x in decimal, zero-padded to width digits.
+void
+printpad(uint64 x, int width)
+{
+  char buf[24];
+  int i;
+
+  for(i = 0; i < width || x; i++, x /= 10)
+    buf[i] = '0' + x % 10;
+  while(--i >= 0)
+    printf("%c", buf[i]);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct klogmsg *m;
+  uint64 seq;
+  int i, n, len, level, bol;
+
+  level = KL_DEBUG;
+  if(argc > 2 && strcmp(argv[1], "-l") == 0){
+    level = atoi(argv[2]);
+  } else if(argc > 1){
+    fprintf(2, "usage: dmesg [-l level]\n");
+    exit(1);
+  }
+
+  seq = 0;
+  bol = 1;
+  while((n = dmesg(msgs, NMSG, seq)) > 0){
+    for(i = 0; i < n; i++){
+      m = &msgs[i];
+      seq = m->seq + 1;
+      if(m->level > level)
+        continue;
+      // a message may be the rest of a line.
+      if(bol){
+        // time is in 0.1us ticks.
+        printf("[%d.", (int)(m->time / 10000000));
+        printpad(m->time / 10 % 1000000, 6);
+        printf("] %s", m->level < NKLEVEL ? levelname[m->level] : "");
+      }
+      printf("%s", m->text);
+      len = strlen(m->text);
+      bol = len > 0 && m->text[len-1] == '\n';
+    }
+  }
+  if(n < 0){
+    fprintf(2, "dmesg: failed\n");
+    exit(1);
+  }
+  if(!bol)
+    printf("\n");
+  exit(0);
+}
@@ -21,6 +21,10 @@ main(void)
   }
   dup(0);  // stdout
   dup(0);  // stderr
+
+  // kernel statistics, as text and as a struct kstats.
+  mknod("stats", 2, 0);
+  mknod("statsbin", 2, 1);
   // vmprint(myproc()->pagetable);
   for(;;){
     printf("init: starting sh\n");
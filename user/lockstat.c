@@ -0,0 +1,63 @@
+//
+// print the kernel locks that processes waited longest for,
+// with the call sites that took them. pcs can be looked up
+// in kernel/kernel.asm.
+//
+// usage: lockstat [-r] [n]
+//   -r  reset the statistics instead
+//   n   how many locks to show (default 10)
+//
+
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/lockstat.h"
+#include "user/user.h"
+
+int
+main(int argc, char *argv[])
+{
+  struct lockstat *st, t;
+  int i, j, n, max, top;
+
+  top = 10;
+  if(argc > 1 && strcmp(argv[1], "-r") == 0){
+    ntas(0);
+    exit(0);
+  }
+  if(argc > 1)
+    top = atoi(argv[1]);
+
+  // the number of locks can change between the calls.
+  max = lockstat(0, 0) + 16;
+  st = malloc(max * sizeof(*st));
+  if(st == 0){
+    fprintf(2, "lockstat: out of memory\n");
+    exit(1);
+  }
+  n = lockstat(st, max);
+  if(n < 0){
+    fprintf(2, "lockstat: failed\n");
+    exit(1);
+  }
+  if(n > max)
+    n = max;
+
+  // sort by time spent waiting, most first.
+  for(i = 0; i < n; i++){
+    for(j = i+1; j < n; j++){
+      if(st[j].waittime > st[i].waittime){
+        t = st[i];
+        st[i] = st[j];
+        st[j] = t;
+      }
+    }
+  }
+
+  for(i = 0; i < n && i < top; i++){
+    printf("%s: %l acquires, %l spins, wait %l, hold %l\n", st[i].name,
+           st[i].n, st[i].nspin, st[i].waittime, st[i].holdtime);
+    for(j = 0; j < NLOCKPC && st[i].pcs[j]; j++)
+      printf("    %p %l\n", st[i].pcs[j], st[i].npcs[j]);
+  }
+  exit(0);
+}
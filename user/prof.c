@@ -0,0 +1,278 @@
+//
+// profile a command with the kernel's sampling profiler,
+// and print where it spent its time.
+//
+// usage: prof [-f] [-u symfile] command args...
+//   -f  print folded stacks ("a;b;c count" lines, as taken by
+//       flame graph tools) instead of a flat profile
+//   -u  name user pcs with symfile, e.g. ls.sym from the build;
+//       kernel pcs are named with kernel.sym
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/prof.h"
+#include "user/user.h"
+
+#define MAXSAMP  4096
+#define MAXNAMES 512    // distinct functions or stacks counted
+
+struct profsample samples[MAXSAMP];
+
+struct symtab {
+  int n;
+  uint64 *addr;
+  char **name;
+};
+
+struct symtab ksyms, usyms;
+
+struct {
+  char *name;
+  int count;
+} counts[MAXNAMES];
+int ncounts;
+
+// parse a hex number, stopping at the first non-digit.
+uint64
+atox(char *s, char **end)
+{
+  uint64 x = 0;
+  int d;
+
+  for(;; s++){
+    if(*s >= '0' && *s <= '9')
+      d = *s - '0';
+    else if(*s >= 'a' && *s <= 'f')
+      d = *s - 'a' + 10;
+    else
+      break;
+    x = x*16 + d;
+  }
+  *end = s;
+  return x;
+}
+
+// read a symbol table as written by the Makefile:
+// "address name" lines, as printed by objdump -t.
+// Returns 0, or -1 if it can't be read.
+int
+loadsyms(char *path, struct symtab *t)
+{
+  struct stat st;
+  char *buf, *p, *e, *q;
+  uint64 a;
+  char *s;
+  int fd, i, j, gap, nlines;
+
+  if((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0)
+    return -1;
+  buf = malloc(st.size + 1);
+  if(buf == 0 || read(fd, buf, st.size) != st.size){
+    close(fd);
+    return -1;
+  }
+  close(fd);
+  buf[st.size] = 0;
+
+  nlines = 0;
+  for(p = buf; *p; p++)
+    if(*p == '\n')
+      nlines++;
+  t->addr = malloc((nlines + 1) * sizeof(uint64));
+  t->name = malloc((nlines + 1) * sizeof(char *));
+  t->n = 0;
+  for(p = buf; *p; p = e + 1){
+    for(e = p; *e && *e != '\n'; e++)
+      ;
+    a = atox(p, &q);
+    if(*q == ' ' && q + 1 < e){
+      t->addr[t->n] = a;
+      t->name[t->n] = q + 1;
+      t->n++;
+    }
+    if(*e == 0)
+      break;
+    *e = 0;
+  }
+
+  // sort by address.
+  for(gap = t->n/2; gap > 0; gap /= 2){
+    for(i = gap; i < t->n; i++){
+      a = t->addr[i];
+      s = t->name[i];
+      for(j = i; j >= gap && t->addr[j-gap] > a; j -= gap){
+        t->addr[j] = t->addr[j-gap];
+        t->name[j] = t->name[j-gap];
+      }
+      t->addr[j] = a;
+      t->name[j] = s;
+    }
+  }
+  return 0;
+}
+
+// the name of the symbol at or before pc.
+char*
+lookup(struct symtab *t, uint64 pc)
+{
+  int lo, hi, mid;
+
+  if(t->n == 0 || pc < t->addr[0])
+    return "?";
+  lo = 0;
+  hi = t->n - 1;
+  while(lo < hi){
+    mid = (lo + hi + 1) / 2;
+    if(t->addr[mid] <= pc)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+  return t->name[lo];
+}
+
+void
+count(char *name)
+{
+  int i;
+
+  for(i = 0; i < ncounts; i++){
+    if(strcmp(counts[i].name, name) == 0){
+      counts[i].count++;
+      return;
+    }
+  }
+  // when the table is full, lump the rest together.
+  if(ncounts == MAXNAMES){
+    i = MAXNAMES - 1;
+    name = "(other)";
+  } else {
+    ncounts++;
+  }
+  counts[i].name = name;
+  counts[i].count++;
+}
+
+// append s to the n-byte buffer buf.
+void
+append(char *buf, int n, char *s)
+{
+  int len = strlen(buf);
+
+  while(*s && len < n - 1)
+    buf[len++] = *s++;
+  buf[len] = 0;
+}
+
+// the stack of sample s, outermost caller first.
+char*
+folded(struct profsample *s)
+{
+  struct symtab *t = s->user ? &usyms : &ksyms;
+  char buf[512], *r;
+  int i;
+
+  buf[0] = 0;
+  append(buf, sizeof(buf), s->user ? "user" : "kernel");
+  for(i = s->depth - 1; i >= 0; i--){
+    append(buf, sizeof(buf), ";");
+    // return addresses point just past the call.
+    append(buf, sizeof(buf), lookup(t, i > 0 ? s->pc[i] - 1 : s->pc[i]));
+  }
+  r = malloc(strlen(buf) + 1);
+  strcpy(r, buf);
+  return r;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fold, i, j, n, r, pid, dropped;
+  char *usym;
+
+  fold = 0;
+  usym = 0;
+  while(argc > 1 && argv[1][0] == '-'){
+    if(strcmp(argv[1], "-f") == 0){
+      fold = 1;
+    } else if(strcmp(argv[1], "-u") == 0 && argc > 2){
+      usym = argv[2];
+      argc--;
+      argv++;
+    } else {
+      break;
+    }
+    argc--;
+    argv++;
+  }
+  if(argc < 2){
+    fprintf(2, "usage: prof [-f] [-u symfile] command args...\n");
+    exit(1);
+  }
+  if(loadsyms("kernel.sym", &ksyms) < 0)
+    fprintf(2, "prof: no kernel.sym\n");
+  if(usym && loadsyms(usym, &usyms) < 0)
+    fprintf(2, "prof: cannot read %s\n", usym);
+
+  profile(PROF_START, 0, 0);
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "prof: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    exec(argv[1], argv + 1);
+    fprintf(2, "prof: exec %s failed\n", argv[1]);
+    exit(1);
+  }
+  wait(0);
+  dropped = profile(PROF_STOP, 0, 0);
+
+  n = r = 0;
+  while(n < MAXSAMP && (r = profile(PROF_READ, samples + n, MAXSAMP - n)) > 0)
+    n += r;
+  if(r < 0){
+    fprintf(2, "prof: reading samples failed\n");
+    exit(1);
+  }
+  if(dropped)
+    fprintf(2, "prof: %d samples dropped\n", dropped);
+
+  for(i = 0; i < n; i++){
+    // symfile only describes the command's own program.
+    if(samples[i].user && samples[i].pid != pid)
+      count("(other process)");
+    else if(fold)
+      count(folded(&samples[i]));
+    else if(samples[i].user)
+      count(lookup(&usyms, samples[i].pc[0]));
+    else
+      count(lookup(&ksyms, samples[i].pc[0]));
+  }
+
+  if(fold){
+    for(i = 0; i < ncounts; i++)
+      printf("%s %d\n", counts[i].name, counts[i].count);
+    exit(0);
+  }
+
+  // flat profile, most samples first.
+  for(i = 0; i < ncounts; i++){
+    for(j = i+1; j < ncounts; j++){
+      if(counts[j].count > counts[i].count){
+        char *name = counts[i].name;
+        int c = counts[i].count;
+        counts[i] = counts[j];
+        counts[j].name = name;
+        counts[j].count = c;
+      }
+    }
+  }
+  printf("%d samples\n", n);
+  for(i = 0; i < ncounts; i++)
+    printf("%d\t%d%%\t%s\n", counts[i].count, counts[i].count * 100 / n,
+           counts[i].name);
+  exit(0);
+}
@@ -52,6 +52,7 @@ struct backcmd {
 int fork1(void);  // Fork but panics on failure.
 void panic(char*);
 struct cmd *parsecmd(char*);
+int spawncmd(char*);
 
 // Execute cmd.  Never returns.
 void
@@ -164,7 +165,7 @@ main(void)
         fprintf(2, "cannot cd %s\n", buf+3);
       continue;
     }
-    if(fork1() == 0)
+    if(spawncmd(buf) < 0 && fork1() == 0)
       runcmd(parsecmd(buf));
     wait(0);
   }
@@ -491,3 +492,34 @@ nulterminate(struct cmd *cmd)
   }
   return cmd;
 }
+
+// Start buf with spawn() if it is a plain command with
+// no redirection, pipes or lists, which spares the shell
+// a fork(). Returns -1 if buf needs fork() and runcmd().
+int
+spawncmd(char *buf)
+{
+  char *s;
+  int nargs, inword;
+  struct execcmd *ecmd;
+
+  nargs = inword = 0;
+  for(s = buf; *s; s++){
+    if(strchr(symbols, *s))
+      return -1;
+    if(strchr(whitespace, *s))
+      inword = 0;
+    else if(!inword){
+      inword = 1;
+      nargs++;
+    }
+  }
+  if(nargs == 0 || nargs >= MAXARGS)
+    return -1;
+
+  ecmd = (struct execcmd*)parsecmd(buf);
+  if(spawn(ecmd->argv[0], ecmd->argv, 0) < 0)
+    fprintf(2, "exec %s failed\n", ecmd->argv[0]);
+  free(ecmd);
+  return 0;
+}
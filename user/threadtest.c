@@ -0,0 +1,252 @@
+//
+// tests for clone(), join() and the futex-based
+// synchronization in ulib.c.
+//
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define NTHREAD 4
+#define NITER   10000
+
+volatile int counter;
+volatile int spin;
+
+void
+adder(void *arg)
+{
+  int i;
+
+  for(i = 0; i < NITER; i++)
+    __sync_fetch_and_add(&counter, 1);
+  exit(0);
+}
+
+// threads share memory: each adds to one counter,
+// and the creator sees every update after join().
+void
+sharetest()
+{
+  void *stacks[NTHREAD], *stack;
+  int i, pid;
+
+  printf("share: ");
+  counter = 0;
+  for(i = 0; i < NTHREAD; i++){
+    stacks[i] = malloc(PGSIZE);
+    if(clone(adder, 0, stacks[i]) < 0){
+      printf("clone failed\n");
+      exit(-1);
+    }
+  }
+  for(i = 0; i < NTHREAD; i++){
+    pid = join(&stack);
+    if(pid < 0){
+      printf("join failed\n");
+      exit(-1);
+    }
+    free(stack);
+  }
+  if(join(&stack) != -1){
+    printf("join with no threads succeeded\n");
+    exit(-1);
+  }
+  if(counter != NTHREAD*NITER){
+    printf("counter %d, expected %d\n", counter, NTHREAD*NITER);
+    exit(-1);
+  }
+  printf("ok\n");
+}
+
+struct mutex lock;
+int total;
+
+void
+locker(void *arg)
+{
+  int i;
+
+  for(i = 0; i < NITER; i++){
+    mutex_lock(&lock);
+    total++;
+    mutex_unlock(&lock);
+  }
+  exit(0);
+}
+
+// a mutex keeps plain read-modify-writes from racing.
+void
+mutextest()
+{
+  int i;
+
+  printf("mutex: ");
+  mutex_init(&lock);
+  total = 0;
+  for(i = 0; i < NTHREAD; i++){
+    if(clone(locker, 0, malloc(PGSIZE)) < 0){
+      printf("clone failed\n");
+      exit(-1);
+    }
+  }
+  for(i = 0; i < NTHREAD; i++)
+    join(0);
+  if(total != NTHREAD*NITER){
+    printf("total %d, expected %d\n", total, NTHREAD*NITER);
+    exit(-1);
+  }
+  printf("ok\n");
+}
+
+#define NSLOT 4
+
+struct cond notempty, notfull;
+int slots[NSLOT];
+int nput, nget;
+
+void
+producer(void *arg)
+{
+  int i;
+
+  for(i = 1; i <= NITER; i++){
+    mutex_lock(&lock);
+    while(nput - nget == NSLOT)
+      cond_wait(&notfull, &lock);
+    slots[nput++ % NSLOT] = i;
+    cond_signal(&notempty);
+    mutex_unlock(&lock);
+  }
+  exit(0);
+}
+
+// a producer thread hands values to its creator through
+// a small buffer guarded by condition variables.
+void
+condtest()
+{
+  int i, v;
+
+  printf("cond: ");
+  mutex_init(&lock);
+  cond_init(&notempty);
+  cond_init(&notfull);
+  nput = nget = 0;
+  if(clone(producer, 0, malloc(PGSIZE)) < 0){
+    printf("clone failed\n");
+    exit(-1);
+  }
+  for(i = 1; i <= NITER; i++){
+    mutex_lock(&lock);
+    while(nput == nget)
+      cond_wait(&notempty, &lock);
+    v = slots[nget++ % NSLOT];
+    cond_signal(&notfull);
+    mutex_unlock(&lock);
+    if(v != i){
+      printf("got %d, expected %d\n", v, i);
+      exit(-1);
+    }
+  }
+  join(0);
+  printf("ok\n");
+}
+
+#define NROUND 100
+
+struct barrier bar;
+int arrived[NROUND];
+int leaders;
+
+void
+stepper(void *arg)
+{
+  int r;
+
+  for(r = 0; r < NROUND; r++){
+    __sync_fetch_and_add(&arrived[r], 1);
+    if(barrier_wait(&bar))
+      __sync_fetch_and_add(&leaders, 1);
+    // everyone has arrived at round r by now.
+    if(arrived[r] != NTHREAD){
+      printf("round %d: %d arrived\n", r, arrived[r]);
+      exit(-1);
+    }
+  }
+  exit(0);
+}
+
+// no thread passes a barrier until all have reached it,
+// and exactly one per round is told it was last.
+void
+barriertest()
+{
+  int i;
+
+  printf("barrier: ");
+  barrier_init(&bar, NTHREAD);
+  memset(arrived, 0, sizeof(arrived));
+  leaders = 0;
+  for(i = 0; i < NTHREAD; i++){
+    if(clone(stepper, 0, malloc(PGSIZE)) < 0){
+      printf("clone failed\n");
+      exit(-1);
+    }
+  }
+  for(i = 0; i < NTHREAD; i++)
+    join(0);
+  if(leaders != NROUND){
+    printf("%d leaders, expected %d\n", leaders, NROUND);
+    exit(-1);
+  }
+  printf("ok\n");
+}
+
+void
+spinner(void *arg)
+{
+  *(int*)arg = 1;
+  for(;;)
+    spin++;
+}
+
+// a process that exits takes its running threads
+// with it, and wait() in the parent still works.
+void
+exittest()
+{
+  int pid, xstatus;
+  volatile int started = 0;
+
+  printf("exit: ");
+  pid = fork();
+  if(pid < 0){
+    printf("fork failed\n");
+    exit(-1);
+  }
+  if(pid == 0){
+    if(clone(spinner, (void*)&started, malloc(PGSIZE)) < 0)
+      exit(-1);
+    while(started == 0)
+      ;
+    exit(7);
+  }
+  if(wait(&xstatus) != pid || xstatus != 7){
+    printf("wait failed\n");
+    exit(-1);
+  }
+  printf("ok\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  sharetest();
+  mutextest();
+  condtest();
+  barriertest();
+  exittest();
+  printf("ALL THREAD TESTS PASSED\n");
+  exit(0);
+}
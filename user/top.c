@@ -0,0 +1,109 @@
+//
+// show the processes using the most CPU time, with their
+// page faults and disk I/O, refreshing periodically.
+//
+// usage: top [-d ticks] [count]
+//   -d     time between refreshes, in ticks (default 10)
+//   count  how many times to refresh (default 1)
+//
+
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/rusage.h"
+#include "user/user.h"
+
+struct procinfo cur[NPROC], prev[NPROC];
+int ncur, nprev;
+int pct[NPROC];
+
+uint64
+cputime(struct procinfo *pi)
+{
+  return pi->ru.ru_utime + pi->ru.ru_stime;
+}
+
+// CPU time pi used since the last refresh.
+uint64
+recent(struct procinfo *pi)
+{
+  int i;
+
+  for(i = 0; i < nprev; i++)
+    if(prev[i].pid == pi->pid)
+      return cputime(pi) - cputime(&prev[i]);
+  return cputime(pi);
+}
+
+int
+snapshot(void)
+{
+  int n;
+
+  n = getprocs(cur, NPROC);
+  if(n < 0){
+    fprintf(2, "top: getprocs failed\n");
+    exit(1);
+  }
+  return n < NPROC ? n : NPROC;
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct procinfo t;
+  int delay, count, i, j, k, start, now, ct;
+
+  delay = 10;
+  count = 1;
+  if(argc > 2 && strcmp(argv[1], "-d") == 0){
+    delay = atoi(argv[2]);
+    argc -= 2;
+    argv += 2;
+  }
+  if(argc > 1)
+    count = atoi(argv[1]);
+  if(delay <= 0)
+    delay = 1;
+
+  ncur = snapshot();
+  start = uptime();
+  for(k = 0; k < count; k++){
+    memmove(prev, cur, sizeof(cur));
+    nprev = ncur;
+    sleep(delay);
+    ncur = snapshot();
+    now = uptime();
+
+    // percent of one CPU since the last refresh.
+    for(i = 0; i < ncur; i++)
+      pct[i] = recent(&cur[i]) * 100 / ((uint64)(now - start) * RU_PER_TICK);
+    start = now;
+
+    for(i = 0; i < ncur; i++){
+      for(j = i+1; j < ncur; j++){
+        if(pct[j] > pct[i] ||
+           (pct[j] == pct[i] && cputime(&cur[j]) > cputime(&cur[i]))){
+          t = cur[i];
+          cur[i] = cur[j];
+          cur[j] = t;
+          ct = pct[i];
+          pct[i] = pct[j];
+          pct[j] = ct;
+        }
+      }
+    }
+
+    printf("%d processes, up %d ticks\n", ncur, now);
+    printf("pid\tppid\tstate\t%%cpu\tms\tkb\tminflt\tmajflt\tin\tout\tname\n");
+    for(i = 0; i < ncur; i++){
+      printf("%d\t%d\t%s\t%d\t%l\t%l\t%l\t%l\t%l\t%l\t%s\n",
+             cur[i].pid, cur[i].ppid, cur[i].state, pct[i],
+             cputime(&cur[i]) / (RU_PER_TICK / 100), cur[i].sz / 1024,
+             cur[i].ru.ru_minflt, cur[i].ru.ru_majflt,
+             cur[i].ru.ru_inblock, cur[i].ru.ru_oublock, cur[i].name);
+    }
+    if(k < count - 1)
+      printf("\n");
+  }
+  exit(0);
+}
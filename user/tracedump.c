@@ -0,0 +1,187 @@
+//
+// trace kernel events while a command runs, save them to a
+// file, and print histograms of how long system calls, traps,
+// disk requests and log commits took.
+//
+// usage: tracedump [-o file] [command args...]
+//   with no command, just collect what the kernel has recorded
+//   since tracing was last started.
+//
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "kernel/trace.h"
+#include "user/user.h"
+
+#define MAXEV    8192
+#define NPENDING 64    // unmatched start events remembered
+#define NBIN     32    // log2 latency bins
+
+struct traceevent ev[MAXEV];
+
+// start events waiting for their end.
+struct {
+  int type;
+  uint64 key;
+  uint64 time;
+} pending[NPENDING];
+int nextpending;
+
+char *histname[NTRTYPE] = {
+[TR_SYSCALL]  "system calls",
+[TR_TRAP]     "traps from user space",
+[TR_KTRAP]    "traps in the kernel",
+[TR_DISK]     "disk requests",
+[TR_COMMIT]   "log commits",
+};
+uint hist[NTRTYPE][NBIN];
+
+// what pairs a start event with its end: the process for
+// system calls and traps, the block for disk requests, and
+// the device for commits.
+uint64
+evkey(struct traceevent *e)
+{
+  switch(e->type){
+  case TR_SYSCALL: case TR_SYSCALL_END:
+  case TR_TRAP: case TR_TRAP_END:
+    return e->pid;
+  case TR_KTRAP: case TR_KTRAP_END:
+    return e->pid ? e->pid : 100000 + e->cpu;
+  default:
+    return e->arg;
+  }
+}
+
+void
+tally(struct traceevent *e)
+{
+  uint64 key = evkey(e), d;
+  int i, start, bin;
+
+  switch(e->type){
+  case TR_SYSCALL: case TR_TRAP: case TR_KTRAP: case TR_DISK: case TR_COMMIT:
+    // a start without an end (e.g. exit()) is eventually
+    // overwritten.
+    for(i = 0; i < NPENDING; i++)
+      if(pending[i].type == e->type && pending[i].key == key)
+        break;
+    if(i == NPENDING)
+      i = nextpending++ % NPENDING;
+    pending[i].type = e->type;
+    pending[i].key = key;
+    pending[i].time = e->time;
+    return;
+  case TR_SYSCALL_END: case TR_TRAP_END: case TR_KTRAP_END:
+  case TR_DISK_END: case TR_COMMIT_END:
+    start = e->type - 1;
+    break;
+  default:
+    return;
+  }
+  for(i = 0; i < NPENDING; i++){
+    if(pending[i].type == start && pending[i].key == key){
+      d = e->time - pending[i].time;
+      for(bin = 0; bin < NBIN-1 && (d >> bin) > 1; bin++)
+        ;
+      hist[start][bin]++;
+      pending[i].type = 0;
+      return;
+    }
+  }
+}
+
+void
+printhist(int type)
+{
+  uint max, tot;
+  int i, j, first, last;
+
+  tot = max = 0;
+  first = -1;
+  last = 0;
+  for(i = 0; i < NBIN; i++){
+    tot += hist[type][i];
+    if(hist[type][i] > max)
+      max = hist[type][i];
+    if(hist[type][i]){
+      if(first < 0)
+        first = i;
+      last = i;
+    }
+  }
+  printf("%s: %d, in ticks of 0.1us\n", histname[type], tot);
+  if(tot == 0)
+    return;
+  // bin i holds times below 2^(i+1) ticks.
+  for(i = first; i <= last; i++){
+    printf("  < %d\t%d\t", 1 << (i+1), hist[type][i]);
+    for(j = 0; j < (hist[type][i] * 40 + max - 1) / max; j++)
+      printf("*");
+    printf("\n");
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  char *out = "trace.out";
+  struct traceevent t;
+  int i, j, n, r, fd, pid, gap;
+
+  if(argc > 2 && strcmp(argv[1], "-o") == 0){
+    out = argv[2];
+    argc -= 2;
+    argv += 2;
+  }
+
+  if(argc > 1){
+    trace(1);
+    pid = fork();
+    if(pid < 0){
+      fprintf(2, "tracedump: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      exec(argv[1], argv + 1);
+      fprintf(2, "tracedump: exec %s failed\n", argv[1]);
+      exit(1);
+    }
+    wait(0);
+    trace(0);
+  }
+
+  n = r = 0;
+  while(n < MAXEV && (r = traceread(ev + n, MAXEV - n)) > 0)
+    n += r;
+  if(r < 0){
+    fprintf(2, "tracedump: traceread failed\n");
+    exit(1);
+  }
+
+  // each CPU's events come in order; merge them by time.
+  for(gap = n/2; gap > 0; gap /= 2){
+    for(i = gap; i < n; i++){
+      t = ev[i];
+      for(j = i; j >= gap && ev[j-gap].time > t.time; j -= gap)
+        ev[j] = ev[j-gap];
+      ev[j] = t;
+    }
+  }
+
+  unlink(out);
+  fd = open(out, O_CREATE | O_WRONLY);
+  if(fd < 0 || write(fd, ev, n * sizeof(ev[0])) != n * sizeof(ev[0])){
+    fprintf(2, "tracedump: cannot write %s\n", out);
+    exit(1);
+  }
+  close(fd);
+  printf("%d events in %s\n", n, out);
+
+  for(i = 0; i < n; i++)
+    tally(&ev[i]);
+  for(i = 0; i < NTRTYPE; i++)
+    if(histname[i])
+      printhist(i);
+  exit(0);
+}
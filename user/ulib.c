@@ -1,6 +1,7 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "kernel/fcntl.h"
+#include "kernel/futex.h"
 #include "user/user.h"
 
 char*
@@ -134,3 +135,102 @@ memcpy(void *dst, const void *src, uint n)
 {
   return memmove(dst, src, n);
 }
+
+// Mutexes, condition variables and barriers for clone()
+// threads, built on futex().
+
+// m->state is 0 if unlocked, 1 if locked, and 2 if
+// locked with (perhaps) sleepers in futex().
+void
+mutex_init(struct mutex *m)
+{
+  m->state = 0;
+}
+
+void
+mutex_lock(struct mutex *m)
+{
+  int c;
+
+  if((c = __sync_val_compare_and_swap(&m->state, 0, 1)) == 0)
+    return;
+  if(c != 2)
+    c = __sync_lock_test_and_set(&m->state, 2);
+  while(c != 0){
+    futex(&m->state, FUTEX_WAIT, 2);
+    c = __sync_lock_test_and_set(&m->state, 2);
+  }
+}
+
+void
+mutex_unlock(struct mutex *m)
+{
+  if(__sync_fetch_and_sub(&m->state, 1) != 1){
+    __sync_lock_release(&m->state);
+    futex(&m->state, FUTEX_WAKE, 1);
+  }
+}
+
+void
+cond_init(struct cond *c)
+{
+  c->seq = 0;
+}
+
+// Release m, sleep until signalled, and re-acquire m.
+// May return spuriously; callers re-check their condition.
+void
+cond_wait(struct cond *c, struct mutex *m)
+{
+  int seq = c->seq;
+
+  mutex_unlock(m);
+  futex(&c->seq, FUTEX_WAIT, seq);
+  mutex_lock(m);
+}
+
+void
+cond_signal(struct cond *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  futex(&c->seq, FUTEX_WAKE, 1);
+}
+
+void
+cond_broadcast(struct cond *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  futex(&c->seq, FUTEX_WAKE, 0x7fffffff);
+}
+
+void
+barrier_init(struct barrier *b, int n)
+{
+  mutex_init(&b->lock);
+  cond_init(&b->cv);
+  b->n = n;
+  b->count = 0;
+  b->round = 0;
+}
+
+// Wait until n threads have called barrier_wait().
+// Returns 1 in exactly one of them, 0 in the rest.
+int
+barrier_wait(struct barrier *b)
+{
+  int round;
+
+  mutex_lock(&b->lock);
+  round = b->round;
+  if(++b->count == b->n){
+    b->count = 0;
+    b->round++;
+    cond_broadcast(&b->cv);
+    mutex_unlock(&b->lock);
+    return 1;
+  }
+  while(round == b->round)
+    cond_wait(&b->cv, &b->lock);
+  mutex_unlock(&b->lock);
+  return 0;
+}
@@ -1,5 +1,32 @@
 struct stat;
 struct rtcdate;
+struct spawn_action;
+struct lockstat;
+struct traceevent;
+struct klogmsg;
+struct profsample;
+struct rusage;
+struct procinfo;
+struct sysring;
+struct pollfd;
+struct epoll_event;
+struct iovec;
+
+struct mutex {
+  int state;
+};
+
+struct cond {
+  int seq;
+};
+
+struct barrier {
+  struct mutex lock;
+  struct cond cv;
+  int n;        // threads to wait for
+  int count;    // threads waiting in this round
+  int round;
+};
 
 // system calls
 int fork(void);
@@ -30,6 +57,34 @@ int umount(char*);
 int sigalarm(int, void*);
 int sigreturn(void);
 int symlink(char *, char *);
+int clone(void(*)(void*), void*, void*);
+int join(void**);
+int futex(int*, int, int);
+int spawn(char*, char**, struct spawn_action*);
+int vfork(void);
+int lockstat(struct lockstat*, int);
+int trace(int);
+int traceread(struct traceevent*, int);
+int profile(int, struct profsample*, int);
+int getrusage(int, struct rusage*);
+int getprocs(struct procinfo*, int);
+struct sysring* ringsetup(void);
+int ringenter(void);
+int poll(struct pollfd*, int, int);
+int epollcreate(void);
+int epollctl(int, int, int, struct epoll_event*);
+int epollwait(int, struct epoll_event*, int, int);
+int fcntl(int, int, int);
+int pread(int, void*, int, int);
+int pwrite(int, const void*, int, int);
+int readv(int, struct iovec*, int);
+int writev(int, struct iovec*, int);
+int fsync(int);
+int fdatasync(int);
+int lseek(int, int, int);
+int ftruncate(int, int);
+int fallocate(int, int, int);
+int dmesg(struct klogmsg*, int, uint64);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -47,3 +102,12 @@ void free(void*);
 int atoi(const char*);
 int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
+void mutex_init(struct mutex*);
+void mutex_lock(struct mutex*);
+void mutex_unlock(struct mutex*);
+void cond_init(struct cond*);
+void cond_wait(struct cond*, struct mutex*);
+void cond_signal(struct cond*);
+void cond_broadcast(struct cond*);
+void barrier_init(struct barrier*, int);
+int barrier_wait(struct barrier*);
@@ -7,6 +7,14 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/spawn.h"
+#include "kernel/stats.h"
+#include "kernel/rusage.h"
+#include "kernel/sysring.h"
+#include "kernel/poll.h"
+#include "kernel/futex.h"
+#include "kernel/uio.h"
+#include "kernel/klog.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -334,6 +342,839 @@ exectest(char *s)
 
 }
 
+// spawn() a child whose stdout is a pipe, set up with
+// file actions rather than in a forked copy of this process.
+void
+spawntest(char *s)
+{
+  int fds[2], pid, xstatus, n;
+  char *echoargv[] = { "echo", "OK", 0 };
+  char buf[4];
+  struct spawn_action acts[] = {
+    { SPAWN_DUP2, 0, 1 },
+    { SPAWN_CLOSE, 0, 0 },
+    { SPAWN_CLOSE, 0, 0 },
+    { 0, 0, 0 },
+  };
+
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  acts[0].fd = fds[1];
+  acts[1].fd = fds[0];
+  acts[2].fd = fds[1];
+  pid = spawn("echo", echoargv, acts);
+  if(pid < 0){
+    printf("%s: spawn failed\n", s);
+    exit(1);
+  }
+  close(fds[1]);
+  n = read(fds[0], buf, sizeof(buf));
+  close(fds[0]);
+  if(wait(&xstatus) != pid || xstatus != 0){
+    printf("%s: wait failed\n", s);
+    exit(1);
+  }
+  if(n != 3 || buf[0] != 'O' || buf[1] != 'K'){
+    printf("%s: wrong output\n", s);
+    exit(1);
+  }
+
+  if(spawn("nosuchprogram", echoargv, 0) >= 0){
+    printf("%s: spawn of missing program succeeded\n", s);
+    exit(1);
+  }
+  acts[0].fd = 99;
+  if(spawn("echo", echoargv, acts) >= 0){
+    printf("%s: spawn with bad fd succeeded\n", s);
+    exit(1);
+  }
+}
+
+// a vfork() child shares its parent's memory until it
+// exec()s or exit()s, and the parent waits until then.
+void
+vforktest(char *s)
+{
+  static volatile int shared;
+  char *argv[] = { "echo", "OK", 0 };
+  int pid, xstatus;
+
+  shared = 0;
+  pid = vfork();
+  if(pid < 0){
+    printf("%s: vfork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    shared = 1;
+    exit(7);
+  }
+  if(shared != 1){
+    printf("%s: vfork child's write not seen\n", s);
+    exit(1);
+  }
+  if(wait(&xstatus) != pid || xstatus != 7){
+    printf("%s: wait failed\n", s);
+    exit(1);
+  }
+
+  pid = vfork();
+  if(pid < 0){
+    printf("%s: vfork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    // the child's file table is its own.
+    close(1);
+    exec("echo", argv);
+    exit(1);
+  }
+  if(wait(&xstatus) != pid || xstatus != 0){
+    printf("%s: exec after vfork failed\n", s);
+    exit(1);
+  }
+}
+
+// program text is demand-paged read-only from the file's
+// page cache and shared, so writing it must kill the writer,
+// and the kernel must refuse to write it for read().
+void
+textwrite(char *s)
+{
+  int fd, pid, xstatus;
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    volatile int *addr = (int *) 0;
+    *addr = 10;
+    exit(1);
+  }
+  wait(&xstatus);
+  if(xstatus != -1){
+    printf("%s: write to text succeeded\n", s);
+    exit(1);
+  }
+
+  fd = open("README", O_RDONLY);
+  if(fd < 0){
+    printf("%s: open README failed\n", s);
+    exit(1);
+  }
+  if(read(fd, (void *) 0, 10) > 0){
+    printf("%s: read into text succeeded\n", s);
+    exit(1);
+  }
+  close(fd);
+}
+
+// read a struct kstats from the stats device.
+void
+readkstats(char *s, struct kstats *ks)
+{
+  int fd;
+
+  fd = open("statsdev", O_RDONLY);
+  if(fd < 0){
+    printf("%s: open statsdev failed\n", s);
+    exit(1);
+  }
+  if(read(fd, ks, sizeof(*ks)) != sizeof(*ks)){
+    printf("%s: short read of statsdev\n", s);
+    exit(1);
+  }
+  if(read(fd, ks, sizeof(*ks)) != 0){
+    printf("%s: read past end of statsdev\n", s);
+    exit(1);
+  }
+  close(fd);
+}
+
+// the stats device counts system calls.
+void
+statstest(char *s)
+{
+  struct kstats ks0, ks1;
+  int i;
+
+  unlink("statsdev");
+  if(mknod("statsdev", 2, 1) < 0){
+    printf("%s: mknod failed\n", s);
+    exit(1);
+  }
+  readkstats(s, &ks0);
+  for(i = 0; i < 10; i++)
+    getpid();
+  readkstats(s, &ks1);
+  unlink("statsdev");
+  if(ks1.syscall[SYS_getpid] < ks0.syscall[SYS_getpid] + 10){
+    printf("%s: getpid count went from %d to %d\n", s,
+           (int)ks0.syscall[SYS_getpid], (int)ks1.syscall[SYS_getpid]);
+    exit(1);
+  }
+}
+
+// getrusage() counts a child's faults and CPU time, and
+// wait() adds them to the parent's RUSAGE_CHILDREN.
+void
+rusagetest(char *s)
+{
+  struct rusage ru0, ru1, cru0, cru1;
+  volatile int spin;
+  char *p;
+  int i, pid, start, xstatus;
+
+  if(getrusage(RUSAGE_CHILDREN, &cru0) < 0){
+    printf("%s: getrusage failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    getrusage(RUSAGE_SELF, &ru0);
+    p = sbrk(4*4096);
+    for(i = 0; i < 4; i++)
+      p[i*4096] = 1;
+    start = uptime();
+    for(spin = 0; uptime() < start + 2; spin++)
+      ;
+    getrusage(RUSAGE_SELF, &ru1);
+    if(ru1.ru_minflt < ru0.ru_minflt + 4){
+      printf("%s: %d minor faults, expected 4\n", s,
+             (int)(ru1.ru_minflt - ru0.ru_minflt));
+      exit(1);
+    }
+    if(ru1.ru_utime == ru0.ru_utime){
+      printf("%s: no user time\n", s);
+      exit(1);
+    }
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+  getrusage(RUSAGE_CHILDREN, &cru1);
+  if(cru1.ru_minflt < cru0.ru_minflt + 4 || cru1.ru_utime == cru0.ru_utime){
+    printf("%s: child's usage not counted\n", s);
+    exit(1);
+  }
+  if(getrusage(2, &cru1) != -1){
+    printf("%s: getrusage(2) succeeded\n", s);
+    exit(1);
+  }
+}
+
+// system calls submitted through the ring run in order,
+// and each completion carries its submission's data.
+void
+ringtest(char *s)
+{
+  struct sysring *r;
+  struct cqe *c;
+  char out[4];
+  int fd, i;
+
+  r = ringsetup();
+  if(r == (struct sysring*)-1 || ringsetup() != r){
+    printf("%s: ringsetup failed\n", s);
+    exit(1);
+  }
+  unlink("ringfile");
+  fd = open("ringfile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 3; i++){
+    r->sq[r->sqtail % NSQE].num = SYS_write;
+    r->sq[r->sqtail % NSQE].arg[0] = fd;
+    r->sq[r->sqtail % NSQE].arg[1] = (uint64)"abc" + i;
+    r->sq[r->sqtail % NSQE].arg[2] = 1;
+    r->sq[r->sqtail % NSQE].data = 100 + i;
+    r->sqtail++;
+  }
+  // fork() can't be batched.
+  r->sq[r->sqtail % NSQE].num = SYS_fork;
+  r->sq[r->sqtail % NSQE].data = 200;
+  r->sqtail++;
+  if(ringenter() != 4 || r->cqtail - r->cqhead != 4){
+    printf("%s: ringenter ran %d\n", s, r->cqtail - r->cqhead);
+    exit(1);
+  }
+  for(i = 0; i < 4; i++){
+    c = &r->cq[r->cqhead++ % NCQE];
+    if(i < 3 && (c->data != 100 + i || c->ret != 1)){
+      printf("%s: write %d returned %d\n", s, i, (int)c->ret);
+      exit(1);
+    }
+    if(i == 3 && (c->data != 200 || (int)c->ret != -1)){
+      printf("%s: batched fork returned %d\n", s, (int)c->ret);
+      exit(1);
+    }
+  }
+  close(fd);
+  fd = open("ringfile", O_RDONLY);
+  if(read(fd, out, sizeof(out)) != 3 || out[0] != 'a' || out[1] != 'b' || out[2] != 'c'){
+    printf("%s: wrong file contents\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("ringfile");
+}
+
+// asynchronous file writes and reads complete in order,
+// after ringenter() has returned.
+void
+aiotest(char *s)
+{
+  enum { N=4, SZ=2048 };
+  static char buf[N][SZ], in[N][SZ];
+  struct sysring *r;
+  struct sqe *e;
+  struct cqe *c;
+  int fd, i, j, seen;
+
+  r = ringsetup();
+  if(r == (struct sysring*)-1){
+    printf("%s: ringsetup failed\n", s);
+    exit(1);
+  }
+  unlink("aiofile");
+  fd = open("aiofile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    memset(buf[i], 'a' + i, SZ);
+    e = &r->sq[r->sqtail % NSQE];
+    e->num = SYS_write;
+    e->flags = SQE_ASYNC;
+    e->arg[0] = fd;
+    e->arg[1] = (uint64)buf[i];
+    e->arg[2] = SZ;
+    e->data = i;
+    r->sqtail++;
+  }
+  if(ringenter() != N){
+    printf("%s: ringenter failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    while((seen = r->cqtail) == r->cqhead)
+      futex((int*)&r->cqtail, FUTEX_WAIT, seen);
+    c = &r->cq[r->cqhead++ % NCQE];
+    if(c->data != i || c->ret != SZ){
+      printf("%s: write %d returned %d\n", s, (int)c->data, (int)c->ret);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  fd = open("aiofile", O_RDONLY);
+  for(i = 0; i < N; i++){
+    e = &r->sq[r->sqtail % NSQE];
+    e->num = SYS_read;
+    e->flags = SQE_ASYNC;
+    e->arg[0] = fd;
+    e->arg[1] = (uint64)in[i];
+    e->arg[2] = SZ;
+    e->data = i;
+    r->sqtail++;
+  }
+  ringenter();
+  for(i = 0; i < N; i++){
+    while((seen = r->cqtail) == r->cqhead)
+      futex((int*)&r->cqtail, FUTEX_WAIT, seen);
+    c = &r->cq[r->cqhead++ % NCQE];
+    if(c->data != i || c->ret != SZ){
+      printf("%s: read %d returned %d\n", s, (int)c->data, (int)c->ret);
+      exit(1);
+    }
+    for(j = 0; j < SZ; j++){
+      if(in[i][j] != 'a' + i){
+        printf("%s: wrong data in read %d\n", s, i);
+        exit(1);
+      }
+    }
+  }
+  close(fd);
+  unlink("aiofile");
+}
+
+// writev() and readv() move several buffers at once, and
+// pread() and pwrite() leave the file offset alone.
+void
+preadtest(char *s)
+{
+  struct iovec iov[3];
+  char a[5], b[3], c[4];
+  int fd, fds[2];
+
+  unlink("preadfile");
+  fd = open("preadfile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  iov[0].iov_base = "hello";
+  iov[0].iov_len = 5;
+  iov[1].iov_base = "";
+  iov[1].iov_len = 0;
+  iov[2].iov_base = "world";
+  iov[2].iov_len = 5;
+  if(writev(fd, iov, 3) != 10){
+    printf("%s: writev failed\n", s);
+    exit(1);
+  }
+  if(pwrite(fd, "W", 1, 5) != 1 || pread(fd, c, 4, 4) != 4 || memcmp(c, "oWor", 4) != 0){
+    printf("%s: pread of pwrite's data failed\n", s);
+    exit(1);
+  }
+  // the offset is still at the end.
+  if(write(fd, "!", 1) != 1 || pread(fd, c, 4, 8) != 3 || memcmp(c, "ld!", 3) != 0){
+    printf("%s: pwrite moved the offset\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("preadfile", O_RDONLY);
+  iov[0].iov_base = a;
+  iov[0].iov_len = sizeof(a);
+  iov[1].iov_base = b;
+  iov[1].iov_len = sizeof(b);
+  if(readv(fd, iov, 2) != 8 || memcmp(a, "hello", 5) != 0 || memcmp(b, "Wor", 3) != 0){
+    printf("%s: readv failed\n", s);
+    exit(1);
+  }
+  if(read(fd, c, sizeof(c)) != 3 || memcmp(c, "ld!", 3) != 0){
+    printf("%s: readv left the wrong offset\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("preadfile");
+
+  // pipes have no offsets.
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  if(pwrite(fds[1], "x", 1, 0) != -1){
+    printf("%s: pwrite to a pipe succeeded\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// file data is written back later; check that fsync() writes
+// it, that what's read meanwhile is what was written, and that
+// a file unlinked before it's written back goes away cleanly.
+void
+fsynctest(char *s)
+{
+  enum { NPAGE=40 };
+  static char buf[4096];
+  int fd, fds[2], i, j;
+
+  unlink("fsyncfile");
+  fd = open("fsyncfile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < NPAGE; i++){
+    memset(buf, 'a' + i % 26, sizeof(buf));
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+  if(fsync(fd) != 0){
+    printf("%s: fsync failed\n", s);
+    exit(1);
+  }
+  memset(buf, 'Z', 100);
+  if(pwrite(fd, buf, 100, 4096*7 + 4000) != 100 || fdatasync(fd) != 0){
+    printf("%s: fdatasync failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("fsyncfile", O_RDONLY);
+  for(i = 0; i < NPAGE; i++){
+    if(read(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf("%s: read failed\n", s);
+      exit(1);
+    }
+    for(j = 0; j < sizeof(buf); j++){
+      if(buf[j] != ((i == 7 && j >= 4000) || (i == 8 && j < 4) ? 'Z' : 'a' + i % 26)){
+        printf("%s: wrong data in page %d at %d\n", s, i, j);
+        exit(1);
+      }
+    }
+  }
+  close(fd);
+  unlink("fsyncfile");
+
+  fd = open("fsyncfile", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, buf, sizeof(buf)) != sizeof(buf)){
+    printf("%s: rewrite failed\n", s);
+    exit(1);
+  }
+  unlink("fsyncfile");
+  close(fd);
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  if(fsync(fds[1]) != -1){
+    printf("%s: fsync of a pipe succeeded\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// holes left by seeking past the end or by ftruncate() read
+// as zeros, shrinking drops what was past the new end, and
+// fallocate() grows a file with zeros.
+void
+sparsetest(char *s)
+{
+  static char buf[4096];
+  struct stat st;
+  int fd, fds[2], i;
+
+  unlink("sparsefile");
+  fd = open("sparsefile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  if(write(fd, "abcdefghijklmno", 15) != 15 || lseek(fd, 300000, SEEK_SET) != 300000 ||
+     write(fd, "x", 1) != 1){
+    printf("%s: write past the end failed\n", s);
+    exit(1);
+  }
+  if(fstat(fd, &st) < 0 || st.size != 300001 || lseek(fd, 0, SEEK_END) != 300001){
+    printf("%s: wrong size after writing past the end\n", s);
+    exit(1);
+  }
+  for(i = 4096; i < 300000 - sizeof(buf); i += sizeof(buf)){
+    if(pread(fd, buf, sizeof(buf), i) != sizeof(buf) || buf[0] || buf[sizeof(buf)-1]){
+      printf("%s: hole at %d doesn't read as zeros\n", s, i);
+      exit(1);
+    }
+  }
+  if(pread(fd, buf, 2, 299999) != 2 || buf[0] != 0 || buf[1] != 'x' ||
+     pread(fd, buf, 1, 400000) != 0){
+    printf("%s: wrong data at the end\n", s);
+    exit(1);
+  }
+
+  if(ftruncate(fd, 10) != 0 || ftruncate(fd, 5000) != 0 ||
+     fstat(fd, &st) < 0 || st.size != 5000){
+    printf("%s: ftruncate failed\n", s);
+    exit(1);
+  }
+  if(pread(fd, buf, 15, 0) != 15 || memcmp(buf, "abcdefghij\0\0\0\0\0", 15) != 0){
+    printf("%s: ftruncate kept data past the end\n", s);
+    exit(1);
+  }
+
+  if(fallocate(fd, 0, 64*1024) != 0 || fstat(fd, &st) < 0 || st.size != 64*1024 ||
+     pread(fd, buf, sizeof(buf), 60*1024) != sizeof(buf) || buf[0] || buf[sizeof(buf)-1]){
+    printf("%s: fallocate failed\n", s);
+    exit(1);
+  }
+  if(pread(fd, buf, 10, 0) != 10 || memcmp(buf, "abcdefghij", 10) != 0){
+    printf("%s: fallocate changed data\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("sparsefile");
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  if(lseek(fds[0], 0, SEEK_SET) != -1 || ftruncate(fds[1], 0) != -1){
+    printf("%s: seek or truncate of a pipe succeeded\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// a big file is freed a transaction at a time, by ftruncate()
+// itself, or once it's unlinked, in the background; check that
+// both free it all, and that shrinking forgets the old data.
+void
+bigtrunc(char *s)
+{
+  enum { BIG=2*1024*1024 };
+  struct stat st;
+  char buf[8];
+  int fd, i;
+
+  for(i = 0; i < 6; i++){
+    unlink("bigtrunc");
+    fd = open("bigtrunc", O_CREATE|O_RDWR);
+    if(fd < 0){
+      printf("%s: open failed\n", s);
+      exit(1);
+    }
+    if(fallocate(fd, 0, BIG) != 0 || pwrite(fd, "start", 5, 0) != 5 ||
+       pwrite(fd, "end", 3, BIG-3) != 3){
+      printf("%s: fallocate failed\n", s);
+      exit(1);
+    }
+    if(i % 2 == 0){
+      // unlink it whole.
+      close(fd);
+      unlink("bigtrunc");
+      continue;
+    }
+    if(ftruncate(fd, 3000) != 0 || fstat(fd, &st) < 0 || st.size != 3000 ||
+       pread(fd, buf, 5, 0) != 5 || memcmp(buf, "start", 5) != 0){
+      printf("%s: shrinking failed\n", s);
+      exit(1);
+    }
+    if(ftruncate(fd, BIG) != 0 || pread(fd, buf, 3, BIG-3) != 3 ||
+       buf[0] || buf[1] || buf[2]){
+      printf("%s: old data came back\n", s);
+      exit(1);
+    }
+    if(ftruncate(fd, 0) != 0){
+      printf("%s: ftruncate to 0 failed\n", s);
+      exit(1);
+    }
+    close(fd);
+    unlink("bigtrunc");
+  }
+}
+
+// the kernel log holds at least the boot messages, in order,
+// and reading past its end returns nothing.
+void
+dmesgtest(char *s)
+{
+  static struct klogmsg m[16];
+  uint64 seq;
+  int i, n, total;
+
+  seq = 0;
+  total = 0;
+  while((n = dmesg(m, 16, seq)) > 0){
+    for(i = 0; i < n; i++){
+      if((total > 0 || i > 0) && m[i].seq != seq){
+        printf("%s: message %d after %d\n", s, (int)m[i].seq, (int)seq - 1);
+        exit(1);
+      }
+      if(m[i].level >= NKLEVEL || strlen(m[i].text) >= KLOGMSG){
+        printf("%s: bad message\n", s);
+        exit(1);
+      }
+      seq = m[i].seq + 1;
+    }
+    total += n;
+  }
+  if(n < 0 || total == 0){
+    printf("%s: dmesg returned %d after %d\n", s, n, total);
+    exit(1);
+  }
+  if(dmesg(m, 16, seq + 1000) != 0){
+    printf("%s: read past the end\n", s);
+    exit(1);
+  }
+}
+
+// stream enough through a pipe in odd-sized pieces that
+// its ring grows, and check that nothing is lost or reordered.
+void
+pipebig(char *s)
+{
+  enum { TOTAL=200*1024, WSZ=3001, RSZ=777 };
+  static char wbuf[WSZ], rbuf[RSZ];
+  int fds[2], pid, xstatus, i, n, m, total;
+  uint seq;
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[0]);
+    seq = 0;
+    for(total = 0; total < TOTAL; total += n){
+      n = TOTAL - total < WSZ ? TOTAL - total : WSZ;
+      for(i = 0; i < n; i++)
+        wbuf[i] = seq++ * 7;
+      if(write(fds[1], wbuf, n) != n){
+        printf("%s: short pipe write\n", s);
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+  close(fds[1]);
+  seq = 0;
+  total = 0;
+  while((m = read(fds[0], rbuf, RSZ)) > 0){
+    for(i = 0; i < m; i++){
+      if(rbuf[i] != (char)(seq++ * 7)){
+        printf("%s: wrong byte at %d\n", s, total + i);
+        exit(1);
+      }
+    }
+    total += m;
+  }
+  close(fds[0]);
+  wait(&xstatus);
+  if(total != TOTAL){
+    printf("%s: read %d bytes, expected %d\n", s, total, TOTAL);
+    exit(1);
+  }
+  exit(xstatus);
+}
+
+// poll() and an epoll set report which of two pipes has data,
+// wait for a child to write, and see the writer hang up.
+void
+polltest(char *s)
+{
+  int a[2], b[2], ep, pid, xstatus;
+  struct pollfd pfd[2];
+  struct epoll_event ev, evs[4];
+  char c;
+
+  if(pipe(a) != 0 || pipe(b) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  pfd[0].fd = a[0];
+  pfd[0].events = POLLIN;
+  pfd[1].fd = b[0];
+  pfd[1].events = POLLIN;
+  if(poll(pfd, 2, 0) != 0){
+    printf("%s: empty pipes polled ready\n", s);
+    exit(1);
+  }
+  write(b[1], "x", 1);
+  if(poll(pfd, 2, 0) != 1 || pfd[0].revents != 0 || pfd[1].revents != POLLIN){
+    printf("%s: poll missed data\n", s);
+    exit(1);
+  }
+  read(b[0], &c, 1);
+
+  ep = epollcreate();
+  if(ep < 0){
+    printf("%s: epollcreate failed\n", s);
+    exit(1);
+  }
+  ev.events = POLLIN;
+  ev.data = 100;
+  if(epollctl(ep, EPOLL_CTL_ADD, a[0], &ev) < 0){
+    printf("%s: epollctl failed\n", s);
+    exit(1);
+  }
+  ev.data = 200;
+  if(epollctl(ep, EPOLL_CTL_ADD, b[0], &ev) < 0 ||
+     epollctl(ep, EPOLL_CTL_ADD, b[0], &ev) != -1){
+    printf("%s: epollctl add twice\n", s);
+    exit(1);
+  }
+  if(epollwait(ep, evs, 4, 2) != 0){
+    printf("%s: epollwait didn't time out\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    sleep(2);
+    write(a[1], "y", 1);
+    exit(0);
+  }
+  close(a[1]);
+  // the child may have exited by the time we look.
+  if(epollwait(ep, evs, 4, -1) != 1 || evs[0].data != 100 ||
+     (evs[0].events & ~POLLHUP) != POLLIN){
+    printf("%s: epollwait missed child's write\n", s);
+    exit(1);
+  }
+  wait(&xstatus);
+  read(a[0], &c, 1);
+  // the child has exited, so no one can write to a.
+  if(epollwait(ep, evs, 4, 0) != 1 || evs[0].events != (POLLIN|POLLHUP)){
+    printf("%s: epollwait missed hangup\n", s);
+    exit(1);
+  }
+  close(ep);
+  exit(xstatus);
+}
+
+// O_NONBLOCK pipe ends fail instead of waiting, and a
+// non-blocking write stops when the pipe is full.
+void
+nonblocktest(char *s)
+{
+  static char buf[4096];
+  int fds[2], n, total;
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  if(fcntl(fds[0], F_SETFL, O_NONBLOCK) < 0 || fcntl(fds[1], F_SETFL, O_NONBLOCK) < 0 ||
+     fcntl(fds[0], F_GETFL, 0) != O_NONBLOCK){
+    printf("%s: fcntl failed\n", s);
+    exit(1);
+  }
+  if(read(fds[0], buf, 1) != -1){
+    printf("%s: read of empty pipe didn't fail\n", s);
+    exit(1);
+  }
+  total = 0;
+  while((n = write(fds[1], buf, sizeof(buf))) > 0){
+    total += n;
+    if(total > 1024*1024){
+      printf("%s: pipe never filled\n", s);
+      exit(1);
+    }
+  }
+  if(total == 0){
+    printf("%s: nothing written\n", s);
+    exit(1);
+  }
+  while((n = read(fds[0], buf, sizeof(buf))) > 0)
+    total -= n;
+  if(total != 0){
+    printf("%s: %d bytes lost\n", s, total);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+}
+
 // simple fork and pipe read/write
 
 void
@@ -2141,6 +2982,18 @@ main(int argc, char *argv[])
     {fourfiles, "fourfiles"},
     {sharedfd, "sharedfd"},
     {exectest, "exectest"},
+    {spawntest, "spawntest"},
+    {vforktest, "vforktest"},
+    {textwrite, "textwrite"},
+    {statstest, "statstest"},
+    {rusagetest, "rusagetest"},
+    {ringtest, "ringtest"},
+    {aiotest, "aiotest"},
+    {preadtest, "preadtest"},
+    {fsynctest, "fsynctest"},
+    {sparsetest, "sparsetest"},
+    {bigtrunc, "bigtrunc"},
+    {dmesgtest, "dmesgtest"},
     {bigargtest, "bigargtest"},
     {bigwrite, "bigwrite"},
     {bsstest, "bsstest"},
@@ -2160,6 +3013,9 @@ main(int argc, char *argv[])
     {iputtest, "iput"},
     // {mem, "mem"},
     {pipe1, "pipe1"},
+    {pipebig, "pipebig"},
+    {polltest, "polltest"},
+    {nonblocktest, "nonblocktest"},
     {preempt, "preempt"},
     {exitwait, "exitwait"},
     {rmdot, "rmdot"},
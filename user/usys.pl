@@ -43,3 +43,31 @@ entry("ntas");
 entry("sigalarm");
 entry("sigreturn");
 entry("symlink");
+entry("clone");
+entry("join");
+entry("futex");
+entry("spawn");
+entry("vfork");
+entry("lockstat");
+entry("trace");
+entry("traceread");
+entry("profile");
+entry("getrusage");
+entry("getprocs");
+entry("ringsetup");
+entry("ringenter");
+entry("poll");
+entry("epollcreate");
+entry("epollctl");
+entry("epollwait");
+entry("fcntl");
+entry("pread");
+entry("pwrite");
+entry("readv");
+entry("writev");
+entry("fsync");
+entry("fdatasync");
+entry("lseek");
+entry("ftruncate");
+entry("fallocate");
+entry("dmesg");